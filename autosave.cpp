@@ -0,0 +1,110 @@
+#include "stdafx.h"
+#include "autosave.h"
+#include "profiler.h"
+#include "trace.h"
+#include <iostream>
+
+Autosave::Autosave(){
+}
+
+Autosave::~Autosave(){
+	stop();
+}
+
+void Autosave::start(const std::string& _vfile, const std::string& _sfile){
+	vfile = _vfile;
+	sfile = _sfile;
+	running = true;
+	lastsubmit = clock.getElapsedTime();
+	lastsave = lastsubmit;
+	thread = std::thread(&Autosave::worker, this);
+}
+
+// Writes anything still pending and joins the worker.
+void Autosave::stop(){
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!running){
+			return;
+		}
+		running = false;
+	}
+	wakecv.notify_one();
+	if (thread.joinable()){
+		thread.join();
+	}
+}
+
+void Autosave::submit(const Document& doc){
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pending = doc;
+		lastsubmit = clock.getElapsedTime();
+		if (!haspending){
+			pendingqueued = lastsubmit;
+		}
+		haspending = true;
+	}
+	wakecv.notify_one();
+}
+
+void Autosave::flush(){
+	std::unique_lock<std::mutex> lock(mutex);
+	idlecv.wait(lock, [this]{ return !haspending && !busy; });
+}
+
+bool Autosave::due(){
+	std::lock_guard<std::mutex> lock(mutex);
+	return interval > 0 && (clock.getElapsedTime() - lastsubmit).asSeconds() >= interval;
+}
+
+AutosaveStats Autosave::getStats(){
+	std::lock_guard<std::mutex> lock(mutex);
+	AutosaveStats result = stats;
+	result.sinceLastSave = (clock.getElapsedTime() - lastsave).asSeconds() * 1000.0f;
+	result.busy = busy || haspending;
+	return result;
+}
+
+void Autosave::worker(){
+	Tracer::nameThread("Autosave");
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true){
+		wakecv.wait(lock, [this]{ return haspending || !running; });
+		if (!haspending){
+			break;
+		}
+		Document doc;
+		std::swap(doc, pending);
+		sf::Time queued = pendingqueued;
+		haspending = false;
+		busy = true;
+		lock.unlock();
+
+		sf::Clock writeclock;
+		TraceScope scope("Write checkpoint", "io");
+		bool ok;
+		{
+			ProfileScope svgscope(PHASE_SAVEVECTOR);
+			ok = writeFileAtomic(sfile, documentToSVG(doc));
+		}
+		ok = writeFileAtomic(vfile, documentToJSON(doc)) && ok;
+		float writetime = writeclock.getElapsedTime().asSeconds() * 1000.0f;
+		if (!ok){
+			std::cout << "Autosave failed to write " << vfile << "\n";
+		}
+
+		lock.lock();
+		busy = false;
+		lastsave = clock.getElapsedTime();
+		stats.lastFailed = !ok;
+		if (ok){
+			stats.savedSequence = doc.sequence;
+		}
+		stats.lastWriteTime = writetime;
+		stats.lastLatency = (lastsave - queued).asSeconds() * 1000.0f;
+		stats.saveCount++;
+		idlecv.notify_all();
+	}
+	idlecv.notify_all();
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "stdafx.h"
+#include "document.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Timings shown in the status panel, in milliseconds.
+struct AutosaveStats {
+	float lastLatency   = 0; // submit -> both files renamed into place
+	float lastWriteTime = 0; // time spent serializing and writing
+	float sinceLastSave = 0;
+	int   saveCount  = 0;
+	unsigned savedSequence = 0; // Document::sequence of the last successful save
+	bool  lastFailed = false;
+	bool  busy       = false;
+};
+
+// Writes document snapshots to disk on a worker thread.
+// The editor only pays for copying the snapshot; if a new snapshot
+// arrives while one is still pending, the older one is dropped.
+class Autosave {
+public:
+	Autosave();
+	~Autosave();
+
+	void start(const std::string& _vfile, const std::string& _sfile);
+	void stop();
+	// Queue a snapshot for writing. Never blocks on disk.
+	void submit(const Document& doc);
+	// Block until every queued snapshot is on disk.
+	void flush();
+	// True once interval seconds passed since the last submit.
+	bool due();
+
+	// Copy of the stats below, taken under the lock.
+	AutosaveStats getStats();
+
+	// Seconds between periodic autosaves, 0 disables them.
+	// Only touched from the editor thread.
+	int interval = 60;
+
+private:
+	void worker();
+
+	std::string vfile;
+	std::string sfile;
+	std::thread thread;
+	std::mutex  mutex;
+	std::condition_variable wakecv;
+	std::condition_variable idlecv;
+	Document pending;
+	bool haspending = false;
+	bool busy       = false;
+	bool running    = false;
+	AutosaveStats stats;
+	sf::Clock clock;         // Never restarted, timestamps below are relative to it
+	sf::Time  lastsubmit;    // Used for due()
+	sf::Time  lastsave;
+	sf::Time  pendingqueued; // When the pending snapshot was first queued
+};
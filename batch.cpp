@@ -0,0 +1,662 @@
+#include "stdafx.h"
+#include "batch.h"
+#include "delaunay.h"
+#include "document.h"
+#include "flips.h"
+#include "journal.h"
+#include "memory.h"
+#include "metrics.h"
+#include "palette.h"
+#include "parallel.h"
+#include "refine.h"
+#include "sampler.h"
+#include "seeding.h"
+#include "shading.h"
+#include "simplify.h"
+#include "threadpool.h"
+#include "trace.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <sstream>
+
+void printUsage(const char* program){
+	printf("Usage:\n");
+	printf("  %s [aalevel] [--threads N] [--trace FILE] [--record FILE | --replay FILE] [--budget LIST]\n", program);
+	printf("                  open the editor, with N worker threads, recording a trace to FILE;\n");
+	printf("                  --record logs the input to FILE, --replay plays it back and reports\n");
+	printf("                  the frame times; --budget as for batch, shown on F5\n");
+	printf("  %s --batch [options] image...\n", program);
+	printf("  %s --bench [options]\n\n", program);
+	printf("Batch options:\n");
+	printf("  --mesh FILE     use FILE instead of <image>.vertices (one image only)\n");
+	printf("  --recolor       re-average every polygon color from the image\n");
+	printf("  --samples N     color samples per polygon for --recolor (default 10)\n");
+	printf("  --seed N        seed for --recolor sampling (default 1)\n");
+	printf("  --generate N    place N points from image detail and triangulate every point\n");
+	printf("  --contrast C    0 spreads generated points evenly, 1 packs them on edges (default 0.8)\n");
+	printf("  --refine N      triangulate every point, then split the worst matching polygons\n");
+	printf("                  until there are N (adds points, colors are exact means)\n");
+	printf("  --max-error E   leave polygons with an RMS color error below E (default 4)\n");
+	printf("  --keep-edges C  keep the existing polygon edges when triangulating, those with\n");
+	printf("                  a color change of at least C across them (0 keeps all)\n");
+	printf("  --flip          flip polygon diagonals that lower the color error\n");
+	printf("  --palette N     quantize the polygon colors to N colors (k-means), or with\n");
+	printf("                  a list like #102030,#ffeedd snap them to those colors\n");
+	printf("  --gouraud       sample a color at every point and shade the polygons with\n");
+	printf("                  them (SVG gets a gradient per polygon)\n");
+	printf("  --simplify N,.. also write <image>.<N>.vertices/.svg simplified to N polygons\n");
+	printf("  --metrics       report PSNR and SSIM of the mesh (and --simplify copies)\n");
+	printf("  --validate      report bad indices, degenerate and duplicate polygons\n");
+	printf("  --svg           write <image>.svg\n");
+	printf("  --png           write <image>.lowpoly.png\n");
+	printf("  --scale S       PNG scale (default 1)\n");
+	printf("  --ss N          PNG supersampling per axis (default 4)\n");
+	printf("  --convert       write the mesh back as a fresh .vertices, merging its journal\n");
+	printf("  --out DIR       write outputs to DIR instead of next to each image\n");
+	printf("  --jobs N        images processed at once (default: one per thread)\n");
+	printf("  --threads N     threads working in total (default: one per core)\n");
+	printf("  --trace FILE    record what every thread does to FILE (Chrome trace JSON)\n");
+	printf("  --budget LIST   warn when memory goes over a budget in MB, like heap=4096,json=512\n");
+	printf("                  (heap, image, texture, points, polygons, shapes, frames, json, imgui)\n\n");
+	printf("Bench options:\n");
+	printf("  --mesh M,..     random, grid and/or delaunay (default all three)\n");
+	printf("  --max N         largest mesh in triangles, from 1000 up by 10x (default 1000000)\n");
+	printf("  --reps N        timings per operation, the median is reported (default 5)\n");
+	printf("  --samples N     color samples per polygon for avgClr (default 10)\n");
+	printf("  --seed N        seed for the meshes and sampling (default 1)\n");
+	printf("  --out FILE      write the results to FILE as JSON\n");
+	printf("  --compare FILE  compare with earlier --out results, exit 1 on a regression\n");
+	printf("  --tolerance P   percent slower that counts as a regression (default 10)\n");
+	printf("  --scratch DIR   where to save and load the test files (default .)\n");
+}
+
+bool isBatchCommand(int argc, char* argv[]){
+	for (int i = 1; i < argc; i++){
+		if (strcmp(argv[i], "--batch") == 0){
+			return true;
+		}
+	}
+	return false;
+}
+
+bool parseBatchArgs(int argc, char* argv[], BatchOptions& options){
+	for (int i = 1; i < argc; i++){
+		std::string arg = argv[i];
+		bool hasvalue = i + 1 < argc;
+		if (arg == "--batch"){
+		}
+		else if (arg == "--recolor"){
+			options.recolor = true;
+		}
+		else if (arg == "--validate"){
+			options.validate = true;
+		}
+		else if (arg == "--svg"){
+			options.svg = true;
+		}
+		else if (arg == "--png"){
+			options.png = true;
+		}
+		else if (arg == "--convert"){
+			options.convert = true;
+		}
+		else if (arg == "--mesh" && hasvalue){
+			options.mesh = argv[++i];
+		}
+		else if (arg == "--out" && hasvalue){
+			options.outdir = argv[++i];
+		}
+		else if (arg == "--generate" && hasvalue){
+			options.generate = std::max(0, atoi(argv[++i]));
+		}
+		else if (arg == "--contrast" && hasvalue){
+			options.contrast = (float)atof(argv[++i]);
+		}
+		else if (arg == "--refine" && hasvalue){
+			options.refine = std::max(0, atoi(argv[++i]));
+		}
+		else if (arg == "--max-error" && hasvalue){
+			options.maxerror = (float)atof(argv[++i]);
+		}
+		else if (arg == "--keep-edges" && hasvalue){
+			options.keepedges = std::max(0, atoi(argv[++i]));
+		}
+		else if (arg == "--flip"){
+			options.flip = true;
+		}
+		else if (arg == "--simplify" && hasvalue){
+			std::istringstream levels(argv[++i]);
+			std::string level;
+			while (std::getline(levels, level, ',')){
+				int triangles = atoi(level.c_str());
+				if (triangles <= 0){
+					printf("--simplify takes positive polygon counts, got %s\n", level.c_str());
+					return false;
+				}
+				options.simplify.push_back(triangles);
+			}
+		}
+		else if (arg == "--metrics"){
+			options.metrics = true;
+		}
+		else if (arg == "--gouraud"){
+			options.gouraud = true;
+		}
+		else if (arg == "--palette" && hasvalue){
+			std::string value = argv[++i];
+			if (value.find_first_not_of("0123456789") == std::string::npos){
+				options.palette = atoi(value.c_str());
+			}
+			else if (!parsePalette(value, options.fixedpalette)){
+				printf("--palette takes a color count or #rrggbb colors, got %s\n", value.c_str());
+				return false;
+			}
+			if (options.palette <= 0 && options.fixedpalette.empty()){
+				printf("--palette needs at least one color\n");
+				return false;
+			}
+		}
+		else if (arg == "--samples" && hasvalue){
+			options.samples = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--seed" && hasvalue){
+			options.seed = (unsigned)strtoul(argv[++i], NULL, 10);
+		}
+		else if (arg == "--scale" && hasvalue){
+			options.raster.scale = (float)atof(argv[++i]);
+		}
+		else if (arg == "--ss" && hasvalue){
+			options.raster.supersample = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--jobs" && hasvalue){
+			options.jobs = std::max(0, atoi(argv[++i]));
+		}
+		else if (arg == "--threads" && hasvalue){
+			options.threads = std::max(0, atoi(argv[++i]));
+		}
+		else if (arg == "--trace" && hasvalue){
+			options.trace = argv[++i];
+		}
+		else if (arg == "--budget" && hasvalue){
+			// Budgets are global, set here rather than kept in options
+			if (!Memory::parseBudgets(argv[++i])){
+				return false;
+			}
+		}
+		else if (arg.size() > 1 && arg[0] == '-'){
+			printf("Unknown or incomplete option %s\n", arg.c_str());
+			return false;
+		}
+		else {
+			options.images.push_back(arg);
+		}
+	}
+	if (options.images.empty()){
+		printf("No images given\n");
+		return false;
+	}
+	if (!options.mesh.empty() && options.images.size() > 1){
+		printf("--mesh only works with a single image\n");
+		return false;
+	}
+	if (options.raster.scale <= 0){
+		printf("--scale must be positive\n");
+		return false;
+	}
+	return true;
+}
+
+// Strips the extension the same way Engine::load does, and moves the
+// result into outdir if one was given.
+static std::string outputBase(const std::string& image, const std::string& outdir){
+	size_t slash = image.find_last_of("/\\");
+	size_t dot = image.find_last_of(".");
+	std::string base = (dot != std::string::npos && (slash == std::string::npos || dot > slash)) ? image.substr(0, dot) : image;
+	if (outdir.empty()){
+		return base;
+	}
+	std::string name = slash == std::string::npos ? base : base.substr(slash + 1);
+	return outdir + "/" + name;
+}
+
+// Checks a mesh for problems. Returns the number of errors; warnings are
+// only reported.
+static int validateDocument(const Document& doc, std::ostream& log){
+	int errors = 0;
+	int npoints = (int)doc.points.size();
+	std::vector<bool> used(npoints, false);
+	int outside = 0;
+	for (int i = 0; i < npoints; i++){
+		const sf::Vector2f& v = doc.points[i].vector;
+		if (!std::isfinite(v.x) || !std::isfinite(v.y)){
+			log << "  error: point " << i << " has a non-finite position\n";
+			errors++;
+		}
+		else if (v.x < 0 || v.y < 0 || v.x > doc.size.x || v.y > doc.size.y){
+			outside++;
+		}
+	}
+	std::set<std::array<int, 3> > seen;
+	int degenerate = 0;
+	int duplicates = 0;
+	for (unsigned p = 0; p < doc.polygons.size(); p++){
+		const DocPoly& poly = doc.polygons[p];
+		bool valid = true;
+		for (int j = 0; j < 3; j++){
+			if (poly.sa[j] < 0 || poly.sa[j] >= npoints){
+				log << "  error: polygon " << p << " uses missing point " << poly.sa[j] << "\n";
+				errors++;
+				valid = false;
+			}
+		}
+		if (!valid){
+			continue;
+		}
+		if (poly.sa[0] == poly.sa[1] || poly.sa[1] == poly.sa[2] || poly.sa[0] == poly.sa[2]){
+			log << "  error: polygon " << p << " uses the same point twice\n";
+			errors++;
+			continue;
+		}
+		for (int j = 0; j < 3; j++){
+			used[poly.sa[j]] = true;
+		}
+		const sf::Vector2f& a = doc.points[poly.sa[0]].vector;
+		const sf::Vector2f& b = doc.points[poly.sa[1]].vector;
+		const sf::Vector2f& c = doc.points[poly.sa[2]].vector;
+		double area = (b.x - a.x) * (double)(c.y - a.y) - (b.y - a.y) * (double)(c.x - a.x);
+		if (std::abs(area) < 1e-6){
+			degenerate++;
+		}
+		std::array<int, 3> key = {{ poly.sa[0], poly.sa[1], poly.sa[2] }};
+		std::sort(key.begin(), key.end());
+		if (!seen.insert(key).second){
+			duplicates++;
+		}
+	}
+	int unused = (int)std::count(used.begin(), used.end(), false);
+	if (outside > 0){
+		log << "  warning: " << outside << " points outside the image (clamped on save)\n";
+	}
+	if (degenerate > 0){
+		log << "  warning: " << degenerate << " polygons with zero area\n";
+	}
+	if (duplicates > 0){
+		log << "  warning: " << duplicates << " duplicate polygons\n";
+	}
+	if (unused > 0){
+		log << "  note: " << unused << " points not used by any polygon\n";
+	}
+	log << "  validate: " << errors << " errors\n";
+	return errors;
+}
+
+// Replaces the polygons with the Delaunay triangulation of every point.
+// keepedges >= 0 keeps the edges of the old polygons with at least that
+// color contrast across them. With refine, the worst matching triangles are
+// then split (adding points) and the polygons get their exact mean color;
+// otherwise colors are left for recoloring. Returns the number of polygons.
+static int triangulateDocument(Document& doc, const sf::Image& img, int keepedges, const RefineOptions* refine, int threads, std::ostream& log){
+	float w = (float)doc.size.x;
+	float h = (float)doc.size.y;
+	if (refine != NULL && doc.points.size() < 3){
+		sf::Vector2f corners[4] = { sf::Vector2f(0, 0), sf::Vector2f(w, 0), sf::Vector2f(w, h), sf::Vector2f(0, h) };
+		for (int i = 0; i < 4; i++){
+			DocPoint p;
+			p.vector = corners[i];
+			p.size = 5;
+			p.color = sf::Color::Green;
+			doc.points.push_back(p);
+		}
+	}
+	std::vector<sf::Vector2f> pts;
+	for (const DocPoint& p : doc.points){
+		pts.push_back(p.vector);
+	}
+	Triangulation tri;
+	tri.begin(sf::FloatRect(0, 0, w, h));
+	std::vector<int> verts = tri.insertAll(pts);
+	if (keepedges >= 0){
+		int kept = 0;
+		int crossing = 0;
+		for (const std::pair<int, int>& e : documentEdges(doc, keepedges)){
+			if (verts[e.first] < 0 || verts[e.second] < 0 || verts[e.first] == verts[e.second]){
+				continue;
+			}
+			if (tri.insertConstraint(verts[e.first], verts[e.second])){
+				kept++;
+			}
+			else {
+				crossing++;
+			}
+		}
+		log << "  kept " << kept << " polygon edges";
+		if (crossing > 0){
+			log << " (" << crossing << " skipped, they cross another kept edge)";
+		}
+		log << "\n";
+	}
+	std::vector<std::array<int, 3> > result;
+	std::vector<sf::Color> colors;
+	int before = tri.vertexCount();
+	if (refine != NULL){
+		ColorStats stats;
+		stats.build(img, threads);
+		Refiner refiner(tri, stats);
+		refiner.run(*refine);
+		refiner.result(result, colors);
+	}
+	else {
+		tri.triangles(result);
+	}
+	std::vector<int> owner(tri.vertexCount(), -1);
+	for (unsigned i = 0; i < verts.size(); i++){
+		if (verts[i] >= 0 && owner[verts[i]] < 0){
+			owner[verts[i]] = i;
+		}
+	}
+	for (int v = before; v < tri.vertexCount(); v++){
+		DocPoint p;
+		p.vector = sf::Vector2f((float)tri.x[v], (float)tri.y[v]);
+		p.size = 5;
+		p.color = sf::Color::Green;
+		owner[v] = (int)doc.points.size();
+		doc.points.push_back(p);
+	}
+	doc.polygons.clear();
+	for (unsigned i = 0; i < result.size(); i++){
+		DocPoly poly;
+		for (int j = 0; j < 3; j++){
+			poly.sa[j] = owner[result[i][j]];
+		}
+		poly.fillcolor = colors.empty() ? sf::Color::Green : colors[i];
+		doc.polygons.push_back(poly);
+	}
+	return (int)doc.polygons.size();
+}
+
+// PSNR and SSIM of doc against img, formatted for the log.
+static std::string fidelityText(const Document& doc, const sf::Image& img, int threads){
+	FidelityMetrics metrics;
+	metrics.reset(img, threads);
+	FidelityStats stats = metrics.update(doc);
+	char text[64];
+	snprintf(text, sizeof(text), "PSNR %.2f dB, SSIM %.4f", stats.psnr, stats.ssim);
+	return text;
+}
+
+// Counts bytes under a memory tag for as long as it lives
+struct CountedBytes {
+	int tag;
+	long long bytes;
+	CountedBytes(int _tag, long long _bytes) : tag(_tag), bytes(_bytes) { Memory::add(tag, bytes); }
+	~CountedBytes() { Memory::add(tag, -bytes); }
+};
+
+// Runs every requested operation on one image. Returns its exit code.
+static int processImage(const std::string& image, const BatchOptions& options, int rasterthreads, std::ostream& log){
+	TraceScope scope("Image", "batch");
+	log << image << "\n";
+	sf::Clock clock;
+	sf::Image img;
+	if (!img.loadFromFile(image)){
+		log << "  error: could not load image\n";
+		return 1;
+	}
+	CountedBytes pixels(MEM_IMAGE, 4LL * img.getSize().x * img.getSize().y);
+	log << "  decoded " << img.getSize().x << "x" << img.getSize().y << " in " << clock.restart().asMilliseconds() << " ms\n";
+
+	std::string base = outputBase(image, options.outdir);
+	std::string inbase = outputBase(image, "");
+	std::string meshfile = options.mesh.empty() ? inbase + ".vertices" : options.mesh;
+	Document doc;
+	if (!loadDocumentJSON(meshfile, doc)){
+		log << "  no mesh at " << meshfile << ", starting empty\n";
+	}
+	int replayed = replayJournal(meshfile + ".journal", doc);
+	if (replayed > 0){
+		log << "  replayed " << replayed << " journal records\n";
+	}
+	doc.size = img.getSize();
+	log << "  mesh: " << doc.points.size() << " points, " << doc.polygons.size() << " polygons\n";
+
+	int result = 0;
+	if (options.validate && validateDocument(doc, log) > 0){
+		result = 2;
+	}
+
+	// Clamp like Engine::snapshot before using the points
+	for (DocPoint& p : doc.points){
+		p.vector.x = std::min(std::max(p.vector.x, 0.0f), (float)doc.size.x);
+		p.vector.y = std::min(std::max(p.vector.y, 0.0f), (float)doc.size.y);
+	}
+
+	if (options.generate > 0){
+		clock.restart();
+		SeedOptions seeding;
+		seeding.count = options.generate;
+		seeding.contrast = options.contrast;
+		seeding.seed = options.seed;
+		seeding.threads = rasterthreads;
+		std::vector<sf::Vector2f> existing;
+		for (const DocPoint& p : doc.points){
+			existing.push_back(p.vector);
+		}
+		std::vector<sf::Vector2f> points = seedPoints(img, seeding, existing);
+		for (const sf::Vector2f& v : points){
+			DocPoint p;
+			p.vector = v;
+			p.size = 5;
+			p.color = sf::Color::Green;
+			doc.points.push_back(p);
+		}
+		log << "  generated " << points.size() << " points in " << clock.getElapsedTime().asMilliseconds() << " ms\n";
+	}
+	if (options.generate > 0 || options.refine > 0){
+		clock.restart();
+		RefineOptions refine;
+		refine.triangles = options.refine;
+		refine.maxerror = options.maxerror;
+		int before = (int)doc.points.size();
+		int count = triangulateDocument(doc, img, options.keepedges, options.refine > 0 ? &refine : NULL, rasterthreads, log);
+		log << "  triangulated into " << count << " polygons";
+		if (options.refine > 0){
+			log << ", refinement added " << (int)doc.points.size() - before << " points";
+		}
+		log << " in " << clock.getElapsedTime().asMilliseconds() << " ms\n";
+	}
+	if (options.flip){
+		clock.restart();
+		int npoints = (int)doc.points.size();
+		std::vector<sf::Vector2f> pts;
+		for (const DocPoint& p : doc.points){
+			pts.push_back(p.vector);
+		}
+		std::vector<std::array<int, 3> > tris;
+		bool valid = true;
+		for (const DocPoly& p : doc.polygons){
+			for (int j = 0; j < 3; j++){
+				valid = valid && p.sa[j] >= 0 && p.sa[j] < npoints;
+			}
+			std::array<int, 3> t = {{ p.sa[0], p.sa[1], p.sa[2] }};
+			tris.push_back(t);
+		}
+		if (!valid){
+			log << "  warning: skipped --flip, the mesh has bad point indices\n";
+		}
+		else {
+			ColorStats stats;
+			stats.build(img, rasterthreads);
+			Triangulation tri;
+			tri.assign(pts, tris);
+			std::vector<int> changed;
+			FlipStats flips = optimizeFlips(tri, stats, &changed);
+			for (int t : changed){
+				DocPoly& p = doc.polygons[t];
+				for (int j = 0; j < 3; j++){
+					p.sa[j] = tri.tris[t].v[j] - 3;
+				}
+				p.fillcolor = stats.triangle(pts[p.sa[0]], pts[p.sa[1]], pts[p.sa[2]]).mean();
+			}
+			log << "  flipped " << flips.flips << " diagonals, error " << flips.before << " -> " << flips.after
+				<< " in " << clock.getElapsedTime().asMilliseconds() << " ms\n";
+		}
+	}
+	// Refined polygons already carry their exact mean color
+	if (options.recolor || (options.generate > 0 && options.refine == 0)){
+		clock.restart();
+		int npoints = (int)doc.points.size();
+		std::vector<int> polys;
+		std::vector<sf::Vector2f> corners;
+		for (unsigned i = 0; i < doc.polygons.size(); i++){
+			const DocPoly& p = doc.polygons[i];
+			if (p.sa[0] < 0 || p.sa[1] < 0 || p.sa[2] < 0 || p.sa[0] >= npoints || p.sa[1] >= npoints || p.sa[2] >= npoints){
+				continue;
+			}
+			polys.push_back(i);
+			for (int j = 0; j < 3; j++){
+				corners.push_back(doc.points[p.sa[j]].vector);
+			}
+		}
+		std::vector<sf::Color> colors;
+		sampleTriangleColors(img, corners, polys, options.seed, options.samples, colors, NULL, NULL, rasterthreads);
+		for (unsigned k = 0; k < polys.size(); k++){
+			doc.polygons[polys[k]].fillcolor = colors[k];
+		}
+		log << "  recolored " << doc.polygons.size() << " polygons in " << clock.getElapsedTime().asMilliseconds() << " ms\n";
+	}
+	bool quantize = options.palette > 0 || !options.fixedpalette.empty();
+	if (quantize){
+		clock.restart();
+		PaletteOptions palette;
+		palette.colors = options.palette;
+		palette.seed = options.seed;
+		palette.threads = rasterthreads;
+		PaletteStats stats;
+		quantizeDocument(doc, palette, options.fixedpalette.empty() ? NULL : &options.fixedpalette, &stats);
+		log << "  quantized to " << doc.palette.size() << " colors";
+		if (options.fixedpalette.empty()){
+			log << " (" << stats.iterations << " k-means rounds)";
+		}
+		log << ", " << stats.changed << " polygons changed, RMS error " << stats.error
+			<< " in " << clock.getElapsedTime().asMilliseconds() << " ms\n";
+	}
+	if (options.gouraud){
+		clock.restart();
+		ColorStats stats;
+		stats.build(img, rasterthreads);
+		doc.gouraud = true;
+		std::vector<int> changed = sampleVertexColors(doc, stats, rasterthreads);
+		log << "  sampled " << changed.size() << " point colors for Gouraud shading in " << clock.getElapsedTime().asMilliseconds() << " ms\n";
+	}
+	if (options.recolor || options.convert || options.generate > 0 || options.refine > 0 || options.flip || quantize || options.gouraud){
+		// A new checkpoint number so the journal that was merged in is not replayed again
+		doc.sequence++;
+		std::string out = base + ".vertices";
+		if (!writeFileAtomic(out, documentToJSON(doc))){
+			log << "  error: could not write " << out << "\n";
+			result = 1;
+		}
+		else {
+			log << "  wrote " << out << "\n";
+		}
+	}
+	if (options.metrics){
+		clock.restart();
+		std::string text = fidelityText(doc, img, rasterthreads);
+		log << "  fidelity: " << text << " in " << clock.getElapsedTime().asMilliseconds() << " ms\n";
+	}
+	if (options.svg){
+		std::string out = base + ".svg";
+		if (!writeFileAtomic(out, documentToSVG(doc))){
+			log << "  error: could not write " << out << "\n";
+			result = 1;
+		}
+		else {
+			log << "  wrote " << out << "\n";
+		}
+	}
+	if (options.png){
+		clock.restart();
+		RasterOptions raster = options.raster;
+		raster.threads = rasterthreads;
+		std::string out = base + ".lowpoly.png";
+		if (!exportPNG(doc, out, raster)){
+			log << "  error: could not write " << out << "\n";
+			result = 1;
+		}
+		else {
+			log << "  wrote " << out << " in " << clock.getElapsedTime().asMilliseconds() << " ms\n";
+		}
+	}
+	if (!options.simplify.empty()){
+		ColorStats stats;
+		stats.build(img, rasterthreads);
+		for (int triangles : options.simplify){
+			clock.restart();
+			SimplifyOptions simplify;
+			simplify.triangles = triangles;
+			Document simple = simplifyDocument(doc, stats, simplify);
+			std::string out = base + "." + std::to_string(triangles);
+			if (!writeFileAtomic(out + ".vertices", documentToJSON(simple)) || !writeFileAtomic(out + ".svg", documentToSVG(simple))){
+				log << "  error: could not write " << out << ".vertices/.svg\n";
+				result = 1;
+			}
+			else {
+				log << "  wrote " << out << ".vertices/.svg with " << simple.polygons.size() << " polygons in "
+					<< clock.getElapsedTime().asMilliseconds() << " ms";
+				if (options.metrics){
+					log << ", " << fidelityText(simple, img, rasterthreads);
+				}
+				log << "\n";
+			}
+		}
+	}
+	return result;
+}
+
+int runBatch(const BatchOptions& options){
+	if (options.threads > 0){
+		ThreadPool::setThreads(options.threads);
+	}
+	int threads = ThreadPool::threads();
+	int count = (int)options.images.size();
+	int jobs = options.jobs > 0 ? options.jobs : threads;
+	jobs = std::min(std::min(jobs, count), threads);
+	// Split the threads between images running at once
+	int rasterthreads = std::max(1, threads / jobs);
+	Tracer::nameThread("Batch");
+	if (!options.trace.empty() && !Tracer::start(options.trace)){
+		printf("Could not write %s\n", options.trace.c_str());
+	}
+	PoolStats before = ThreadPool::shared().stats();
+	std::vector<int> results(count, 0);
+	std::mutex printmutex;
+	sf::Clock clock;
+	parallelFor(count, [&](int i){
+		std::ostringstream log;
+		results[i] = processImage(options.images[i], options, rasterthreads, log);
+		std::lock_guard<std::mutex> lock(printmutex);
+		std::cout << log.str() << std::flush;
+	}, jobs);
+	int result = 0;
+	int failed = 0;
+	for (int r : results){
+		result = std::max(result, r);
+		failed += r != 0;
+	}
+	printf("%d images, %d with problems, %.2f s using %d jobs\n", count, failed, clock.getElapsedTime().asSeconds(), jobs);
+	printf("thread pool: %s\n", describePool(before, ThreadPool::shared().stats()).c_str());
+	Memory::print();
+	Memory::checkBudgets();
+	if (Tracer::recording()){
+		Tracer::stop();
+		printf("trace: %lld events written to %s\n", Tracer::events(), options.trace.c_str());
+	}
+	return result;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include "stdafx.h"
+#include "raster.h"
+#include <string>
+#include <vector>
+
+// Headless batch mode: runs operations on image/mesh pairs given on the
+// command line without creating a window or opening any dialog.
+struct BatchOptions {
+	std::vector<std::string> images;
+	std::string mesh;       // Mesh for a single image instead of <image>.vertices
+	std::string outdir;     // Outputs go next to the image when empty
+	bool recolor  = false;
+	bool validate = false;
+	bool svg      = false;
+	bool png      = false;
+	bool convert  = false;  // Write the mesh back as a fresh .vertices
+	int  generate = 0;      // Seed this many points and triangulate the mesh
+	float contrast = 0.8f;  // Detail contrast for --generate
+	int  refine   = 0;      // Refine the mesh up to this many triangles
+	float maxerror = 4.0f;  // RMS error below which --refine leaves a polygon
+	int  keepedges = -1;    // Contrast from which --generate/--refine keep polygon edges, -1 for none
+	bool flip     = false;  // Flip diagonals that lower the color error
+	std::vector<int> simplify; // Also write copies simplified to these polygon counts
+	bool metrics  = false;  // Report PSNR/SSIM of the results against the image
+	int  palette  = 0;      // Quantize polygon colors to this many swatches
+	std::vector<sf::Color> fixedpalette; // Or snap them to these
+	bool gouraud  = false;  // Sample point colors and shade polygons with them
+	int  samples  = 10;     // Color samples per polygon for recolor
+	unsigned seed = 1;
+	int  jobs     = 0;      // Files processed at once, 0 uses every thread
+	int  threads  = 0;      // Size of the thread pool, 0 uses every core
+	std::string trace;      // Chrome trace of the run, none when empty
+	RasterOptions raster;
+};
+
+// Prints the command line usage.
+void printUsage(const char* program);
+
+// Returns true if the arguments ask for batch mode.
+bool isBatchCommand(int argc, char* argv[]);
+
+// Fills options from argv. Returns false (after printing why) on bad input.
+bool parseBatchArgs(int argc, char* argv[], BatchOptions& options);
+
+// Processes every image, returns the process exit code.
+int runBatch(const BatchOptions& options);
@@ -0,0 +1,381 @@
+#include "stdafx.h"
+#include "bench.h"
+#include "delaunay.h"
+#include "document.h"
+#include "memory.h"
+#include "mesh.h"
+#include "poly.h"
+#include "renderer.h"
+#include "sampler.h"
+#include "json/json.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+// Side of the synthetic image the meshes cover and avgClr samples
+#define BENCHIMAGE 2048
+// Smallest mesh, each further one is ten times larger
+#define BENCHMINTRIANGLES 1000
+// Differences below this many milliseconds are never a regression
+#define BENCHNOISEMS 0.05
+
+static const char* meshnames[] = { "random", "grid", "delaunay" };
+
+struct BenchResult {
+	std::string mesh;
+	int triangles;
+	int points;
+	std::string op;
+	double median;  // Milliseconds
+	double min;
+};
+
+bool isBenchCommand(int argc, char* argv[]){
+	for (int i = 1; i < argc; i++){
+		if (strcmp(argv[i], "--bench") == 0){
+			return true;
+		}
+	}
+	return false;
+}
+
+bool parseBenchArgs(int argc, char* argv[], BenchOptions& options){
+	for (int i = 1; i < argc; i++){
+		std::string arg = argv[i];
+		bool hasvalue = i + 1 < argc;
+		if (arg == "--bench"){
+		}
+		else if (arg == "--mesh" && hasvalue){
+			std::istringstream names(argv[++i]);
+			std::string name;
+			while (std::getline(names, name, ',')){
+				if (std::find(std::begin(meshnames), std::end(meshnames), name) == std::end(meshnames)){
+					printf("--mesh takes random, grid or delaunay, got %s\n", name.c_str());
+					return false;
+				}
+				options.meshes.push_back(name);
+			}
+		}
+		else if (arg == "--max" && hasvalue){
+			options.maxtriangles = atoi(argv[++i]);
+		}
+		else if (arg == "--reps" && hasvalue){
+			options.reps = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--samples" && hasvalue){
+			options.samples = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--seed" && hasvalue){
+			options.seed = (unsigned)strtoul(argv[++i], NULL, 10);
+		}
+		else if (arg == "--out" && hasvalue){
+			options.out = argv[++i];
+		}
+		else if (arg == "--compare" && hasvalue){
+			options.compare = argv[++i];
+		}
+		else if (arg == "--tolerance" && hasvalue){
+			options.tolerance = std::max(0.0f, (float)atof(argv[++i]));
+		}
+		else if (arg == "--scratch" && hasvalue){
+			options.scratch = argv[++i];
+		}
+		else {
+			printf("Unknown or incomplete option %s\n", arg.c_str());
+			return false;
+		}
+	}
+	if (options.maxtriangles < 2){
+		printf("--max needs at least 2 triangles\n");
+		return false;
+	}
+	if (options.meshes.empty()){
+		options.meshes.assign(std::begin(meshnames), std::end(meshnames));
+	}
+	return true;
+}
+
+// Smooth gradients with a fine checker on top, so sampled colors vary
+// within a polygon the way a photo's do.
+static void makeImage(sf::Image& img){
+	std::vector<sf::Uint8> pixels(BENCHIMAGE * BENCHIMAGE * 4);
+	for (int y = 0; y < BENCHIMAGE; y++){
+		for (int x = 0; x < BENCHIMAGE; x++){
+			sf::Uint8* p = &pixels[(y * BENCHIMAGE + x) * 4];
+			int checker = ((x >> 3) + (y >> 3)) & 1 ? 24 : 0;
+			p[0] = (sf::Uint8)(x * 200 / BENCHIMAGE + checker);
+			p[1] = (sf::Uint8)(y * 200 / BENCHIMAGE + checker);
+			p[2] = (sf::Uint8)((x + y) * 100 / BENCHIMAGE + checker);
+			p[3] = 255;
+		}
+	}
+	img.create(BENCHIMAGE, BENCHIMAGE, &pixels[0]);
+}
+
+static sf::Color randomColor(SampleRng& rng){
+	return sf::Color(rng() & 255, rng() & 255, rng() & 255);
+}
+
+static void addPoint(Document& doc, float x, float y, SampleRng& rng){
+	DocPoint p = { sf::Vector2f(x, y), 5, randomColor(rng) };
+	doc.points.push_back(p);
+}
+
+static void addPolygon(Document& doc, int a, int b, int c, SampleRng& rng){
+	DocPoly p = { { a, b, c }, randomColor(rng) };
+	doc.polygons.push_back(p);
+}
+
+// A mesh of the given kind with about triangles polygons over the image:
+// random joins random points (no locality at all), grid splits the cells
+// of a regular grid in row order, and delaunay triangulates random points
+// in the order the triangulation leaves them, like a generated mesh.
+static Document makeMesh(const std::string& kind, int triangles, unsigned seed){
+	SampleRng rng(seed);
+	std::uniform_real_distribution<float> coord(0, BENCHIMAGE);
+	Document doc;
+	doc.size = sf::Vector2u(BENCHIMAGE, BENCHIMAGE);
+	if (kind == "random"){
+		int points = std::max(3, triangles / 2);
+		for (int i = 0; i < points; i++){
+			addPoint(doc, coord(rng), coord(rng), rng);
+		}
+		std::uniform_int_distribution<int> pick(0, points - 1);
+		for (int i = 0; i < triangles; i++){
+			int a = pick(rng), b = pick(rng), c = pick(rng);
+			while (b == a){
+				b = pick(rng);
+			}
+			while (c == a || c == b){
+				c = pick(rng);
+			}
+			addPolygon(doc, a, b, c, rng);
+		}
+	}
+	else if (kind == "grid"){
+		int cols = std::max(1, (int)std::ceil(std::sqrt(triangles / 2.0)));
+		int rows = std::max(1, (triangles / 2 + cols - 1) / cols);
+		for (int y = 0; y <= rows; y++){
+			for (int x = 0; x <= cols; x++){
+				addPoint(doc, (float)x * BENCHIMAGE / cols, (float)y * BENCHIMAGE / rows, rng);
+			}
+		}
+		for (int y = 0; y < rows; y++){
+			for (int x = 0; x < cols; x++){
+				int a = y * (cols + 1) + x;
+				int c = a + cols + 1;
+				addPolygon(doc, a, a + 1, c, rng);
+				addPolygon(doc, a + 1, c + 1, c, rng);
+			}
+		}
+	}
+	else {
+		// A triangulation of n points has about 2n triangles less the hull
+		std::vector<sf::Vector2f> points(triangles / 2 + 64);
+		for (sf::Vector2f& p : points){
+			p = sf::Vector2f(coord(rng), coord(rng));
+		}
+		Triangulation tri;
+		tri.begin(sf::FloatRect(0, 0, BENCHIMAGE, BENCHIMAGE));
+		tri.insertAll(points);
+		for (int v = 3; v < tri.vertexCount(); v++){
+			addPoint(doc, (float)tri.x[v], (float)tri.y[v], rng);
+		}
+		std::vector<std::array<int, 3> > tris;
+		tri.triangles(tris);
+		for (const std::array<int, 3>& t : tris){
+			addPolygon(doc, t[0] - 3, t[1] - 3, t[2] - 3, rng);
+		}
+	}
+	if ((int)doc.polygons.size() > triangles){
+		doc.polygons.resize(triangles);
+	}
+	return doc;
+}
+
+// The editor's state for one mesh
+struct BenchMesh {
+	std::vector<Point> rpoints;
+	std::vector<Poly> polygons;
+	std::vector<sf::Color> palette;
+};
+
+// Runs op reps times and adds its median and fastest time to results.
+template<typename Op>
+static void measure(std::vector<BenchResult>& results, const BenchResult& base, const char* name, int reps, Op op){
+	std::vector<double> times;
+	for (int r = 0; r < reps; r++){
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		op();
+		std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+		times.push_back(ms.count());
+	}
+	std::sort(times.begin(), times.end());
+	BenchResult result = base;
+	result.op = name;
+	result.median = times[times.size() / 2];
+	result.min = times.front();
+	results.push_back(result);
+	printf("%-9s %9d %9d  %-11s %10.3f %10.3f\n", result.mesh.c_str(), result.triangles, result.points, name, result.median, result.min);
+	fflush(stdout);
+}
+
+// Times every operation on one mesh. Returns false if a file could not be
+// written or read back.
+static bool benchMesh(const BenchOptions& options, const sf::Image& img, const Document& doc, const BenchResult& base, std::vector<BenchResult>& results){
+	const int reps = options.reps;
+	std::string vfile = options.scratch + "/bench.vertices";
+	std::string sfile = options.scratch + "/bench.svg";
+	bool ok = true;
+	BenchMesh mesh;
+	measure(results, base, "setDocument", reps, [&](){
+		buildMesh(doc, mesh.rpoints, mesh.polygons, 1);
+	});
+	// The per-frame part of Engine::update, with nothing selected or dragged
+	measure(results, base, "update", reps, [&](){
+		updateMesh(mesh.rpoints, mesh.polygons, doc.size);
+	});
+	// Filling a frame the way Engine::draw does; the buffers are reused
+	// between frames there too
+	FrameData frame;
+	measure(results, base, "draw", reps, [&](){
+		frame.clear();
+		fillFrame(frame, mesh.polygons, mesh.rpoints, false, false);
+	});
+	measure(results, base, "avgClr", reps, [&](){
+		SampleRng rng(options.seed);
+		for (Poly& polygon : mesh.polygons){
+			polygon.fillcolor = sampleTriangleColor(img, polygon.p1->vector, polygon.p2->vector, polygon.p3->vector, options.samples, rng);
+		}
+	});
+	measure(results, base, "snapshot", reps, [&](){
+		snapshotMesh(mesh.rpoints, mesh.polygons, doc.size, mesh.palette, doc.gouraud);
+	});
+	measure(results, base, "saveJSON", reps, [&](){
+		ok = writeFileAtomic(vfile, documentToJSON(snapshotMesh(mesh.rpoints, mesh.polygons, doc.size, mesh.palette, doc.gouraud))) && ok;
+	});
+	measure(results, base, "saveVector", reps, [&](){
+		ok = writeFileAtomic(sfile, documentToSVG(snapshotMesh(mesh.rpoints, mesh.polygons, doc.size, mesh.palette, doc.gouraud))) && ok;
+	});
+	if (!ok){
+		printf("Could not write to %s\n", options.scratch.c_str());
+		return false;
+	}
+	Document loaded;
+	measure(results, base, "loadJSON", reps, [&](){
+		loadDocumentJSON(vfile, loaded);
+	});
+	std::remove(vfile.c_str());
+	std::remove(sfile.c_str());
+	if (loaded.points.size() != doc.points.size() || loaded.polygons.size() != doc.polygons.size()){
+		printf("%s read back %u points and %u polygons instead of %u and %u\n", vfile.c_str(),
+			(unsigned)loaded.points.size(), (unsigned)loaded.polygons.size(), (unsigned)doc.points.size(), (unsigned)doc.polygons.size());
+		return false;
+	}
+	return true;
+}
+
+static std::string resultKey(const std::string& mesh, int triangles, const std::string& op){
+	return mesh + " " + std::to_string(triangles) + " " + op;
+}
+
+// Prints the change of every median against the earlier results. Returns
+// the number of operations that got slower by more than the tolerance.
+static int compareResults(const BenchOptions& options, const std::vector<BenchResult>& results){
+	std::ifstream in(options.compare, std::ios::binary);
+	Json::Value old;
+	Json::Reader reader;
+	if (!in || !reader.parse(in, old)){
+		printf("Could not read %s\n", options.compare.c_str());
+		return 1;
+	}
+	if (old["seed"].asUInt() != options.seed || old["samples"].asInt() != options.samples){
+		printf("Note: %s was run with a different --seed or --samples\n", options.compare.c_str());
+	}
+	std::map<std::string, double> medians;
+	const Json::Value& list = old["results"];
+	for (unsigned i = 0; i < list.size(); i++){
+		medians[resultKey(list[i]["mesh"].asString(), list[i]["triangles"].asInt(), list[i]["op"].asString())] = list[i]["median_ms"].asDouble();
+	}
+	printf("\nCompared with %s (median ms):\n", options.compare.c_str());
+	int regressions = 0;
+	for (const BenchResult& r : results){
+		std::map<std::string, double>::const_iterator found = medians.find(resultKey(r.mesh, r.triangles, r.op));
+		if (found == medians.end()){
+			continue;
+		}
+		double before = found->second;
+		double change = before > 0 ? (r.median / before - 1) * 100 : 0;
+		bool slower = change > options.tolerance && r.median - before > BENCHNOISEMS;
+		printf("%-9s %9d  %-11s %10.3f -> %10.3f  %+7.1f%%%s\n", r.mesh.c_str(), r.triangles, r.op.c_str(), before, r.median, change, slower ? "  slower" : "");
+		if (slower){
+			regressions++;
+		}
+	}
+	printf("%d of %d operations slower by more than %g%%\n", regressions, (int)results.size(), options.tolerance);
+	return regressions;
+}
+
+int runBench(const BenchOptions& options){
+	std::vector<int> sizes;
+	for (long long n = BENCHMINTRIANGLES; n <= options.maxtriangles; n *= 10){
+		sizes.push_back((int)n);
+	}
+	if (sizes.empty()){
+		sizes.push_back(options.maxtriangles);
+	}
+	sf::Image img;
+	makeImage(img);
+	printf("Image %dx%d, %d reps, %d samples, seed %u\n\n", BENCHIMAGE, BENCHIMAGE, options.reps, options.samples, options.seed);
+	printf("%-9s %9s %9s  %-11s %10s %10s\n", "mesh", "triangles", "points", "op", "median ms", "min ms");
+	std::vector<BenchResult> results;
+	for (const std::string& kind : options.meshes){
+		for (int size : sizes){
+			// One mesh at a time, the largest ones take a good part of a gigabyte
+			Document doc = makeMesh(kind, size, options.seed);
+			BenchResult base;
+			base.mesh = kind;
+			base.triangles = (int)doc.polygons.size();
+			base.points = (int)doc.points.size();
+			if (!benchMesh(options, img, doc, base, results)){
+				return 1;
+			}
+		}
+	}
+	// Peaks are those of the largest mesh
+	printf("\n");
+	Memory::print();
+	if (!options.out.empty()){
+		Json::Value root;
+		root["seed"] = options.seed;
+		root["reps"] = options.reps;
+		root["samples"] = options.samples;
+		root["image"] = BENCHIMAGE;
+		for (unsigned i = 0; i < results.size(); i++){
+			Json::Value& r = root["results"][i];
+			r["mesh"] = results[i].mesh;
+			r["triangles"] = results[i].triangles;
+			r["points"] = results[i].points;
+			r["op"] = results[i].op;
+			r["median_ms"] = results[i].median;
+			r["min_ms"] = results[i].min;
+		}
+		std::ostringstream out;
+		out << root << std::endl;
+		if (!writeFileAtomic(options.out, out.str())){
+			printf("Could not write %s\n", options.out.c_str());
+			return 1;
+		}
+		printf("\nWrote %s\n", options.out.c_str());
+	}
+	if (!options.compare.empty() && compareResults(options, results) > 0){
+		return 1;
+	}
+	return 0;
+}
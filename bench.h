@@ -0,0 +1,30 @@
+#pragma once
+#include "stdafx.h"
+#include <string>
+#include <vector>
+
+// Headless benchmarks of the editor's core operations (update, draw,
+// avgClr, snapshot, saveJSON, saveVector, loadJSON) on synthetic meshes.
+// Meshes and colors come from the seed alone, so two builds given the same
+// options time exactly the same work and their results can be compared.
+struct BenchOptions {
+	std::vector<std::string> meshes; // random, grid, delaunay; all when empty
+	int maxtriangles = 1000000; // Meshes of 1k, 10k, ... triangles up to this
+	int reps      = 5;         // Timings per operation, the median is reported
+	int samples   = 10;        // Color samples per polygon for avgClr
+	unsigned seed = 1;
+	std::string out;           // JSON results, none when empty
+	std::string compare;       // Earlier JSON results to compare against
+	float tolerance = 10;      // Percent slower than compare that counts as a regression
+	std::string scratch = "."; // Directory for the files saved and loaded
+};
+
+// Returns true if the arguments ask for bench mode.
+bool isBenchCommand(int argc, char* argv[]);
+
+// Fills options from argv. Returns false (after printing why) on bad input.
+bool parseBenchArgs(int argc, char* argv[], BenchOptions& options);
+
+// Runs every benchmark. Returns 1 if a comparison found a regression or
+// something could not be written, 0 otherwise.
+int runBench(const BenchOptions& options);
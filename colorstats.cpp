@@ -0,0 +1,197 @@
+#include "stdafx.h"
+#include "colorstats.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+
+sf::Color TriangleStats::mean() const {
+	if (count <= 0){
+		return sf::Color::Black;
+	}
+	return sf::Color((sf::Uint8)(sum[0] / count + 0.5), (sf::Uint8)(sum[1] / count + 0.5), (sf::Uint8)(sum[2] / count + 0.5), 255);
+}
+
+double TriangleStats::error() const {
+	if (count <= 0){
+		return 0;
+	}
+	double e = squares - (sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]) / count;
+	return e > 0 ? e : 0;
+}
+
+void TriangleStats::add(const TriangleStats& other){
+	count += other.count;
+	for (int i = 0; i < 3; i++){
+		sum[i] += other.sum[i];
+	}
+	squares += other.squares;
+}
+
+void ColorStats::build(const sf::Image& img, int threads){
+	w = (int)img.getSize().x;
+	h = (int)img.getSize().y;
+	pixels = img.getPixelsPtr();
+	prefix.assign((size_t)(w + 1) * h * 4, 0);
+	if (w == 0 || h == 0){
+		return;
+	}
+	parallelFor(h, [&](int y){
+		sf::Uint32* row = &prefix[(size_t)(w + 1) * y * 4];
+		const sf::Uint8* p = pixels + (size_t)w * y * 4;
+		for (int x = 0; x < w; x++, p += 4, row += 4){
+			row[4] = row[0] + p[0];
+			row[5] = row[1] + p[1];
+			row[6] = row[2] + p[2];
+			row[7] = row[3] + p[0] * p[0] + p[1] * p[1] + p[2] * p[2];
+		}
+	}, threads);
+}
+
+int ColorStats::edges(const sf::Vector2f* v, Edge* out) const {
+	int n = 0;
+	for (int i = 0; i < 3; i++){
+		const sf::Vector2f& p = v[i].y <= v[(i + 1) % 3].y ? v[i] : v[(i + 1) % 3];
+		const sf::Vector2f& q = v[i].y <= v[(i + 1) % 3].y ? v[(i + 1) % 3] : v[i];
+		if (p.y == q.y){
+			continue;
+		}
+		Edge& e = out[n++];
+		e.px = p.x;
+		e.py = p.y;
+		e.qy = q.y;
+		e.slope = ((double)q.x - p.x) / ((double)q.y - p.y);
+	}
+	return n;
+}
+
+bool ColorStats::span(const Edge* e, int n, int y, int& x0, int& x1) const {
+	double yc = y + 0.5;
+	double lo = 1e30;
+	double hi = -1e30;
+	for (int i = 0; i < n; i++){
+		// Half open in y so a vertex row is not counted twice
+		if (e[i].py <= yc && e[i].qy > yc){
+			double x = e[i].px + (yc - e[i].py) * e[i].slope;
+			lo = std::min(lo, x);
+			hi = std::max(hi, x);
+		}
+	}
+	if (lo > hi){
+		return false;
+	}
+	// Pixels whose center x + 0.5 lies in [lo, hi), half open like y so a
+	// center on a shared edge belongs to one triangle only
+	x0 = std::max((int)std::ceil(lo - 0.5), 0);
+	x1 = std::min((int)std::ceil(hi - 0.5), w);
+	return x0 < x1;
+}
+
+TriangleStats ColorStats::triangle(const sf::Vector2f& a, const sf::Vector2f& b, const sf::Vector2f& c) const {
+	TriangleStats stats;
+	if (w == 0){
+		return stats;
+	}
+	sf::Vector2f v[3] = { a, b, c };
+	Edge e[3];
+	int n = edges(v, e);
+	int y0 = std::max((int)std::floor(std::min(std::min(a.y, b.y), c.y)), 0);
+	int y1 = std::min((int)std::ceil(std::max(std::max(a.y, b.y), c.y)), h);
+	for (int y = y0; y < y1; y++){
+		int x0, x1;
+		if (!span(e, n, y, x0, x1)){
+			continue;
+		}
+		const sf::Uint32* row = &prefix[(size_t)(w + 1) * y * 4];
+		const sf::Uint32* l = row + x0 * 4;
+		const sf::Uint32* r = row + x1 * 4;
+		stats.count += x1 - x0;
+		stats.sum[0] += (sf::Uint32)(r[0] - l[0]);
+		stats.sum[1] += (sf::Uint32)(r[1] - l[1]);
+		stats.sum[2] += (sf::Uint32)(r[2] - l[2]);
+		stats.squares += (sf::Uint32)(r[3] - l[3]);
+	}
+	return stats;
+}
+
+bool ColorStats::errorCentroid(const sf::Vector2f& a, const sf::Vector2f& b, const sf::Vector2f& c, const sf::Color& color, sf::Vector2f& out) const {
+	if (w == 0){
+		return false;
+	}
+	sf::Vector2f v[3] = { a, b, c };
+	Edge e[3];
+	int n = edges(v, e);
+	int y0 = std::max((int)std::floor(std::min(std::min(a.y, b.y), c.y)), 0);
+	int y1 = std::min((int)std::ceil(std::max(std::max(a.y, b.y), c.y)), h);
+	double total = 0;
+	double sx = 0;
+	double sy = 0;
+	for (int y = y0; y < y1; y++){
+		int x0, x1;
+		if (!span(e, n, y, x0, x1)){
+			continue;
+		}
+		const sf::Uint8* p = pixels + ((size_t)w * y + x0) * 4;
+		double row = 0;
+		for (int x = x0; x < x1; x++, p += 4){
+			int dr = p[0] - color.r;
+			int dg = p[1] - color.g;
+			int db = p[2] - color.b;
+			double d = dr * dr + dg * dg + db * db;
+			row += d;
+			sx += d * (x + 0.5);
+		}
+		total += row;
+		sy += row * (y + 0.5);
+	}
+	if (total <= 0){
+		return false;
+	}
+	out = sf::Vector2f((float)(sx / total), (float)(sy / total));
+	return true;
+}
+
+void ColorStats::cornerSums(const sf::Vector2f& a, const sf::Vector2f& b, const sf::Vector2f& c, double mass[3][3], double color[3][3]) const {
+	for (int i = 0; i < 3; i++){
+		for (int j = 0; j < 3; j++){
+			mass[i][j] = 0;
+			color[i][j] = 0;
+		}
+	}
+	double det = ((double)b.x - a.x) * ((double)c.y - a.y) - ((double)b.y - a.y) * ((double)c.x - a.x);
+	if (w == 0 || det == 0){
+		return;
+	}
+	sf::Vector2f v[3] = { a, b, c };
+	Edge e[3];
+	int n = edges(v, e);
+	int y0 = std::max((int)std::floor(std::min(std::min(a.y, b.y), c.y)), 0);
+	int y1 = std::min((int)std::ceil(std::max(std::max(a.y, b.y), c.y)), h);
+	for (int y = y0; y < y1; y++){
+		int x0, x1;
+		if (!span(e, n, y, x0, x1)){
+			continue;
+		}
+		double py = y + 0.5;
+		const sf::Uint8* p = pixels + ((size_t)w * y + x0) * 4;
+		for (int x = x0; x < x1; x++, p += 4){
+			double px = x + 0.5;
+			double l[3];
+			l[1] = ((px - a.x) * ((double)c.y - a.y) - (py - a.y) * ((double)c.x - a.x)) / det;
+			l[2] = (((double)b.x - a.x) * (py - a.y) - ((double)b.y - a.y) * (px - a.x)) / det;
+			l[0] = 1 - l[1] - l[2];
+			for (int i = 0; i < 3; i++){
+				for (int j = i; j < 3; j++){
+					mass[i][j] += l[i] * l[j];
+				}
+				color[i][0] += l[i] * p[0];
+				color[i][1] += l[i] * p[1];
+				color[i][2] += l[i] * p[2];
+			}
+		}
+	}
+	for (int i = 0; i < 3; i++){
+		for (int j = 0; j < i; j++){
+			mass[i][j] = mass[j][i];
+		}
+	}
+}
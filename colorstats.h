@@ -0,0 +1,53 @@
+#pragma once
+#include "stdafx.h"
+#include <vector>
+
+// Color sums over the pixels whose centers lie inside a triangle.
+struct TriangleStats {
+	double count = 0;
+	double sum[3] = { 0, 0, 0 };
+	double squares = 0;  // Sum of r*r + g*g + b*b
+
+	sf::Color mean() const;
+	// Squared error of the pixels against their mean color
+	double error() const;
+	void add(const TriangleStats& other);
+};
+
+// Per-row prefix sums of an image. A triangle's sums then cost one lookup
+// per row it covers instead of one per pixel, which is what makes scoring
+// many candidate triangles (refinement, edge flips) cheap.
+//
+// Sums are 32 bit and wrap; a span is still exact as long as it is under
+// about 22000 pixels wide.
+class ColorStats {
+public:
+	// Keeps a pointer to the pixels of img, which must outlive the stats.
+	void build(const sf::Image& img, int threads = 0);
+	bool empty() const { return w == 0; }
+
+	TriangleStats triangle(const sf::Vector2f& a, const sf::Vector2f& b, const sf::Vector2f& c) const;
+	// Center of the pixels in the triangle weighted by their squared
+	// distance from color. Returns false when all of them match it.
+	bool errorCentroid(const sf::Vector2f& a, const sf::Vector2f& b, const sf::Vector2f& c, const sf::Color& color, sf::Vector2f& out) const;
+	// Sums over the pixels in the triangle weighted by their barycentric
+	// coordinates l: mass[i][j] = sum of l_i * l_j, color[i][ch] = sum of
+	// l_i * pixel. Fitting corner colors (Gouraud) by least squares needs these.
+	void cornerSums(const sf::Vector2f& a, const sf::Vector2f& b, const sf::Vector2f& c, double mass[3][3], double color[3][3]) const;
+
+	int w = 0;
+	int h = 0;
+
+private:
+	// Triangle edge from its upper end, x moving by slope per unit of y
+	struct Edge { double px, py, qy, slope; };
+	// The non-horizontal edges of a triangle, each set up from its upper end
+	// so the triangles on both sides compute exactly the same crossings.
+	int edges(const sf::Vector2f* v, Edge* out) const;
+	// Pixel range [x0, x1) of row y inside the triangle
+	bool span(const Edge* e, int n, int y, int& x0, int& x1) const;
+
+	// (w + 1) entries per row, 4 values each: r, g, b, r*r + g*g + b*b
+	std::vector<sf::Uint32> prefix;
+	const sf::Uint8* pixels = NULL;
+};
@@ -0,0 +1,698 @@
+#include "stdafx.h"
+#include "delaunay.h"
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+// Cells per side of the point location grid.
+#define LOCATEGRID 256
+
+// Key of the undirected edge a-b in the constraint set.
+static unsigned long long edgeKey(int a, int b){
+	if (a > b){
+		std::swap(a, b);
+	}
+	return ((unsigned long long)a << 32) | (unsigned)b;
+}
+
+Triangulation::Triangulation(){
+}
+
+void Triangulation::begin(const sf::FloatRect& bounds){
+	x.clear();
+	y.clear();
+	tris.clear();
+	freetris.clear();
+	mark.clear();
+	created.clear();
+	removed.clear();
+	constraints.clear();
+	vtri.clear();
+	stamp = 0;
+	// Super triangle; its vertices are treated as points at infinity by the
+	// cavity test, so the size only needs to cover the bounds
+	double d = std::max(bounds.width, bounds.height) + 1.0;
+	double cx = bounds.left + bounds.width / 2.0;
+	double cy = bounds.top + bounds.height / 2.0;
+	double m = 20.0 * d;
+	x.push_back(cx - 3 * m); y.push_back(cy - m);
+	x.push_back(cx + 3 * m); y.push_back(cy - m);
+	x.push_back(cx);         y.push_back(cy + 3 * m);
+	if (orient(0, 1, x[2], y[2]) < 0){
+		std::swap(x[1], x[2]);
+		std::swap(y[1], y[2]);
+	}
+	lasttri = newTri(0, 1, 2);
+	gridbounds = bounds;
+	gridsize = LOCATEGRID;
+	grid.assign(gridsize * gridsize, lasttri);
+}
+
+double Triangulation::orient(int a, int b, double cx, double cy) const {
+	return (x[b] - x[a]) * (cy - y[a]) - (y[b] - y[a]) * (cx - x[a]);
+}
+
+double Triangulation::inCircle(int t, double px, double py) const {
+	const Tri& tr = tris[t];
+	return inCircle(tr.v[0], tr.v[1], tr.v[2], px, py);
+}
+
+double Triangulation::inCircle(int a, int b, int c, double px, double py) const {
+	double adx = x[a] - px, ady = y[a] - py;
+	double bdx = x[b] - px, bdy = y[b] - py;
+	double cdx = x[c] - px, cdy = y[c] - py;
+	double ad = adx * adx + ady * ady;
+	double bd = bdx * bdx + bdy * bdy;
+	double cd = cdx * cdx + cdy * cdy;
+	return adx * (bdy * cd - bd * cdy) - ady * (bdx * cd - bd * cdx) + ad * (bdx * cdy - bdy * cdx);
+}
+
+bool Triangulation::conflicts(int t, double px, double py) const {
+	const Tri& tr = tris[t];
+	int supers = isSuper(tr.v[0]) + isSuper(tr.v[1]) + isSuper(tr.v[2]);
+	if (supers == 0){
+		return inCircle(t, px, py) > 0;
+	}
+	if (supers == 1){
+		// The super vertex stands for a point at infinity, so the circle is
+		// the half plane beyond the finite edge. This keeps the hull edges
+		// of the real points no matter where the super triangle sits.
+		int i = isSuper(tr.v[0]) ? 0 : (isSuper(tr.v[1]) ? 1 : 2);
+		int a = tr.v[(i + 1) % 3];
+		int b = tr.v[(i + 2) % 3];
+		double o = orient(a, b, px, py);
+		if (o != 0){
+			return o > 0;
+		}
+		// On the hull edge itself
+		return (px - x[a]) * (px - x[b]) + (py - y[a]) * (py - y[b]) < 0;
+	}
+	// Corner triangles between two hull edges use the real circle; it is
+	// big enough to take them whenever the hull edges next to them go
+	return inCircle(t, px, py) > 0;
+}
+
+int Triangulation::newTri(int a, int b, int c){
+	Tri tr;
+	tr.v[0] = a;
+	tr.v[1] = b;
+	tr.v[2] = c;
+	tr.n[0] = tr.n[1] = tr.n[2] = -1;
+	tr.alive = true;
+	int t;
+	if (!freetris.empty()){
+		t = freetris.back();
+		freetris.pop_back();
+		tris[t] = tr;
+	}
+	else {
+		t = (int)tris.size();
+		tris.push_back(tr);
+		mark.push_back(0);
+	}
+	if (vtri.size() < x.size()){
+		vtri.resize(x.size() + x.size() / 2, -1);
+	}
+	vtri[a] = vtri[b] = vtri[c] = t;
+	return t;
+}
+
+void Triangulation::killTri(int t){
+	tris[t].alive = false;
+	freetris.push_back(t);
+}
+
+void Triangulation::relink(int t, int old, int nt){
+	if (t < 0){
+		return;
+	}
+	for (int i = 0; i < 3; i++){
+		if (tris[t].n[i] == old){
+			tris[t].n[i] = nt;
+			return;
+		}
+	}
+}
+
+int Triangulation::cellOf(double px, double py) const {
+	int cx = (int)((px - gridbounds.left) / (gridbounds.width + 1e-9) * gridsize);
+	int cy = (int)((py - gridbounds.top) / (gridbounds.height + 1e-9) * gridsize);
+	cx = std::min(std::max(cx, 0), gridsize - 1);
+	cy = std::min(std::max(cy, 0), gridsize - 1);
+	return cy * gridsize + cx;
+}
+
+void Triangulation::setHint(double px, double py, int t){
+	grid[cellOf(px, py)] = t;
+	lasttri = t;
+}
+
+int Triangulation::locate(double px, double py){
+	// Start from whichever of the grid hint and the last triangle touched is
+	// closer; slots are recycled, so a hint may point anywhere by now.
+	int t = -1;
+	double best = 0;
+	int starts[2] = { grid.empty() ? -1 : grid[cellOf(px, py)], lasttri };
+	for (int s : starts){
+		if (s < 0 || s >= (int)tris.size() || !tris[s].alive){
+			continue;
+		}
+		const Tri& tr = tris[s];
+		double dx = (x[tr.v[0]] + x[tr.v[1]] + x[tr.v[2]]) / 3 - px;
+		double dy = (y[tr.v[0]] + y[tr.v[1]] + y[tr.v[2]]) / 3 - py;
+		if (t < 0 || dx * dx + dy * dy < best){
+			t = s;
+			best = dx * dx + dy * dy;
+		}
+	}
+	if (t < 0){
+		t = -1;
+		for (unsigned i = 0; i < tris.size() && t < 0; i++){
+			if (tris[i].alive){
+				t = i;
+			}
+		}
+		if (t < 0){
+			return -1;
+		}
+	}
+	// Visibility walk: step across any edge the point lies beyond. The
+	// starting edge rotates so the walk cannot cycle on flat spots.
+	int limit = (int)tris.size() + 8;
+	for (int steps = 0; steps < limit; steps++){
+		const Tri& tr = tris[t];
+		int next = -1;
+		bool outside = false;
+		for (int k = 0; k < 3; k++){
+			int i = (k + steps) % 3;
+			if (orient(tr.v[(i + 1) % 3], tr.v[(i + 2) % 3], px, py) < 0){
+				next = tr.n[i];
+				outside = true;
+				break;
+			}
+		}
+		if (!outside){
+			return t;
+		}
+		if (next < 0){
+			return -1;
+		}
+		t = next;
+	}
+	// The walk got lost (only on badly broken input): fall back to a scan
+	for (unsigned i = 0; i < tris.size(); i++){
+		const Tri& tr = tris[i];
+		if (tr.alive &&
+			orient(tr.v[0], tr.v[1], px, py) >= 0 &&
+			orient(tr.v[1], tr.v[2], px, py) >= 0 &&
+			orient(tr.v[2], tr.v[0], px, py) >= 0){
+			return i;
+		}
+	}
+	return -1;
+}
+
+int Triangulation::insert(double px, double py){
+	created.clear();
+	removed.clear();
+	int t = locate(px, py);
+	if (t < 0){
+		return -1;
+	}
+	for (int i = 0; i < 3; i++){
+		int v = tris[t].v[i];
+		if (x[v] == px && y[v] == py){
+			return v;
+		}
+	}
+
+	// Cavity: every triangle whose circumcircle holds the point, grown
+	// through the adjacency from the one containing it
+	stamp++;
+	cavity.clear();
+	stack.clear();
+	stack.push_back(t);
+	mark[t] = stamp;
+	while (!stack.empty()){
+		int c = stack.back();
+		stack.pop_back();
+		cavity.push_back(c);
+		for (int i = 0; i < 3; i++){
+			int nb = tris[c].n[i];
+			if (nb >= 0 && mark[nb] != stamp && conflicts(nb, px, py) &&
+				canCross(tris[c].v[(i + 1) % 3], tris[c].v[(i + 2) % 3], px, py)){
+				mark[nb] = stamp;
+				stack.push_back(nb);
+			}
+		}
+	}
+	// Rounding can leave a boundary edge the point does not see; pull the
+	// triangle behind it into the cavity until the cavity is star shaped.
+	while (true){
+		boundary.clear();
+		for (int c : cavity){
+			const Tri& tr = tris[c];
+			for (int i = 0; i < 3; i++){
+				int nb = tr.n[i];
+				if (nb < 0 || mark[nb] != stamp){
+					Edge e = { tr.v[(i + 1) % 3], tr.v[(i + 2) % 3], nb };
+					boundary.push_back(e);
+				}
+			}
+		}
+		bool grew = false;
+		for (const Edge& e : boundary){
+			if (e.outside >= 0 && mark[e.outside] != stamp && orient(e.a, e.b, px, py) <= 0 && canCross(e.a, e.b, px, py)){
+				mark[e.outside] = stamp;
+				cavity.push_back(e.outside);
+				grew = true;
+			}
+		}
+		if (!grew){
+			break;
+		}
+	}
+
+	// Constraints inside the cavity are ones the point lies on; they are
+	// split at the new vertex
+	splits.clear();
+	if (!constraints.empty()){
+		for (int c : cavity){
+			const Tri& tr = tris[c];
+			for (int i = 0; i < 3; i++){
+				int a = tr.v[(i + 1) % 3];
+				int b = tr.v[(i + 2) % 3];
+				if (a < b && tr.n[i] >= 0 && mark[tr.n[i]] == stamp && isConstraint(a, b)){
+					Edge e = { a, b, -1 };
+					splits.push_back(e);
+				}
+			}
+		}
+	}
+
+	int v = (int)x.size();
+	x.push_back(px);
+	y.push_back(py);
+	for (int c : cavity){
+		killTri(c);
+		removed.push_back(c);
+	}
+	// Fan the cavity boundary to the new point. bya[a] is the new triangle
+	// whose boundary edge starts at a.
+	if (bya.size() < x.size()){
+		bya.resize(x.size() * 2, -1);
+	}
+	for (const Edge& e : boundary){
+		int nt = newTri(e.a, e.b, v);
+		tris[nt].n[2] = e.outside;
+		if (e.outside >= 0){
+			Tri& out = tris[e.outside];
+			for (int j = 0; j < 3; j++){
+				if (out.v[j] != e.a && out.v[j] != e.b){
+					out.n[j] = nt;
+				}
+			}
+		}
+		bya[e.a] = nt;
+		created.push_back(nt);
+	}
+	for (int nt : created){
+		Tri& tr = tris[nt];
+		// Opposite a is edge (b, v), shared with the triangle starting at b
+		tr.n[0] = bya[tr.v[1]];
+		// Opposite b is edge (v, a), shared with the triangle ending at a
+		tr.n[1] = -1;
+	}
+	for (int nt : created){
+		tris[tris[nt].n[0]].n[1] = nt;
+	}
+	for (const Edge& e : splits){
+		constraints.erase(edgeKey(e.a, e.b));
+		constraints.insert(edgeKey(e.a, v));
+		constraints.insert(edgeKey(v, e.b));
+	}
+	setHint(px, py, created.empty() ? lasttri : created[0]);
+	return v;
+}
+
+bool Triangulation::isConstraint(int a, int b) const {
+	return !constraints.empty() && constraints.count(edgeKey(a, b)) > 0;
+}
+
+bool Triangulation::canCross(int a, int b, double px, double py) const {
+	if (!isConstraint(a, b)){
+		return true;
+	}
+	// Only a point right on the constraint may open it up
+	return orient(a, b, px, py) == 0 && (px - x[a]) * (px - x[b]) + (py - y[a]) * (py - y[b]) < 0;
+}
+
+int Triangulation::startConstraint(int a, int b, int& through){
+	through = -1;
+	int start = vtri[a];
+	if (start < 0 || !tris[start].alive){
+		return -1;
+	}
+	double bx = x[b] - x[a];
+	double by = y[b] - y[a];
+	// Turn one way around a, then the other way if the hull stops the turn
+	for (int dir = 0; dir < 2; dir++){
+		int t = start;
+		for (int steps = 0; t >= 0 && steps < (int)tris.size(); steps++){
+			const Tri& tr = tris[t];
+			int i = tr.v[0] == a ? 0 : (tr.v[1] == a ? 1 : 2);
+			int p = tr.v[(i + 1) % 3];
+			int q = tr.v[(i + 2) % 3];
+			double op = orient(a, p, x[b], y[b]);
+			double oq = orient(a, q, x[b], y[b]);
+			if (op == 0 && (x[p] - x[a]) * bx + (y[p] - y[a]) * by > 0){
+				through = p;
+				return t;
+			}
+			if (oq == 0 && (x[q] - x[a]) * bx + (y[q] - y[a]) * by > 0){
+				through = q;
+				return t;
+			}
+			if (op > 0 && oq < 0){
+				return t;
+			}
+			t = dir == 0 ? tr.n[(i + 1) % 3] : tr.n[(i + 2) % 3];
+			if (t == start){
+				return -1;
+			}
+		}
+	}
+	return -1;
+}
+
+void Triangulation::fillPseudoPolygon(const std::vector<int>& chain, std::vector<std::array<int, 3> >& newtris){
+	// Each edge (first, last) takes the chain point whose circle holds no
+	// other point between them, then both halves are filled the same way
+	std::vector<std::pair<int, int> > todo(1, std::make_pair(0, (int)chain.size() - 1));
+	while (!todo.empty()){
+		int first = todo.back().first;
+		int last = todo.back().second;
+		todo.pop_back();
+		if (last - first < 2){
+			continue;
+		}
+		int a = chain[first];
+		int b = chain[last];
+		int c = first + 1;
+		for (int k = first + 2; k < last; k++){
+			bool positive = orient(a, b, x[chain[c]], y[chain[c]]) > 0;
+			if (inCircle(positive ? a : b, positive ? b : a, chain[c], x[chain[k]], y[chain[k]]) > 0){
+				c = k;
+			}
+		}
+		std::array<int, 3> t = {{ a, b, chain[c] }};
+		if (orient(a, b, x[chain[c]], y[chain[c]]) < 0){
+			std::swap(t[0], t[1]);
+		}
+		newtris.push_back(t);
+		todo.push_back(std::make_pair(first, c));
+		todo.push_back(std::make_pair(c, last));
+	}
+}
+
+bool Triangulation::insertConstraint(int a, int b){
+	created.clear();
+	removed.clear();
+	if (a < 3 || b < 3 || a >= vertexCount() || b >= vertexCount()){
+		return false;
+	}
+	while (a != b){
+		int through;
+		int t = startConstraint(a, b, through);
+		if (t < 0){
+			return false;
+		}
+		if (through >= 0){
+			// The segment runs along an existing edge to the next vertex
+			constraints.insert(edgeKey(a, through));
+			a = through;
+			continue;
+		}
+		// Walk the strip of triangles the segment crosses. The points on
+		// either side of it bound the two pseudo-polygons that replace it.
+		const Tri& first = tris[t];
+		int i = first.v[0] == a ? 0 : (first.v[1] == a ? 1 : 2);
+		int r = first.v[(i + 1) % 3];
+		int l = first.v[(i + 2) % 3];
+		std::vector<int> left(1, a);
+		std::vector<int> right(1, a);
+		left.push_back(l);
+		right.push_back(r);
+		cavity.clear();
+		cavity.push_back(t);
+		int end = -1;
+		int cur = t;
+		while (end < 0){
+			if (isConstraint(l, r)){
+				return false;
+			}
+			const Tri& tr = tris[cur];
+			int k = (tr.v[0] != l && tr.v[0] != r) ? 0 : ((tr.v[1] != l && tr.v[1] != r) ? 1 : 2);
+			int nb = tr.n[k];
+			if (nb < 0){
+				return false;
+			}
+			cavity.push_back(nb);
+			const Tri& tn = tris[nb];
+			int w = (tn.v[0] != l && tn.v[0] != r) ? tn.v[0] : ((tn.v[1] != l && tn.v[1] != r) ? tn.v[1] : tn.v[2]);
+			double o = orient(a, b, x[w], y[w]);
+			if (w == b || o == 0){
+				// Reached b, or a vertex right on the segment
+				end = w;
+			}
+			else if (o > 0){
+				left.push_back(w);
+				l = w;
+			}
+			else {
+				right.push_back(w);
+				r = w;
+			}
+			cur = nb;
+		}
+		left.push_back(end);
+		right.push_back(end);
+
+		stamp++;
+		for (int c : cavity){
+			mark[c] = stamp;
+		}
+		boundary.clear();
+		for (int c : cavity){
+			const Tri& tr = tris[c];
+			for (int j = 0; j < 3; j++){
+				int nb = tr.n[j];
+				if (nb < 0 || mark[nb] != stamp){
+					Edge e = { tr.v[(j + 1) % 3], tr.v[(j + 2) % 3], nb };
+					boundary.push_back(e);
+				}
+			}
+		}
+		for (int c : cavity){
+			killTri(c);
+			removed.push_back(c);
+		}
+		std::vector<std::array<int, 3> > newtris;
+		fillPseudoPolygon(left, newtris);
+		fillPseudoPolygon(right, newtris);
+
+		// Link the new triangles to each other and to the strip's outside
+		std::unordered_map<unsigned long long, int> outside;
+		for (const Edge& e : boundary){
+			outside[((unsigned long long)e.a << 32) | (unsigned)e.b] = e.outside;
+		}
+		std::unordered_map<unsigned long long, int> open;
+		for (const std::array<int, 3>& nt : newtris){
+			int n = newTri(nt[0], nt[1], nt[2]);
+			created.push_back(n);
+			for (int j = 0; j < 3; j++){
+				int ea = nt[(j + 1) % 3];
+				int eb = nt[(j + 2) % 3];
+				std::unordered_map<unsigned long long, int>::iterator out = outside.find(((unsigned long long)ea << 32) | (unsigned)eb);
+				if (out != outside.end()){
+					tris[n].n[j] = out->second;
+					if (out->second >= 0){
+						Tri& o = tris[out->second];
+						for (int k = 0; k < 3; k++){
+							if (o.v[k] != ea && o.v[k] != eb){
+								o.n[k] = n;
+							}
+						}
+					}
+					continue;
+				}
+				std::unordered_map<unsigned long long, int>::iterator other = open.find(((unsigned long long)eb << 32) | (unsigned)ea);
+				if (other != open.end()){
+					tris[n].n[j] = other->second / 3;
+					tris[other->second / 3].n[other->second % 3] = n;
+					open.erase(other);
+				}
+				else {
+					open[((unsigned long long)ea << 32) | (unsigned)eb] = n * 3 + j;
+				}
+			}
+		}
+		if (!created.empty()){
+			lasttri = created[0];
+		}
+		constraints.insert(edgeKey(a, end));
+		a = end;
+	}
+	return true;
+}
+
+void Triangulation::assign(const std::vector<sf::Vector2f>& points, const std::vector<std::array<int, 3> >& triangles){
+	x.assign(3, 0.0);
+	y.assign(3, 0.0);
+	tris.clear();
+	freetris.clear();
+	mark.clear();
+	created.clear();
+	removed.clear();
+	grid.clear();
+	constraints.clear();
+	vtri.clear();
+	lasttri = -1;
+	stamp = 0;
+	for (const sf::Vector2f& p : points){
+		x.push_back(p.x);
+		y.push_back(p.y);
+	}
+	tris.reserve(triangles.size());
+	mark.reserve(triangles.size());
+	for (const std::array<int, 3>& t : triangles){
+		int a = t[0] + 3;
+		int b = t[1] + 3;
+		int c = t[2] + 3;
+		if (orient(a, b, x[c], y[c]) < 0){
+			std::swap(b, c);
+		}
+		newTri(a, b, c);
+	}
+	// Link through the directed edges; the neighbour runs the edge backwards
+	std::unordered_map<unsigned long long, int> edges;
+	edges.reserve(tris.size() * 3);
+	for (int t = 0; t < (int)tris.size(); t++){
+		for (int i = 0; i < 3; i++){
+			unsigned long long a = tris[t].v[(i + 1) % 3];
+			unsigned long long b = tris[t].v[(i + 2) % 3];
+			std::pair<std::unordered_map<unsigned long long, int>::iterator, bool> slot = edges.insert(std::make_pair((a << 32) | b, t * 3 + i));
+			if (!slot.second){
+				// Same edge the same way twice: overlapping triangles
+				slot.first->second = -1;
+			}
+		}
+	}
+	for (int t = 0; t < (int)tris.size(); t++){
+		for (int i = 0; i < 3; i++){
+			unsigned long long a = tris[t].v[(i + 1) % 3];
+			unsigned long long b = tris[t].v[(i + 2) % 3];
+			std::unordered_map<unsigned long long, int>::const_iterator mine = edges.find((a << 32) | b);
+			std::unordered_map<unsigned long long, int>::const_iterator other = edges.find((b << 32) | a);
+			if (mine->second >= 0 && other != edges.end() && other->second >= 0){
+				tris[t].n[i] = other->second / 3;
+			}
+		}
+	}
+}
+
+int Triangulation::backIndex(int t, int i) const {
+	int nb = tris[t].n[i];
+	if (nb < 0){
+		return -1;
+	}
+	for (int j = 0; j < 3; j++){
+		if (tris[nb].n[j] == t){
+			return j;
+		}
+	}
+	return -1;
+}
+
+bool Triangulation::flip(int t, int i){
+	int nb = tris[t].n[i];
+	int j = backIndex(t, i);
+	if (j < 0){
+		return false;
+	}
+	// t = (a, b, d), nb = (c, d, b); the shared edge b-d becomes a-c
+	Tri& ta = tris[t];
+	Tri& tb = tris[nb];
+	int a = ta.v[i];
+	int b = ta.v[(i + 1) % 3];
+	int d = ta.v[(i + 2) % 3];
+	int c = tb.v[j];
+	if (orient(a, b, x[c], y[c]) <= 0 || orient(c, d, x[a], y[a]) <= 0 || isConstraint(b, d)){
+		return false;
+	}
+	int na = ta.n[(i + 1) % 3]; // across d-a
+	int nbb = ta.n[(i + 2) % 3]; // across a-b
+	int nc = tb.n[(j + 1) % 3]; // across b-c
+	int nd = tb.n[(j + 2) % 3]; // across c-d
+	ta.v[0] = a; ta.v[1] = b; ta.v[2] = c;
+	ta.n[0] = nc; ta.n[1] = nb; ta.n[2] = nbb;
+	tb.v[0] = c; tb.v[1] = d; tb.v[2] = a;
+	tb.n[0] = na; tb.n[1] = t; tb.n[2] = nd;
+	relink(nc, nb, t);
+	relink(na, t, nb);
+	vtri[b] = t;
+	vtri[d] = nb;
+	return true;
+}
+
+// Hilbert curve index of (hx, hy) on a 2^16 grid.
+static unsigned long long hilbertIndex(unsigned hx, unsigned hy){
+	unsigned long long d = 0;
+	for (unsigned s = 1u << 15; s > 0; s >>= 1){
+		unsigned rx = (hx & s) > 0;
+		unsigned ry = (hy & s) > 0;
+		d += (unsigned long long)s * s * ((3 * rx) ^ ry);
+		if (ry == 0){
+			if (rx == 1){
+				hx = s - 1 - hx;
+				hy = s - 1 - hy;
+			}
+			std::swap(hx, hy);
+		}
+	}
+	return d;
+}
+
+std::vector<int> Triangulation::insertAll(const std::vector<sf::Vector2f>& points){
+	std::vector<std::pair<unsigned long long, int> > order(points.size());
+	double sx = 65535.0 / std::max(gridbounds.width, 1e-9f);
+	double sy = 65535.0 / std::max(gridbounds.height, 1e-9f);
+	for (unsigned i = 0; i < points.size(); i++){
+		double hx = (points[i].x - gridbounds.left) * sx;
+		double hy = (points[i].y - gridbounds.top) * sy;
+		hx = std::min(std::max(hx, 0.0), 65535.0);
+		hy = std::min(std::max(hy, 0.0), 65535.0);
+		order[i] = std::make_pair(hilbertIndex((unsigned)hx, (unsigned)hy), (int)i);
+	}
+	std::sort(order.begin(), order.end());
+	x.reserve(x.size() + points.size());
+	y.reserve(y.size() + points.size());
+	tris.reserve(tris.size() + points.size() * 2);
+	mark.reserve(tris.capacity());
+	std::vector<int> result(points.size(), -1);
+	for (unsigned i = 0; i < order.size(); i++){
+		const sf::Vector2f& p = points[order[i].second];
+		result[order[i].second] = insert(p.x, p.y);
+	}
+	return result;
+}
+
+void Triangulation::triangles(std::vector<std::array<int, 3> >& out) const {
+	out.clear();
+	for (const Tri& tr : tris){
+		if (tr.alive && !isSuper(tr.v[0]) && !isSuper(tr.v[1]) && !isSuper(tr.v[2])){
+			std::array<int, 3> t = {{ tr.v[0], tr.v[1], tr.v[2] }};
+			out.push_back(t);
+		}
+	}
+}
@@ -0,0 +1,125 @@
+#pragma once
+#include "stdafx.h"
+#include <array>
+#include <unordered_set>
+#include <vector>
+
+// Incremental Delaunay triangulation (Bowyer-Watson) with triangle adjacency.
+//
+// Vertices 0-2 are a super triangle enclosing the bounds given to begin();
+// inserted points start at index 3. Points are located by walking the
+// adjacency from a hint taken from a coarse grid over the bounds, so an
+// insertion only touches the triangles whose circumcircle contains the
+// new point. insertAll() orders points along a Hilbert curve first, which
+// keeps every walk a few steps long.
+//
+// Edges added with insertConstraint() are kept from then on: later
+// insertions never grow a cavity across them (a point landing exactly on
+// one splits it), so the mesh stays a constrained Delaunay triangulation.
+class Triangulation {
+public:
+	struct Tri {
+		int v[3]; // Vertices, positively oriented (see orient())
+		int n[3]; // Neighbour across the edge opposite v[i], -1 on the hull
+		bool alive;
+	};
+
+	Triangulation();
+
+	// Starts an empty triangulation that can hold points inside bounds.
+	void begin(const sf::FloatRect& bounds);
+	// Inserts a point and returns its vertex index. A point on top of an
+	// existing vertex returns that vertex instead.
+	int insert(double px, double py);
+	// Inserts points in a cache friendly order. Returns the vertex index of
+	// each input point.
+	std::vector<int> insertAll(const std::vector<sf::Vector2f>& points);
+	// Forces the edge between vertices a and b into the mesh. Only the
+	// triangles the segment crosses are replaced, so the cost follows the
+	// size of that strip. A segment running through another vertex is
+	// split there. Returns false if it would cross an earlier constraint
+	// (the part up to that point is kept).
+	bool insertConstraint(int a, int b);
+	bool isConstraint(int a, int b) const;
+	int constraintCount() const { return (int)constraints.size(); }
+
+	// Takes over an existing mesh instead: vertex i of points becomes vertex
+	// i + 3 and triangle i stays triangle i (turned positive if needed).
+	// Triangles sharing an edge are linked; edges used by more than two
+	// triangles, or by two facing the same way, are left as borders. Such
+	// a mesh supports flips and queries but not insert().
+	void assign(const std::vector<sf::Vector2f>& points, const std::vector<std::array<int, 3> >& triangles);
+
+	// Replaces the edge opposite v[i] of t and its neighbour's diagonal by
+	// the other diagonal of their quad. Both triangles keep their slots.
+	// Returns false (and changes nothing) unless the quad is strictly convex
+	// and the edge is not a constraint.
+	bool flip(int t, int i);
+	// Slot in neighbour n[i] of t that points back at t.
+	int backIndex(int t, int i) const;
+
+	// Triangle containing the point (walks from a grid hint), or -1.
+	int locate(double px, double py);
+	// Triangles that do not touch the super triangle.
+	void triangles(std::vector<std::array<int, 3> >& out) const;
+
+	bool isSuper(int v) const { return v < 3; }
+	int vertexCount() const { return (int)x.size(); }
+
+	// Orientation of c relative to a->b: > 0 when a, b, c turn counter
+	// clockwise in x-right/y-up terms (clockwise on screen), 0 when collinear.
+	double orient(int a, int b, double cx, double cy) const;
+	// > 0 when the point lies inside the circumcircle of triangle t.
+	double inCircle(int t, double px, double py) const;
+	// Same for the positively oriented triangle a, b, c.
+	double inCircle(int a, int b, int c, double px, double py) const;
+	// Whether the point invalidates triangle t, so it belongs in the cavity
+	// of an insertion. Like inCircle() but with the super vertices at infinity.
+	bool conflicts(int t, double px, double py) const;
+
+	std::vector<double> x;
+	std::vector<double> y;
+	std::vector<Tri> tris;
+	// Triangles created and killed by the last insert() or insertConstraint().
+	std::vector<int> created;
+	std::vector<int> removed;
+
+protected:
+	int newTri(int a, int b, int c);
+	void killTri(int t);
+	// Points the neighbour slot of t that faces old at nt instead.
+	void relink(int t, int old, int nt);
+	// Whether a cavity may grow across edge a-b for the point: not across a
+	// constraint, unless the point lies on it.
+	bool canCross(int a, int b, double px, double py) const;
+	int cellOf(double px, double py) const;
+	void setHint(double px, double py, int t);
+	// Some triangle around vertex a whose wedge holds the direction to b,
+	// and what the segment does there (see insertConstraint()).
+	int startConstraint(int a, int b, int& through);
+	// Triangulates the pseudo-polygon chain[first..last] on one side of the
+	// edge chain[first]-chain[last] into newtris.
+	void fillPseudoPolygon(const std::vector<int>& chain, std::vector<std::array<int, 3> >& newtris);
+
+	std::vector<int> freetris;
+	std::vector<int> mark;   // Per triangle stamp for the cavity search
+	int stamp = 0;
+	int lasttri = -1;
+
+	// Coarse grid of triangle hints for point location
+	sf::FloatRect gridbounds;
+	int gridsize = 1;
+	std::vector<int> grid;
+
+	// Scratch buffers reused between insertions
+	std::vector<int> cavity;
+	std::vector<int> stack;
+	struct Edge { int a, b, outside; };
+	std::vector<Edge> boundary;
+	std::vector<int> bya;
+
+	// Constraint edges by their (smaller, larger) vertex pair
+	std::unordered_set<unsigned long long> constraints;
+	std::vector<int> vtri; // Some live triangle around each vertex
+	std::vector<Edge> splits; // Constraints the point being inserted lies on
+};
@@ -0,0 +1,227 @@
+#include "stdafx.h"
+#include "document.h"
+#include "shading.h"
+#include "json/json.h"
+#include "memory.h"
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// Builds the same JSON layout the editor has always written.
+// With a palette, polygons using one of its swatches store the swatch index
+// instead of the color.
+std::string documentToJSON(const Document& doc){
+	MemoryScope memory(MEM_JSON);
+	Json::Value rootobj;
+	std::map<sf::Uint32, int> swatches;
+	for (unsigned i = 0; i < doc.palette.size(); i++){
+		rootobj["palette"][i] = doc.palette[i].toInteger();
+		swatches.insert(std::make_pair(doc.palette[i].toInteger(), (int)i));
+	}
+	for (unsigned i = 0; i < doc.points.size(); i++){
+		rootobj["rpoints"][i]["vector"]["x"] = doc.points[i].vector.x;
+		rootobj["rpoints"][i]["vector"]["y"] = doc.points[i].vector.y;
+		rootobj["rpoints"][i]["size"] = doc.points[i].size;
+		rootobj["rpoints"][i]["color"] = doc.points[i].color.toInteger();
+	}
+	for (unsigned i = 0; i < doc.polygons.size(); i++){
+		for (int j = 0; j < 3; j++){
+			rootobj["polygons"][i]["pointindices"][j] = doc.polygons[i].sa[j];
+		}
+		std::map<sf::Uint32, int>::const_iterator swatch = swatches.find(doc.polygons[i].fillcolor.toInteger());
+		if (swatch != swatches.end()){
+			rootobj["polygons"][i]["swatch"] = swatch->second;
+		}
+		else {
+			rootobj["polygons"][i]["color"] = doc.polygons[i].fillcolor.toInteger();
+		}
+	}
+	if (doc.gouraud){
+		rootobj["shading"] = "gouraud";
+	}
+	rootobj["checkpoint"] = doc.sequence;
+	std::ostringstream out;
+	out << rootobj << std::endl;
+	return out.str();
+}
+
+static std::string rgbText(const sf::Color& c){
+	return "rgb(" + std::to_string(c.r) + "," + std::to_string(c.g) + "," + std::to_string(c.b) + ")";
+}
+
+// Builds the SVG, one <polygon> per triangle in draw order.
+std::string documentToSVG(const Document& doc){
+	char headerc[350];
+	const char *hdr = "<?xml version=\"1.0\" standalone=\"no\"?>\n<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" \"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\"><svg width=\"%d\" height=\"%d\" viewBox=\"0 0 %d %d\" xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\">\n<style type=\"text/css\"> polygon { stroke-width: .5; stroke-linejoin: round; } </style>";
+	snprintf(headerc, sizeof(headerc), hdr,
+		doc.size.x,
+		doc.size.y,
+		doc.size.x,
+		doc.size.y);
+	std::string out = headerc;
+	for (unsigned i = 0; i < doc.polygons.size(); i++){
+		const DocPoly& p = doc.polygons[i];
+		std::string pointslist = "";
+		for (int j = 0; j < 3; j++){
+			pointslist += std::to_string(doc.points[p.sa[j]].vector.x);
+			pointslist += ",";
+			pointslist += std::to_string(doc.points[p.sa[j]].vector.y);
+			pointslist += " ";
+		}
+		std::string color = rgbText(p.fillcolor);
+		LinearGradient gradient;
+		sf::Vector2f v[3] = { doc.points[p.sa[0]].vector, doc.points[p.sa[1]].vector, doc.points[p.sa[2]].vector };
+		sf::Color c[3] = { doc.points[p.sa[0]].color, doc.points[p.sa[1]].color, doc.points[p.sa[2]].color };
+		if (doc.gouraud && gouraudGradient(v, c, gradient)){
+			char def[320];
+			snprintf(def, sizeof(def), "<linearGradient id=\"g%u\" gradientUnits=\"userSpaceOnUse\" x1=\"%g\" y1=\"%g\" x2=\"%g\" y2=\"%g\">"
+				"<stop offset=\"0\" stop-color=\"%s\"/><stop offset=\"1\" stop-color=\"%s\"/></linearGradient>\n",
+				i, gradient.from.x, gradient.from.y, gradient.to.x, gradient.to.y, rgbText(gradient.start).c_str(), rgbText(gradient.end).c_str());
+			out += def;
+			color = "url(#g" + std::to_string(i) + ")";
+		}
+		else if (doc.gouraud){
+			sf::Color mean((c[0].r + c[1].r + c[2].r) / 3, (c[0].g + c[1].g + c[2].g) / 3, (c[0].b + c[1].b + c[2].b) / 3);
+			color = rgbText(mean);
+		}
+		out += "<polygon style=\"fill:";
+		out += color;
+		out += ";stroke:";
+		out += color;
+		out += "\"";
+		out += " points=\"";
+		out += pointslist;
+		out += "\"/>\n";
+	}
+	out += "\n</svg>";
+	return out;
+}
+
+// Reads the points and polygons from a .vertices file.
+bool loadDocumentJSON(const std::string& filename, Document& doc){
+	MemoryScope memory(MEM_JSON);
+	doc.points.clear();
+	doc.polygons.clear();
+	doc.palette.clear();
+	std::fstream vfilestrm;
+	vfilestrm.open(filename, std::ios::in);
+	if (!vfilestrm || vfilestrm.peek() == std::fstream::traits_type::eof()) {
+		return false;
+	}
+	Json::Value rootobj;
+	vfilestrm >> rootobj;
+	doc.sequence = rootobj.get("checkpoint", 0).asUInt();
+	doc.gouraud = rootobj.get("shading", "flat").asString() == "gouraud";
+	const Json::Value& jsonrpoints = rootobj["rpoints"];
+	const Json::Value& jsonpolygons = rootobj["polygons"];
+	const Json::Value& jsonpalette = rootobj["palette"];
+	for (unsigned i = 0; i < jsonpalette.size(); i++){
+		doc.palette.push_back(sf::Color((sf::Uint32)jsonpalette[i].asInt64()));
+	}
+	doc.points.resize(jsonrpoints.size());
+	for (unsigned i = 0; i < jsonrpoints.size(); i++){
+		DocPoint& p = doc.points[i];
+		p.vector.x = jsonrpoints[i]["vector"]["x"].asFloat();
+		p.vector.y = jsonrpoints[i]["vector"]["y"].asFloat();
+		p.size = jsonrpoints[i]["size"].asFloat();
+		int c = jsonrpoints[i]["color"].asInt64();
+		p.color = sf::Color(c);
+	}
+	doc.polygons.resize(jsonpolygons.size());
+	for (unsigned i = 0; i < jsonpolygons.size(); i++){
+		DocPoly& p = doc.polygons[i];
+		for (int j = 0; j < 3; j++){
+			p.sa[j] = jsonpolygons[i]["pointindices"][j].asInt();
+		}
+		int swatch = jsonpolygons[i].get("swatch", -1).asInt();
+		if (swatch >= 0 && swatch < (int)doc.palette.size()){
+			p.fillcolor = doc.palette[swatch];
+			continue;
+		}
+		int c = jsonpolygons[i]["color"].asInt64();
+		p.fillcolor = sf::Color(c);
+	}
+	return true;
+}
+
+std::vector<std::pair<int, int> > documentEdges(const Document& doc, int mincontrast){
+	struct EdgeUse { int count; sf::Color color; int contrast; };
+	std::map<std::pair<int, int>, EdgeUse> uses;
+	int npoints = (int)doc.points.size();
+	for (const DocPoly& p : doc.polygons){
+		if (p.sa[0] < 0 || p.sa[1] < 0 || p.sa[2] < 0 || p.sa[0] >= npoints || p.sa[1] >= npoints || p.sa[2] >= npoints){
+			continue;
+		}
+		for (int i = 0; i < 3; i++){
+			int a = p.sa[i];
+			int b = p.sa[(i + 1) % 3];
+			if (a == b){
+				continue;
+			}
+			std::pair<int, int> key(std::min(a, b), std::max(a, b));
+			std::map<std::pair<int, int>, EdgeUse>::iterator use = uses.find(key);
+			if (use == uses.end()){
+				EdgeUse first = { 1, p.fillcolor, 0 };
+				uses[key] = first;
+				continue;
+			}
+			const sf::Color& c = use->second.color;
+			int contrast = std::max(std::max(std::abs(c.r - p.fillcolor.r), std::abs(c.g - p.fillcolor.g)), std::abs(c.b - p.fillcolor.b));
+			use->second.count++;
+			use->second.contrast = std::max(use->second.contrast, contrast);
+		}
+	}
+	std::vector<std::pair<int, int> > edges;
+	for (const std::pair<const std::pair<int, int>, EdgeUse>& use : uses){
+		if (use.second.count == 1 || use.second.contrast >= mincontrast){
+			edges.push_back(use.first);
+		}
+	}
+	return edges;
+}
+
+void eraseFromDocument(Document& doc, std::vector<int> polys, std::vector<int> points){
+	std::sort(polys.begin(), polys.end());
+	polys.erase(std::unique(polys.begin(), polys.end()), polys.end());
+	std::sort(points.begin(), points.end());
+	points.erase(std::unique(points.begin(), points.end()), points.end());
+	for (int i = (int)polys.size() - 1; i >= 0; i--){
+		doc.polygons.erase(doc.polygons.begin() + polys[i]);
+	}
+	for (int i = (int)points.size() - 1; i >= 0; i--){
+		doc.points.erase(doc.points.begin() + points[i]);
+	}
+	for (DocPoly& p : doc.polygons){
+		for (int i = 0; i < 3; i++){
+			// Number of removed points below this index
+			p.sa[i] -= std::lower_bound(points.begin(), points.end(), p.sa[i]) - points.begin();
+		}
+	}
+}
+
+bool writeFileAtomic(const std::string& filename, const std::string& data){
+	std::string tmpname = filename + ".tmp";
+	{
+		std::ofstream out(tmpname, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!out){
+			return false;
+		}
+		out.write(data.data(), data.size());
+		out.flush();
+		if (!out){
+			return false;
+		}
+	}
+#ifdef _WIN32
+	// rename() refuses to replace an existing file on windows
+	return MoveFileExA(tmpname.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return std::rename(tmpname.c_str(), filename.c_str()) == 0;
+#endif
+}
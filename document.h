@@ -0,0 +1,48 @@
+#pragma once
+#include "stdafx.h"
+#include <string>
+#include <vector>
+
+// Plain copies of points and polygons with no render shapes attached.
+// These are cheap to copy and safe to hand to another thread.
+struct DocPoint {
+	sf::Vector2f vector;
+	float size;
+	sf::Color color;
+};
+
+struct DocPoly {
+	int sa[3]; // Indices to Document::points
+	sf::Color fillcolor;
+};
+
+// Everything that gets written to the .vertices and .svg files.
+struct Document {
+	std::vector<DocPoint> points;
+	std::vector<DocPoly>  polygons;
+	std::vector<sf::Color> palette; // Swatches the colors were quantized to, empty if none
+	bool gouraud = false; // Shade polygons from their point colors instead of filling them flat
+	sf::Vector2u size; // Size of the source image
+	unsigned sequence = 0; // Checkpoint number, matched against the journal header
+};
+
+// Serializers for the two sidecar formats. With gouraud set, the SVG
+// fills each polygon with a linear gradient (see gouraudGradient).
+std::string documentToJSON(const Document& doc);
+std::string documentToSVG(const Document& doc);
+
+// Reads a .vertices file. Returns false if it is missing or empty.
+bool loadDocumentJSON(const std::string& filename, Document& doc);
+
+// Edges of the polygons (point index pairs, smaller index first) whose
+// fill colors differ by at least mincontrast in some channel across them.
+// Edges with a polygon on one side only are always included.
+std::vector<std::pair<int, int> > documentEdges(const Document& doc, int mincontrast);
+
+// Removes polygons and points by index the same way Engine::deleteSelection
+// does, shifting the point indices of the remaining polygons.
+void eraseFromDocument(Document& doc, std::vector<int> polys, std::vector<int> points);
+
+// Writes data to filename + ".tmp" and renames it over filename,
+// so a crash mid-write never leaves a truncated file behind.
+bool writeFileAtomic(const std::string& filename, const std::string& data);
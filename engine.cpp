@@ -1,13 +1,20 @@
 #include "stdafx.h"
 #include "engine.h"
 #include "poly.h"
+#include "mesh.h"
+#include "delaunay.h"
+#include "flips.h"
+#include "repair.h"
+#include "parallel.h"
 #include "tinyfiledialogs.h"
 #include "json/json.h"
 #include <iomanip>
+#include <map>
+#include <array>
+#include <cmath>
 #include "imgui/imgui.h"
 #include "imgui/imconfig.h"
 #include "imgui-backends/SFML/imgui-events-SFML.h"
-#include "imgui-backends/SFML/imgui-rendering-SFML.h"
 #include "imgui/imguicolorpicker.h"
 
 
@@ -23,26 +30,132 @@
 #define WINDOW_Y 480
 // Fixed framerate set in the engine constructor.
 #define FRAMERATE 144
+// Journal records after which a checkpoint is written regardless of the autosave interval.
+#define JOURNALCOMPACT 20000
+// Milliseconds between fidelity metric updates while they are shown.
+#define METRICSINTERVAL 250
+// Color samples per polygon when re-averaging (A).
+#define RECOLORSAMPLES 10
 // Range in pixels to snap to already existing points.
 #define GRABDIST 10  
+// Largest side of the preview shown while a large image's full texture uploads.
+#define PREVIEWSIZE 1024
 
-// Background color 
-#define BGCOLOR sf::Color(125,125,125,255)
+// How far the image loader got (Engine::imagestage).
+#define IMAGE_FAILED  -1
+#define IMAGE_DECODING 0
+#define IMAGE_DECODED  1  // img can be read, no texture yet
+#define IMAGE_PREVIEW  2  // preview uploaded
+#define IMAGE_FULL     3  // full size texture uploaded
 
-// Number of decimals to care about when using randdbl.
-// RPRECISION should equal 10^x where x is the relevant decimal count.
-#define RPRECISION 10000
-// Returns a random double between a and b.
-#define randdbl(a,b) ((rand()%(RPRECISION*(b-a)))/(RPRECISION*((float)b-a))+a)
+// Box filtered copy of img whose larger side is at most size pixels.
+static sf::Image downsample(const sf::Image& img, unsigned size){
+	sf::Vector2u from = img.getSize();
+	unsigned step = (std::max(from.x, from.y) + size - 1) / size;
+	unsigned w = (from.x + step - 1) / step;
+	unsigned h = (from.y + step - 1) / step;
+	const sf::Uint8* src = img.getPixelsPtr();
+	std::vector<sf::Uint8> pixels(w * h * 4);
+	parallelFor(h, [&](int y){
+		unsigned y0 = y * step;
+		unsigned y1 = std::min(from.y, y0 + step);
+		for (unsigned x = 0; x < w; x++){
+			unsigned x0 = x * step;
+			unsigned x1 = std::min(from.x, x0 + step);
+			unsigned sum[4] = { 0, 0, 0, 0 };
+			for (unsigned sy = y0; sy < y1; sy++){
+				const sf::Uint8* p = src + (sy * from.x + x0) * 4;
+				for (unsigned sx = x0; sx < x1; sx++, p += 4){
+					for (int c = 0; c < 4; c++){
+						sum[c] += p[c];
+					}
+				}
+			}
+			unsigned n = (x1 - x0) * (y1 - y0);
+			for (int c = 0; c < 4; c++){
+				pixels[(y * w + x) * 4 + c] = (sf::Uint8)(sum[c] / n);
+			}
+		}
+	});
+	sf::Image out;
+	out.create(w, h, &pixels[0]);
+	return out;
+}
+
+// Name of an event in a trace, and the argument worth recording with it.
+static const char* eventName(const sf::Event& event, const char*& argname, double& arg){
+	argname = NULL;
+	arg = 0;
+	switch (event.type){
+	case sf::Event::KeyPressed:
+		argname = "code";
+		arg = event.key.code;
+		return "KeyPressed";
+	case sf::Event::KeyReleased:
+		argname = "code";
+		arg = event.key.code;
+		return "KeyReleased";
+	case sf::Event::MouseButtonPressed:
+		argname = "button";
+		arg = event.mouseButton.button;
+		return "MouseButtonPressed";
+	case sf::Event::MouseButtonReleased:
+		argname = "button";
+		arg = event.mouseButton.button;
+		return "MouseButtonReleased";
+	case sf::Event::MouseWheelScrolled:
+		argname = "delta";
+		arg = event.mouseWheelScroll.delta;
+		return "MouseWheelScrolled";
+	case sf::Event::MouseMoved: return "MouseMoved";
+	case sf::Event::TextEntered: return "TextEntered";
+	case sf::Event::Resized: return "Resized";
+	case sf::Event::LostFocus: return "LostFocus";
+	case sf::Event::GainedFocus: return "GainedFocus";
+	case sf::Event::Closed: return "Closed";
+	default: return "Event";
+	}
+}
 
 // Returns the distance between two vectors.
 float v2fdistance(sf::Vector2f a, sf::Vector2f b){
 	return std::sqrt((b.x - a.x)*(b.x - a.x) + (b.y - a.y)*(b.y - a.y));
 }
 
+// Heap bytes held by the SFML shape of one point and of one polygon, found
+// by building one of each. The objects themselves are counted with the
+// vectors they are in.
+static void measureShapes(long long& pointbytes, long long& polybytes){
+	Point a(sf::Vector2f(0, 0), 1), b(sf::Vector2f(1, 0), 1), c(sf::Vector2f(0, 1), 1);
+	long long before = Memory::threadBytes();
+	{
+		Point p(sf::Vector2f(0, 0), 1);
+		p.updateCShape(1);
+		pointbytes = Memory::threadBytes() - before;
+	}
+	before = Memory::threadBytes();
+	Poly poly(&a, &b, &c, 0, 1, 2);
+	poly.updateCShape(1);
+	polybytes = Memory::threadBytes() - before;
+}
+
 // Constructor for the main engine.
-// Sets up renderwindow variables and loads an image.
-Engine::Engine(int aaLevel) {
+// Sets up renderwindow variables, starts loading an image and hands the
+// window over to the render thread. With recordfile the input is recorded
+// once loaded; with replayfile a recording is replayed instead of asking
+// for an image.
+Engine::Engine(int aaLevel, const std::string& _recordfile, const std::string& _replayfile) {
+	// Count what ImGui allocates, from its first allocation on
+	ImGui::GetIO().MemAllocFn = Memory::imguiAlloc;
+	ImGui::GetIO().MemFreeFn = Memory::imguiFree;
+	measureShapes(pointshapebytes, polyshapebytes);
+	recordfile = _recordfile;
+	if (!_replayfile.empty()){
+		if (!replay.open(_replayfile)){
+			std::exit(1);
+		}
+		replaying = true;
+	}
 	sf::ContextSettings settings;
 	settings.antialiasingLevel = aaLevel;
 	window = new sf::RenderWindow(sf::VideoMode(WINDOW_X, WINDOW_Y), WINDOWTITLE, sf::Style::Default,settings);
@@ -53,19 +166,25 @@ Engine::Engine(int aaLevel) {
 		std::exit(1);
 	}
 	view.reset(sf::FloatRect(0, 0, WINDOW_X, WINDOW_Y));
-	window->setView(view);
-	drawimg.setTexture(image);
 
 	// Initialize GUI and backend
-	ImGui::SFML::SetRenderTarget(*window);
-	ImGui::SFML::InitImGuiRendering();
 	ImGui::SFML::SetWindow(*window);
 	ImGui::SFML::InitImGuiEvents();
+	// Panels would open where imgui.ini last left them, which may differ
+	// between a recording and its replay
+	if (replaying || !recordfile.empty()){
+		ImGui::GetIO().IniFilename = NULL;
+	}
+	renderer = new Renderer(*window);
+	renderer->resetCamera(sf::FloatRect(0, 0, WINDOW_X, WINDOW_Y));
+	renderer->setKeyCamera(!replaying);
+	renderer->start();
 }
 
 // Destructor for the main engine.
 // Deletes the window.
 Engine::~Engine() {
+	delete renderer;
 	delete window;
 }
 
@@ -73,22 +192,67 @@ Engine::~Engine() {
 // Delegates events to the Engine::handleEvents() function,
 // Saves on exit, 
 // and delegates update/draw as well.
+// Drawing happens on the render thread; this thread only fills in the
+// frames it draws, so it is paced to the frame rate here instead of by
+// display(). Replays run unpaced.
 void Engine::run() {
+	Tracer::nameThread("Editor");
+	if (replaying) {
+		// Recordings start at the first frame with everything loaded
+		if (imageload.valid()) {
+			imageload.wait();
+		}
+		meshload.wait();
+		updateLoad();
+		rng.seed(replay.seed);
+		std::cout << "Replaying " << replay.frames.size() << " frames from " << replay.filename << "\n";
+	}
 	while (window->isOpen()) {
+		frameclock.restart();
+		ProfileScope frame(PHASE_TICK);
+		// Pick up camera moves made by the render thread
+		renderer->getCamera(view, viewzoom);
+		if (!recordfile.empty() && !recorder.recording() && loaded && !imageload.valid()) {
+			startRecording();
+		}
+		pollInput();
+		ProfileScope events(PHASE_EVENTS);
 		sf::Event event;
-		while (window->pollEvent(event)) {
+		while (nextEvent(event)) {
+			if (Tracer::recording()) {
+				const char* argname;
+				double arg;
+				const char* name = eventName(event, argname, arg);
+				Tracer::instant(name, "input", argname, arg);
+			}
+			// Nothing to save or edit until the image and mesh are in
+			if (!loaded) {
+				if (event.type == sf::Event::Closed) {
+					if (imageload.valid()) {
+						imageload.wait();
+					}
+					meshload.wait();
+					renderer->stop();
+					window->close();
+					std::exit(1);
+				}
+				if (event.type == sf::Event::Resized || event.type == sf::Event::MouseWheelScrolled) {
+					handleEvents(event);
+				}
+				continue;
+			}
 			if (event.type == sf::Event::Closed) {
-				saveJSON();
-				ImGui::SFML::Shutdown();
-				window->close();
-				std::exit(1);
+				shutdown();
 			}
 			// Handle events in relation to the GUI
 			handleGUItoggleEvent(event);
 			// If the GUI is open pass events to it and block left clicks
-			if (showColorPickerGUI) {
+			// (the status panel only blocks clicks that land on it)
+			if (showColorPickerGUI || showStatusGUI || showProfilerGUI || showMemoryGUI) {
 				ImGui::SFML::ProcessEvent(event);
-				if (!(event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left)) {
+				bool blockclick = showColorPickerGUI || ImGui::GetIO().WantCaptureMouse;
+				bool blockkey = ImGui::GetIO().WantTextInput && event.type == sf::Event::KeyPressed;
+				if (!blockkey && !(blockclick && event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left)) {
 					handleEvents(event);
 				}
 			}
@@ -97,34 +261,208 @@ void Engine::run() {
 				handleEvents(event);
 			}
 		}
-		window->clear(BGCOLOR);
+		events.stop();
+		updateLoad();
+		bool loading = !loaded || imageload.valid();
+		bool gui = showColorPickerGUI || showStatusGUI || showProfilerGUI || showMemoryGUI || loading;
 		// If a GUI is up update them
-		if (showColorPickerGUI) {
-			ImGui::SFML::UpdateImGui();
-			ImGui::SFML::UpdateImGuiRendering();
-			createColorPickerGUI();
+		if (gui) {
+			ProfileScope scope(PHASE_GUI);
+			ImGui::SFML::UpdateImGui(input.mouse, input.left, input.right, input.dt);
+			ImGui::GetIO().DisplaySize = ImVec2((float)input.winsize.x, (float)input.winsize.y);
+			if (showColorPickerGUI) {
+				createColorPickerGUI();
+			}
+			if (showStatusGUI) {
+				createStatusGUI();
+			}
+			if (showProfilerGUI) {
+				createProfilerGUI();
+			}
+			if (showMemoryGUI) {
+				createMemoryGUI();
+			}
+			if (loading) {
+				createLoadingGUI();
+			}
 		}
 		// Main loop
-		update();
+		if (loaded) {
+			update();
+		}
 		draw();
+		// Append this frame's edits to the journal, and compact it into a
+		// checkpoint periodically. The write itself happens off this thread.
+		if (loaded) {
+			ProfileScope scope(PHASE_BACKGROUND);
+			updateJournal();
+			updateExport();
+			updateRecolor();
+			updateMetrics();
+			updateMemory();
+			if (journal.recordCount > 0 && (autosave.due() || journal.recordCount > JOURNALCOMPACT)) {
+				std::cout << "Autosaving\n";
+				saveAsync();
+			}
+		}
 		// Render UI
-		if (showColorPickerGUI) {
-			ImGui::Render();
+		if (gui) {
+			renderer->renderGUI();
+		}
+		renderer->submit();
+		if (Tracer::recording()) {
+			long long allocations = Memory::allocations();
+			Tracer::counter("Allocations per frame", (double)(allocations - frameallocations));
+			Tracer::counter("Live allocations", (double)(allocations - Memory::frees()));
+			Tracer::counter("Heap MB", Memory::stats()[MEM_HEAP].live / 1048576.0);
+			frameallocations = allocations;
+		}
+		frame.stop();
+		float ms = frameclock.getElapsedTime().asSeconds() * 1000.0f;
+		if (recorder.recording()) {
+			input.ms = ms;
+			recorder.record(input);
+		}
+		if (replaying) {
+			replay.time(ms);
+			continue;
+		}
+		sf::Time left = sf::seconds(1.0f / FRAMERATE) - frameclock.getElapsedTime();
+		if (left > sf::Time::Zero) {
+			sf::sleep(left);
 		}
-		window->display();
 	}
 }
 
-// Loads an image into the engine variables, 
+// Fills input with what this frame sees of the mouse, the window and the
+// camera: polled from the devices, or the next recorded frame while
+// replaying. Everything the editor thread reads outside of events comes
+// from here.
+void Engine::pollInput() {
+	if (replaying) {
+		if (replay.done()) {
+			shutdown();
+		}
+		input = replay.advance();
+		replayevent = 0;
+		view = sf::View(input.center, input.size);
+		viewzoom = input.zoom;
+		renderer->setCamera(view, viewzoom);
+		if (window->getSize() != input.winsize) {
+			window->setSize(input.winsize);
+		}
+		return;
+	}
+	input.events.clear();
+	input.dt = inputclock.restart().asSeconds();
+	input.mouse = sf::Mouse::getPosition(*window);
+	input.left = sf::Mouse::isButtonPressed(sf::Mouse::Left);
+	input.right = sf::Mouse::isButtonPressed(sf::Mouse::Right);
+	input.winsize = window->getSize();
+	input.center = view.getCenter();
+	input.size = view.getSize();
+	input.zoom = viewzoom;
+	input.recolored = false;
+}
+
+// Next event of this frame. While replaying, events come from the
+// recording and the window's own are dropped, except that closing the
+// window ends the replay.
+bool Engine::nextEvent(sf::Event& event) {
+	if (replaying) {
+		sf::Event own;
+		while (window->pollEvent(own)) {
+			if (own.type == sf::Event::Closed) {
+				shutdown();
+			}
+		}
+		if (replayevent >= input.events.size()) {
+			return false;
+		}
+		event = input.events[replayevent++];
+		return true;
+	}
+	if (!window->pollEvent(event)) {
+		return false;
+	}
+	if (recorder.recording()) {
+		input.events.push_back(event);
+	}
+	return true;
+}
+
+// Starts recording to recordfile, from the mesh as it is now. The sampling
+// seed starts over so the replay draws the same random numbers.
+void Engine::startRecording() {
+	unsigned seed = rng();
+	rng.seed(seed);
+	if (recorder.start(recordfile, file, seed, snapshot())) {
+		std::cout << "Recording input to " << recordfile << "\n";
+	}
+	else {
+		std::cout << "Could not write " << recordfile << "\n";
+		recordfile.clear();
+	}
+}
+
+// Writes the final checkpoint, waits for the background work and exits.
+// A recording gets the frame in progress (with the close event); a replay
+// prints its timings.
+void Engine::shutdown() {
+	journal.flush();
+	Document doc = snapshot();
+	doc.sequence = journal.beginCheckpoint();
+	autosave.submit(doc);
+	autosave.stop();
+	if (autosave.getStats().savedSequence == doc.sequence) {
+		journal.endCheckpoint();
+	}
+	journal.close();
+	if (pngexport.valid()) {
+		exportcancel.cancel();
+		pngexport.wait();
+	}
+	if (imageload.valid()) {
+		imageload.wait();
+	}
+	if (recolor.valid()) {
+		recolorjob->cancel.cancel();
+		recolor.wait();
+	}
+	renderer->stop();
+	if (Tracer::recording()) {
+		std::string name = Tracer::file();
+		Tracer::stop();
+		std::cout << "Trace of " << Tracer::events() << " events written to " << name << "\n";
+	}
+	if (recorder.recording()) {
+		input.ms = frameclock.getElapsedTime().asSeconds() * 1000.0f;
+		recorder.record(input);
+		recorder.stop();
+		std::cout << "Recorded " << recorder.frames << " frames to " << recorder.name() << "\n";
+	}
+	if (replaying) {
+		replay.report();
+	}
+	window->close();
+	std::exit(1);
+}
+
+// Asks for an image and starts loading it in the background,
 // storing the names of the files to save into vfile and sfile.
-// If the files do not exist, they are created.
+// The image is decoded on one thread (loadImage) and the mesh read on
+// another (loadJSON); updateLoad() takes them over as they come in.
+// The sidecar files are not created until the first save.
 int Engine::load(){
-	const char* filter[3] = { "*.png", "*.jpg", "*.gif" };
-    const char* filenamecc = tinyfd_openFileDialog("Select image: ", "./", 3, filter, NULL, 0);
-	if (filenamecc == NULL){
-		return 1;
+	std::string filename = replay.image;
+	if (!replaying){
+		const char* filter[3] = { "*.png", "*.jpg", "*.gif" };
+		const char* filenamecc = tinyfd_openFileDialog("Select image: ", "./", 3, filter, NULL, 0);
+		if (filenamecc == NULL){
+			return 1;
+		}
+		filename = filenamecc;
 	}
-	std::string filename = filenamecc;
 	// Strip extension
 	size_t lastindex = filename.find_last_of(".");
 	std::string filenoext = filename.substr(0, lastindex);
@@ -133,36 +471,118 @@ int Engine::load(){
 	const std::string vfext = ".vertices";
 	vfile = filenoext + vfext;
 	sfile = filenoext + sfext;
-	// Open/create based on if the file exists
-	std::fstream vstream;
-	vstream.open(vfile, std::ios::in);
-	if (!vstream){
-		vstream.open(vfile, std::ios::out);
-	}
-	std::fstream sstream;
-	sstream.open(sfile, std::ios::in);
-	if (!sstream){
-		sstream.open(sfile, std::ios::out);
-	}
-	// Fail if the images do not open correctly
-	if (!(image.loadFromFile(filename))){
-		return 1;
-	}
-	if (!(img.loadFromFile(filename))){
-		return 1;
-	}
-	// Load JSOn containing points, etc.
-	loadJSON();
-	vstream.close();
-	sstream.close();
+	jfile = vfile + ".journal";
+	pfile = filenoext + ".lowpoly.png";
+	tfile = filenoext + ".trace.json";
+	file = filename;
+	// Replays start from the mesh saved with the recording and write next
+	// to it, never over the image's own files
+	if (replaying){
+		std::string base = replay.filename + ".replay";
+		vfile = base + vfext;
+		sfile = base + sfext;
+		jfile = vfile + ".journal";
+		pfile = base + ".png";
+		tfile = base + ".trace.json";
+		std::ifstream mesh(replay.mesh, std::ios::binary);
+		std::stringstream contents;
+		contents << mesh.rdbuf();
+		std::remove(jfile.c_str());
+		if (!mesh || !writeFileAtomic(vfile, contents.str())){
+			std::cout << "Could not copy " << replay.mesh << " to " << vfile << "\n";
+			return 1;
+		}
+	}
+	loadclock.restart();
+	imageload = std::async(std::launch::async, [this](){ return loadImage(); });
+	meshload = std::async(std::launch::async, [this](){ return loadJSON(); });
 	return 0;
 }
 
+// Runs on a loader thread. Decodes file into img, uploads a small preview
+// if the image is large, then the full size texture, advancing imagestage
+// after each step. Returns false if the image does not decode.
+// Without a full size texture (e.g. larger than the GPU allows) the
+// preview stays up.
+bool Engine::loadImage(){
+	Tracer::nameThread("Image loader");
+	sf::Clock clock;
+	{
+		TraceScope scope("Decode image", "load");
+		if (!(img.loadFromFile(file))){
+			imagestage = IMAGE_FAILED;
+			return false;
+		}
+	}
+	decodeTime = clock.restart().asSeconds() * 1000.0f;
+	imagestage = IMAGE_DECODED;
+	sf::Vector2u size = img.getSize();
+	if (std::max(size.x, size.y) > PREVIEWSIZE) {
+		TraceScope scope("Upload preview", "load");
+		if (preview.loadFromImage(downsample(img, PREVIEWSIZE))){
+			imagestage = IMAGE_PREVIEW;
+		}
+	}
+	clock.restart();
+	{
+		TraceScope scope("Upload texture", "load");
+		if (image.loadFromImage(img)){
+			imagestage = IMAGE_FULL;
+		}
+	}
+	uploadTime = clock.restart().asSeconds() * 1000.0f;
+	return true;
+}
+
+// Runs once per frame while loading. The mesh is shown as soon as it is
+// read and the image is decoded (points are clamped to the image); the
+// image timings are printed once the full size texture is up.
+void Engine::updateLoad(){
+	if (!loaded && imagestage >= IMAGE_DECODED && meshload.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		int replayed = meshload.get();
+		if (replayed > 0){
+			std::cout << "Recovered " << replayed << " unsaved edits from " << jfile << "\n";
+		}
+		setDocument(loaddoc);
+		journal.open(jfile, loaddoc.sequence, loadrecords);
+		journal.recordCount = replayed;
+		loaddoc = Document();
+		loadrecords.clear();
+		autosave.start(vfile, sfile);
+		loaded = true;
+		std::cout << "total polygons loaded: " << polygons.size() << "\n";
+	}
+	if (imageload.valid() && imageload.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		if (!imageload.get()) {
+			std::cout << "Could not load " << file << "\n";
+			meshload.wait();
+			renderer->stop();
+			window->close();
+			std::exit(1);
+		}
+		printf("Decoded %ux%u image in %.1f ms, texture upload %.1f ms\n",
+			img.getSize().x, img.getSize().y, decodeTime, uploadTime);
+		if (imagestage != IMAGE_FULL) {
+			printf("Could not upload the full size texture, showing a preview\n");
+		}
+	}
+}
+
 // Check if the GUI is being toggled; pause other inputs if it is
 void Engine::handleGUItoggleEvent(sf::Event event) {
 	if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::C) {
 		showColorPickerGUI = !showColorPickerGUI;
 	}
+	if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::I) {
+		showStatusGUI = !showStatusGUI;
+	}
+	if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F3) {
+		showProfilerGUI = !showProfilerGUI;
+		Profiler::shared().enable(showProfilerGUI);
+	}
+	if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F5) {
+		showMemoryGUI = !showMemoryGUI;
+	}
 }
 
 
@@ -209,36 +629,89 @@ void Engine::handleEvents(sf::Event event){
 			clearSelection();
             std::cout << "Clearing selection (Spacebar) \n";
 		}
-        // Saves the file as a set of a SVG and ".vertices" file
+        // Saves the file as a set of a SVG and ".vertices" file, written by
+        // the autosave thread
 		if (event.key.code == sf::Keyboard::S){
-			saveVector(file);
-			saveJSON();
+			saveAsync();
             std::cout << "Saving file (S) \n";
 		}
+        // Renders the polygons to a PNG on the CPU, in the background
+		if (event.key.code == sf::Keyboard::E){
+			exportRaster();
+		}
+        // Starts/stops recording a trace of what every thread does
+		if (event.key.code == sf::Keyboard::F4){
+			if (Tracer::recording()){
+				std::string name = Tracer::file();
+				Tracer::stop();
+				std::cout << "Trace of " << Tracer::events() << " events written to " << name << " (F4)\n";
+			}
+			else if (Tracer::start(tfile)){
+				std::cout << "Recording trace to " << tfile << " (F4)\n";
+			}
+			else {
+				std::cout << "Could not write " << tfile << "\n";
+			}
+		}
         // Camera panning without mousewheelclick
 		if (event.key.code == sf::Keyboard::LControl){
             std::cout << "Panning while button held (LControl)\n";
-			sf::Vector2i pointi = sf::Mouse::getPosition(*window);
-			sf::Vector2f point;
-			point.x = (float)pointi.x;
-			point.y = (float)pointi.y;
-			point = windowToGlobalPos(point);
+			sf::Vector2f point = windowToGlobalPos(getMPosFloat());
 			vdraginitpt = point;
 			vdragflag = true;
 		}
+        // Connects the selected points (or all points) into a Delaunay mesh
+		if (event.key.code == sf::Keyboard::T){
+			std::cout << "Triangulating " << (spointsin.size() >= 3 ? "selection" : "all points") << " (T)\n";
+			triangulate();
+		}
+        // Places points automatically, denser where the image has detail
+		if (event.key.code == sf::Keyboard::G){
+			std::cout << "Generating " << seedoptions.count << " points (G)\n";
+			generatePoints();
+		}
+        // Adds points where the polygons match the image worst
+		if (event.key.code == sf::Keyboard::R){
+			std::cout << "Refining mesh (R)\n";
+			refine();
+		}
+        // Flips polygon diagonals where the other one matches the image better
+		if (event.key.code == sf::Keyboard::F){
+			std::cout << "Optimizing diagonals (F)\n";
+			optimizeDiagonals();
+		}
+        // Writes a copy of the mesh simplified to the polygon count in the status panel
+		if (event.key.code == sf::Keyboard::L){
+			exportSimplified();
+		}
+        // Switches between flat and Gouraud shading, sampling the point colors
+		if (event.key.code == sf::Keyboard::V){
+			gouraud = !gouraud;
+			std::cout << (gouraud ? "Gouraud shading (V)\n" : "Flat shading (V)\n");
+			journal.setShading(gouraud);
+			if (gouraud){
+				shadeVertices();
+			}
+		}
+        // Reduces the polygon colors to a palette (or snaps them to the fixed one)
+		if (event.key.code == sf::Keyboard::K){
+			std::cout << "Quantizing colors (K)\n";
+			quantizeColors();
+		}
         // Deletes selected points, polys
 		if (event.key.code == sf::Keyboard::Delete){
             std::cout << "Deleting selection (Delete) \n";
 			deleteSelection();
 		}
-        // Reaverage colors
+        // Reaverage colors of the selected polygons, or of every polygon with shift
 		if (event.key.code == sf::Keyboard::A) {
-            std::cout << "Re-averaging color in polygon (A) \n";
-            if (spoly != NULL){
-                spoly->fillcolor = sf::Color(avgClr(rpoints[spoly->s1], rpoints[spoly->s2], rpoints[spoly->s3], 10));
-            } else {
-                "Can't change color - no polygon selected (C) \n";
-            }
+			if (event.key.shift) {
+				std::cout << "Re-averaging color in every polygon (Shift+A)\n";
+			}
+			else {
+				std::cout << "Re-averaging color in selected polygons (A)\n";
+			}
+			recolorPolygons(event.key.shift);
         }
         // Get color at mouse
 		if (event.key.code == sf::Keyboard::O) {
@@ -249,6 +722,7 @@ void Engine::handleEvents(sf::Event event){
 				point = getClampedImgPoint(point);
                 sf::Color color = img.getPixel(point.x, point.y);
                 spoly->fillcolor = color;
+                journal.setColor(spoly - &polygons[0], spoly->fillcolor);
             } else {
                 "Can't change color - no polygon selected (C) \n";
             }
@@ -261,6 +735,7 @@ void Engine::handleEvents(sf::Event event){
 					if (polygons[i].selected == true){
 						polygons.insert(polygons.begin(), polygons[i]);
 						polygons.erase(1 + polygons.begin() + i);
+						journal.sendToBack(i);
 					}
 				}
 				clearSelection();
@@ -274,6 +749,7 @@ void Engine::handleEvents(sf::Event event){
 					if (polygons[i].selected == true){
 						polygons.push_back(polygons[i]);
 						polygons.erase(polygons.begin() + i);
+						journal.sendToFront(i);
 					}
 				}
 				clearSelection();
@@ -306,6 +782,10 @@ void Engine::handleEvents(sf::Event event){
 	// On click release (used for disabling flags)
 	if (event.type == sf::Event::MouseButtonReleased){
 		if (event.mouseButton.button == sf::Mouse::Left){
+			// Journal where the dragged point ended up
+			if (dragflag && rpoints[nindex].vector != pdragstart){
+				journal.movePoint(nindex, rpoints[nindex].vector);
+			}
 			dragflag = false;
 		}
 		if (event.mouseButton.button == sf::Mouse::Middle){
@@ -318,12 +798,12 @@ void Engine::handleEvents(sf::Event event){
 		if (event.mouseWheelScroll.delta < 0){
 			viewzoom *= 1.5;
 			view.zoom(1.5);
-			window->setView(view);
+			renderer->zoomCamera(1.5);
 		}
 		else if (event.mouseWheelScroll.delta > 0){
 			viewzoom *= 0.75;
 			view.zoom(0.75);
-			window->setView(view);
+			renderer->zoomCamera(0.75);
 		}
 	}
 
@@ -331,22 +811,15 @@ void Engine::handleEvents(sf::Event event){
 	if (event.type == sf::Event::Resized){
 		view.reset(sf::FloatRect(0, 0, (float)event.size.width, (float)event.size.height));
 		viewzoom = 1;
-		window->setView(view);
+		renderer->resetCamera(sf::FloatRect(0, 0, (float)event.size.width, (float)event.size.height));
 	}
 }
 
 // Handles logic directly before drawing.
 // This function runs every frame.
 void Engine::update(){
-	// safeguard bandaid fix for spoly FIX ME
-	for (Poly& polygon : polygons){
-		polygon.updateCShape(viewzoom);
-		polygon.updateCenter();
-	}
-	for (Point& point : rpoints){
-		point.updateCShape(viewzoom);
-		point.vector = getClampedImgPoint(point.vector);
-	}
+	ProfileScope scope(PHASE_UPDATE);
+	updateMesh(rpoints, polygons, img.getSize());
 	for (auto& point : nspoints){
 		point->selected = false;
 	}
@@ -354,8 +827,6 @@ void Engine::update(){
 		point->selected = true;
 	}
 
-	handleCamera();
-
 	if (wireframe == true && (wireframe != wireframels)){
 		for (Poly& polygon : polygons){
 			polygon.isWireframe = true;
@@ -373,6 +844,9 @@ void Engine::update(){
 		point = windowToGlobalPos(point);
 		sf::Vector2f rpoint = rpoints[nindex].vector;
 		rpoints[nindex].vector = (pdragoffset + point);
+		if (keepvalid && rpoints[nindex].vector != rpoint){
+			repairAround(nindex);
+		}
 	}
 	if (vdragflag){
 		sf::Vector2f point = getMPosFloat();
@@ -380,41 +854,100 @@ void Engine::update(){
 		vdragoffset.x = (vdraginitpt.x - point.x);
 		vdragoffset.y = (vdraginitpt.y - point.y);
 		view.move(vdragoffset);
-		window->setView(view);
+		renderer->moveCamera(vdragoffset);
 	}
 }
 
-// Draws the objects to the screen.
+// Fills the frame the render thread draws next.
 // This function runs every frame, preceded by Engine::update().
 void Engine::draw(){
-	// Reset view incase other objects change it
-	window->setView(view);
-	if (!hideimage){
-		window->draw(drawimg);
+	ProfileScope scope(PHASE_DRAW);
+	FrameData& f = renderer->frame();
+	int stage = imagestage;
+	f.image = stage == IMAGE_FULL ? &image : stage == IMAGE_PREVIEW ? &preview : NULL;
+	if (f.image != NULL){
+		f.imagesize = sf::Vector2f(img.getSize());
 	}
-	for (Poly polygon : polygons){
-		if (polygon.selected == false){
-			window->draw(polygon.cshape);
-		}
+	f.showimage = !hideimage;
+	f.smooth = imgsmooth;
+	f.showpoints = showrvectors;
+	f.showcenters = showcenters;
+	fillFrame(f, polygons, rpoints, wireframe, gouraud);
+}
+
+// Progress of the background load, shown until the image and mesh are in
+void Engine::createLoadingGUI() {
+	int stage = imagestage;
+	bool meshread = loaded || meshload.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+	int steps = (stage >= IMAGE_DECODED) + (stage == IMAGE_FULL || !imageload.valid()) + meshread;
+	ImGui::Begin("Loading");
+	ImGui::Text("%s", file.c_str());
+	ImGui::ProgressBar(steps / 3.0f);
+	if (stage < IMAGE_DECODED) {
+		ImGui::Text("Decoding image");
+	}
+	else if (stage == IMAGE_DECODED && imageload.valid()) {
+		ImGui::Text("Uploading texture");
+	}
+	else if (stage == IMAGE_PREVIEW && imageload.valid()) {
+		ImGui::Text("Uploading full size texture (showing a preview)");
 	}
-	if (showrvectors){
-		for (Point& point : rpoints){
-			window->draw(point.cshape);
+	if (loaded) {
+		ImGui::Text("Mesh: %d polygons", (int)polygons.size());
+	}
+	else {
+		ImGui::Text(meshread ? "Mesh read, waiting for the image" : "Reading mesh");
+	}
+	ImGui::Text("%.1f s", loadclock.getElapsedTime().asSeconds());
+	ImGui::End();
+}
+
+// Rolling timings of the frame phases and slow operations (F3), and what
+// the render thread drew last frame. Timings are only taken while shown.
+void Engine::createProfilerGUI() {
+	ImGui::Begin("Profiler");
+	ImGui::Text("%-12s %7s %7s %7s %7s", "ms", "last", "min", "avg", "p99");
+	for (const PhaseStats& s : Profiler::shared().stats()) {
+		if (s.samples > 0) {
+			ImGui::Text("%-12s %7.2f %7.2f %7.2f %7.2f", s.name, s.last, s.min, s.avg, s.p99);
 		}
 	}
-	for (Poly polygon : polygons){
-		if (polygon.selected == true){
-			window->draw(polygon.cshape);
+	ImGui::Separator();
+	RenderCounts counts = renderer->counts();
+	ImGui::Text("Draw calls: %d (%d ImGui)", counts.drawcalls, counts.guicommands);
+	ImGui::Text("Triangles batched: %d, shapes: %d", counts.triangles, counts.shapes);
+	ImGui::Text("ImGui: %d vertices, %d indices", counts.guivertices, counts.guielements);
+	ImGui::End();
+}
+
+// Live and peak memory per subsystem (F5), with the budgets to edit.
+// Rows whose peak went over budget are red.
+void Engine::createMemoryGUI() {
+	ImGui::Begin("Memory");
+	ImGui::Text("%-9s %9s %9s   budget", "MB", "live", "peak");
+	std::vector<MemoryStats> stats = Memory::stats();
+	for (int t = 0; t < MEM_COUNT; t++) {
+		const MemoryStats& s = stats[t];
+		bool over = s.budget > 0 && s.peak > s.budget;
+		ImVec4 color = over ? ImVec4(1.0f, 0.35f, 0.35f, 1.0f) : ImGui::GetStyle().Colors[ImGuiCol_Text];
+		ImGui::TextColored(color, "%-9s %9.1f %9.1f", s.name, s.live / 1048576.0, s.peak / 1048576.0);
+		ImGui::SameLine();
+		ImGui::PushID(t);
+		ImGui::PushItemWidth(90);
+		float budget = s.budget / 1048576.0f;
+		if (ImGui::DragFloat("##budget", &budget, 1.0f, 0.0f, 1048576.0f, budget > 0 ? "%.0f MB" : "none")) {
+			Memory::setBudget(t, (long long)(budget * 1048576.0f));
 		}
+		ImGui::PopItemWidth();
+		ImGui::PopID();
 	}
-    if (showcenters){
-        for (Poly polygon : polygons){
-            sf::CircleShape cshape = sf::CircleShape(2*viewzoom);
-            cshape.setPosition(polygon.center);
-            cshape.setFillColor(sf::Color(255,255,255,127));
-            window->draw(cshape);
-        }
-    }
+	ImGui::Separator();
+	ImGui::Text("Allocations: %lld, %lld live", Memory::allocations(), Memory::allocations() - Memory::frees());
+	ImGui::Text("Textures are in GPU memory, not on the heap.");
+	if (ImGui::Button("Reset peaks")) {
+		Memory::resetPeaks();
+	}
+	ImGui::End();
 }
 
 // Create GUI elements for color picker
@@ -428,6 +961,20 @@ void Engine::createColorPickerGUI() {
 		spolycolor[2] = spoly->fillcolor.b / 255.0f;
 		if (ColorPicker3(spolycolor)){
 			spoly->fillcolor = sf::Color(spolycolor[0] * 255.0f, spolycolor[1] * 255.0f, spolycolor[2] * 255.0f, 255);
+			journal.setColor(spoly - &polygons[0], spoly->fillcolor);
+		}
+		// Swatches of the last quantization (K), click one to use it
+		for (unsigned i = 0; i < palette.size(); i++){
+			if (i % 8 != 0){
+				ImGui::SameLine();
+			}
+			ImGui::PushID(i);
+			ImVec4 swatch(palette[i].r / 255.0f, palette[i].g / 255.0f, palette[i].b / 255.0f, 1.0f);
+			if (ImGui::ColorButton(swatch)){
+				spoly->fillcolor = palette[i];
+				journal.setColor(spoly - &polygons[0], spoly->fillcolor);
+			}
+			ImGui::PopID();
 		}
 	}
 	else {
@@ -436,34 +983,96 @@ void Engine::createColorPickerGUI() {
 	ImGui::End();
 }
 
-// Checks input for arrow keys and +/- for camera movement
-void Engine::handleCamera() {
-	if (sf::Keyboard::isKeyPressed(sf::Keyboard::Left) && window->hasFocus()) {
-		view.move(sf::Vector2f(-2 * viewzoom, 0));
-		window->setView(view);
+// Create GUI elements for the status panel
+void Engine::createStatusGUI() {
+	ImGui::Begin("Status");
+	ImGui::Text("Points: %d  Polygons: %d", (int)rpoints.size(), (int)polygons.size());
+	if (imageload.valid()) {
+		ImGui::Text("Image: %ux%u, decode %.1f ms, uploading", img.getSize().x, img.getSize().y, decodeTime);
 	}
-	if (sf::Keyboard::isKeyPressed(sf::Keyboard::Right) && window->hasFocus()) {
-		view.move(sf::Vector2f(2 * viewzoom, 0));
-		window->setView(view);
+	else {
+		ImGui::Text("Image: %ux%u, decode %.1f ms, upload %.1f ms", img.getSize().x, img.getSize().y, decodeTime, uploadTime);
 	}
-	if (sf::Keyboard::isKeyPressed(sf::Keyboard::Up) && window->hasFocus()) {
-		view.move(sf::Vector2f(0, -2 * viewzoom));
-		window->setView(view);
+	ImGui::Separator();
+	AutosaveStats stats = autosave.getStats();
+	ImGui::SliderInt("Autosave (s)", &autosave.interval, 0, 600);
+	if (autosave.interval == 0) {
+		ImGui::Text("Autosave off, saving only on S and exit.");
 	}
-	if (sf::Keyboard::isKeyPressed(sf::Keyboard::Down) && window->hasFocus()) {
-		view.move(sf::Vector2f(0, 2 * viewzoom));
-		window->setView(view);
+	if (stats.saveCount > 0) {
+		ImGui::Text("Last save: %.0fs ago%s", stats.sinceLastSave / 1000.0f, stats.lastFailed ? " (FAILED)" : "");
+		ImGui::Text("Latency: %.1f ms (write %.1f ms)", stats.lastLatency, stats.lastWriteTime);
 	}
-	if (sf::Keyboard::isKeyPressed(sf::Keyboard::Dash) && window->hasFocus()) {
-		viewzoom *= 1.01f;
-		view.zoom(1.01f);
-		window->setView(view);
+	else {
+		ImGui::Text("Not saved yet this session.");
+	}
+	ImGui::Text("Snapshot: %.2f ms%s", snapshotTime, stats.busy ? "  [writing]" : "");
+	ImGui::Text("Journal: %d edits, %d bytes since checkpoint", journal.recordCount, (int)journal.byteCount);
+	if (poolusage.empty() || poolclock.getElapsedTime().asMilliseconds() >= 1000) {
+		PoolStats now = ThreadPool::shared().stats();
+		poolusage = describePool(poolstats, now);
+		poolstats = now;
+		float seconds = poolclock.restart().asSeconds();
+		long long drawn = renderer->framesDrawn();
+		long long built = renderer->framesSubmitted();
+		drawrate = (drawn - framesdrawn) / seconds;
+		buildrate = (built - framesbuilt) / seconds;
+		framesdrawn = drawn;
+		framesbuilt = built;
+	}
+	ImGui::Text("Threads: %d, %s", ThreadPool::threads(), poolusage.c_str());
+	ImGui::Text("Frames: %.0f drawn/s, %.0f built/s", drawrate, buildrate);
+	if (Tracer::recording()) {
+		ImGui::Text("F4: recording trace, %lld events written", Tracer::events());
 	}
-	if (sf::Keyboard::isKeyPressed(sf::Keyboard::Equal) && window->hasFocus()) {
-		viewzoom *= 0.99f;
-		view.zoom(0.99f);
-		window->setView(view);
+	if (recolor.valid()) {
+		ImGui::Text("Recoloring: %d of %d polygons", (int)recolorjob->done, (int)recolorjob->polys.size());
+	}
+	ImGui::Separator();
+	ImGui::DragInt("Seed points", &seedoptions.count, 50, 3, 1000000);
+	ImGui::SliderFloat("Seed contrast", &seedoptions.contrast, 0.0f, 1.0f);
+	ImGui::Checkbox("Seed border", &seedoptions.border);
+	ImGui::DragInt("Refine triangles", &refineoptions.triangles, 100, 1, 2000000);
+	ImGui::SliderFloat("Refine error", &refineoptions.maxerror, 0.0f, 32.0f);
+	ImGui::Checkbox("Keep polygon edges", &keepedges);
+	ImGui::SliderInt("Keep edges from contrast", &keepcontrast, 0, 255);
+	ImGui::Checkbox("Keep mesh valid while dragging", &keepvalid);
+	ImGui::Text("G: place points, T: triangulate, R: refine, F: flip diagonals");
+	ImGui::DragInt("Simplify to", &simplifyoptions.triangles, 50, 1, 2000000);
+	ImGui::Text("L: write a copy simplified to %d polygons", simplifyoptions.triangles);
+	if (gouraud) {
+		ImGui::Text("V: flat shading");
+		if (ImGui::Button("Sample point colors")) {
+			shadeVertices();
+		}
 	}
+	else {
+		ImGui::Text("V: Gouraud shading from the point colors");
+	}
+	ImGui::DragInt("Palette colors", &paletteoptions.colors, 1, 1, 4096);
+	ImGui::InputText("Fixed palette", fixedpalette, sizeof(fixedpalette));
+	if (fixedpalette[0] != 0) {
+		ImGui::Text("K: snap the polygon colors to the fixed palette");
+	}
+	else {
+		ImGui::Text("K: quantize the polygon colors to %d colors", paletteoptions.colors);
+	}
+	ImGui::Separator();
+	ImGui::Checkbox("Live fidelity metrics", &livemetrics);
+	if (livemetrics && !metrics.empty()) {
+		ImGui::Text("PSNR: %.2f dB  SSIM: %.4f", fidelity.psnr, fidelity.ssim);
+		ImGui::Text("Updated %d tiles in %.1f ms", fidelity.tiles, fidelity.time);
+	}
+	ImGui::Separator();
+	ImGui::SliderFloat("PNG scale", &pngoptions.scale, 0.25f, 8.0f);
+	ImGui::SliderInt("Supersampling", &pngoptions.supersample, 1, 8);
+	if (pngexport.valid()) {
+		ImGui::Text("Exporting PNG...");
+	}
+	else {
+		ImGui::Text("E: export %s", pfile.c_str());
+	}
+	ImGui::End();
 }
 
 /*////////////////////////////////////////////////////////////////////////////
@@ -487,13 +1096,12 @@ void Engine::clearSelection() {
 
 // On slash
 void Engine::smoothnessToggle() {
-	image.setSmooth(!imgsmooth);
 	imgsmooth = !imgsmooth;
-	drawimg.setTexture(image);
 }
 
 // On delete
 void Engine::deleteSelection() {
+	ProfileScope scope(PHASE_DELETE);
 	if (spointsin.size() == 0 && spoly == NULL) {}
 	else {
 		std::vector<int> polyIndices;
@@ -534,6 +1142,7 @@ void Engine::deleteSelection() {
 		// Reverse indices for easier deletion of elements
 		std::reverse(rpointsIndices.begin(), rpointsIndices.end());
 		std::reverse(polyIndices.begin(), polyIndices.end());
+		journal.erase(polyIndices, rpointsIndices);
 		/*for (Poly& polygon : polygons){
 			cout << "Polygon point 1 x:" << polygon.p1->vector.x << endl;
 		}
@@ -568,8 +1177,583 @@ void Engine::deleteSelection() {
 	}
 }
 
+// On T
+// Replaces the polygons between the selected points (all points when fewer
+// than 3 are selected) with their Delaunay triangulation. Triangles that
+// already existed keep their color, new ones are averaged from the image.
+void Engine::triangulate() {
+	ProfileScope scope(PHASE_TRIANGULATE);
+	sf::Clock clock;
+	std::vector<int> ids = spointsin;
+	if (ids.size() < 3) {
+		ids.clear();
+		for (unsigned i = 0; i < rpoints.size(); i++) {
+			ids.push_back(i);
+		}
+	}
+	if (ids.size() < 3) {
+		std::cout << "Need at least 3 points to triangulate\n";
+		return;
+	}
+	std::sort(ids.begin(), ids.end());
+	ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+	std::vector<sf::Vector2f> pts;
+	sf::Vector2f lo = rpoints[ids[0]].vector;
+	sf::Vector2f hi = lo;
+	for (int id : ids) {
+		sf::Vector2f v = rpoints[id].vector;
+		pts.push_back(v);
+		lo.x = std::min(lo.x, v.x);
+		lo.y = std::min(lo.y, v.y);
+		hi.x = std::max(hi.x, v.x);
+		hi.y = std::max(hi.y, v.y);
+	}
+	Triangulation tri;
+	tri.begin(sf::FloatRect(lo.x, lo.y, hi.x - lo.x, hi.y - lo.y));
+	std::vector<int> verts = tri.insertAll(pts);
+	// Vertex -> rpoints index; points on top of each other share a vertex
+	std::vector<int> owner(tri.vertexCount(), -1);
+	std::vector<int> vertof(rpoints.size(), -1);
+	for (unsigned i = 0; i < verts.size(); i++) {
+		if (verts[i] >= 0 && owner[verts[i]] < 0) {
+			owner[verts[i]] = ids[i];
+		}
+		vertof[ids[i]] = verts[i];
+	}
+	if (keepedges) {
+		keepEdges(tri, vertof);
+	}
+	std::vector<std::array<int, 3> > result;
+	tri.triangles(result);
+
+	std::vector<std::array<int, 3> > tris;
+	for (const std::array<int, 3>& t : result) {
+		std::array<int, 3> mapped = {{ owner[t[0]], owner[t[1]], owner[t[2]] }};
+		tris.push_back(mapped);
+	}
+	int kept = replacePolygons(ids, tris, NULL);
+	std::cout << "Triangulated " << ids.size() << " points into " << result.size() << " polygons ("
+		<< kept << " kept their color) in " << clock.getElapsedTime().asMilliseconds() << " ms\n";
+}
+
+// On G
+// Seeds points from the image detail map, keeping clear of existing points.
+void Engine::generatePoints() {
+	sf::Clock clock;
+	std::vector<sf::Vector2f> existing;
+	for (Point& point : rpoints) {
+		existing.push_back(point.vector);
+	}
+	std::vector<sf::Vector2f> points = seedPoints(img, seedoptions, existing);
+	rpoints.reserve(rpoints.size() + points.size());
+	for (const sf::Vector2f& point : points) {
+		rpoints.push_back(Point(point, 5));
+		journal.addPoint(point, rpoints.back().size, rpoints.back().color);
+	}
+	clearSelection();
+	for (Poly& poly : polygons) {
+		poly.updatePointers(rpoints);
+	}
+	// Seeds differ on the next press
+	seedoptions.seed++;
+	std::cout << "Placed " << points.size() << " points in " << clock.getElapsedTime().asMilliseconds() << " ms\n";
+}
+
+// Forces the edges of the current polygons (those with keepcontrast or more
+// across them) into tri. vertof maps rpoints indices to vertices of tri, -1
+// for points that are not in it. Returns how many edges were kept.
+int Engine::keepEdges(Triangulation& tri, const std::vector<int>& vertof) {
+	int kept = 0;
+	int crossing = 0;
+	for (const std::pair<int, int>& e : documentEdges(snapshot(), keepcontrast)) {
+		int a = vertof[e.first];
+		int b = vertof[e.second];
+		if (a < 0 || b < 0 || a == b) {
+			continue;
+		}
+		if (tri.insertConstraint(a, b)) {
+			kept++;
+		}
+		else {
+			crossing++;
+		}
+	}
+	std::cout << "Kept " << kept << " polygon edges";
+	if (crossing > 0) {
+		std::cout << " (" << crossing << " skipped, they cross another kept edge)";
+	}
+	std::cout << "\n";
+	return kept;
+}
+
+// Replaces the polygons whose points are all in ids with tris (indices to
+// rpoints). Colors come from colors when given; otherwise triangles that
+// already existed keep their color and new ones are averaged from the image.
+// Returns how many kept their color.
+int Engine::replacePolygons(const std::vector<int>& ids, const std::vector<std::array<int, 3> >& tris, const std::vector<sf::Color>* colors) {
+	std::vector<bool> inset(rpoints.size(), false);
+	for (int id : ids) {
+		inset[id] = true;
+	}
+	std::map<std::array<int, 3>, sf::Color> oldcolors;
+	std::vector<int> polyIndices;
+	for (unsigned i = 0; i < polygons.size(); i++) {
+		Poly& poly = polygons[i];
+		if (inset[poly.sa[0]] && inset[poly.sa[1]] && inset[poly.sa[2]]) {
+			std::array<int, 3> key = {{ poly.sa[0], poly.sa[1], poly.sa[2] }};
+			std::sort(key.begin(), key.end());
+			oldcolors[key] = poly.fillcolor;
+			polyIndices.push_back(i);
+		}
+	}
+	std::reverse(polyIndices.begin(), polyIndices.end());
+	journal.erase(polyIndices, std::vector<int>());
+	// Compact in one pass; erasing one by one is quadratic on big meshes
+	unsigned out = 0;
+	for (unsigned i = 0; i < polygons.size(); i++) {
+		Poly& poly = polygons[i];
+		if (!(inset[poly.sa[0]] && inset[poly.sa[1]] && inset[poly.sa[2]])) {
+			if (out != i) {
+				polygons[out] = poly;
+			}
+			out++;
+		}
+	}
+	polygons.erase(polygons.begin() + out, polygons.end());
+
+	int kept = 0;
+	polygons.reserve(polygons.size() + tris.size());
+	for (unsigned i = 0; i < tris.size(); i++) {
+		int a = tris[i][0];
+		int b = tris[i][1];
+		int c = tris[i][2];
+		Poly poly(&rpoints[a], &rpoints[b], &rpoints[c], a, b, c, sf::Color::Green);
+		if (colors != NULL) {
+			poly.fillcolor = (*colors)[i];
+		}
+		else {
+			std::array<int, 3> key = {{ a, b, c }};
+			std::sort(key.begin(), key.end());
+			std::map<std::array<int, 3>, sf::Color>::iterator old = oldcolors.find(key);
+			if (old != oldcolors.end()) {
+				poly.fillcolor = old->second;
+				kept++;
+			}
+			else {
+				poly.fillcolor = avgClr(rpoints[a], rpoints[b], rpoints[c], 10);
+			}
+		}
+		journal.addPoly(a, b, c, poly.fillcolor);
+		polygons.push_back(poly);
+	}
+	clearSelection();
+	for (Poly& poly : polygons) {
+		poly.updatePointers(rpoints);
+	}
+	if (gouraud) {
+		shadeVertices();
+	}
+	return kept;
+}
+
+// On R
+// Splits the polygons that match the image worst until the triangle budget
+// or error target in refineoptions is met. Every polygon edge is kept, so
+// polygons that are not split keep their corners, color and place, and a
+// split one is replaced by the triangles it was cut into. With no polygons,
+// every point (or the image corners) is triangulated first.
+void Engine::refine() {
+	ProfileScope scope(PHASE_REFINE);
+	sf::Clock clock;
+	sf::Vector2u size = img.getSize();
+	if (polygons.empty() && rpoints.size() < 3) {
+		// Start from the image corners
+		sf::Vector2f corners[4] = { sf::Vector2f(0, 0), sf::Vector2f((float)size.x, 0),
+			sf::Vector2f((float)size.x, (float)size.y), sf::Vector2f(0, (float)size.y) };
+		for (int i = 0; i < 4; i++) {
+			rpoints.push_back(Point(corners[i], 5));
+			journal.addPoint(corners[i], rpoints.back().size, rpoints.back().color);
+		}
+	}
+	if (colorstats.empty()) {
+		colorstats.build(img);
+	}
+	bool fresh = polygons.empty();
+	std::vector<int> ids;
+	std::vector<int> vertof(rpoints.size(), -1);
+	if (fresh) {
+		for (unsigned i = 0; i < rpoints.size(); i++) {
+			ids.push_back(i);
+		}
+	}
+	else {
+		// Only the corners of the polygons, loose points stay loose
+		for (Poly& poly : polygons) {
+			for (int j = 0; j < 3; j++) {
+				if (vertof[poly.sa[j]] < 0) {
+					vertof[poly.sa[j]] = 0;
+					ids.push_back(poly.sa[j]);
+				}
+			}
+		}
+	}
+	std::vector<sf::Vector2f> pts;
+	for (int id : ids) {
+		pts.push_back(getClampedImgPoint(rpoints[id].vector));
+	}
+	Triangulation tri;
+	tri.begin(sf::FloatRect(0, 0, (float)size.x, (float)size.y));
+	std::vector<int> verts = tri.insertAll(pts);
+	std::vector<int> owner(tri.vertexCount(), -1);
+	for (unsigned i = 0; i < verts.size(); i++) {
+		if (verts[i] >= 0 && owner[verts[i]] < 0) {
+			owner[verts[i]] = ids[i];
+		}
+		vertof[ids[i]] = verts[i];
+	}
+	Refiner refiner(tri, colorstats);
+	RefineOptions options = refineoptions;
+	if (!fresh) {
+		// Constrain every polygon edge, so each insertion stays inside the
+		// polygon it splits, then label the triangle each polygon became.
+		// Polygons that are not a triangle of the mesh (overlapping or
+		// degenerate ones) are left alone.
+		for (Poly& poly : polygons) {
+			for (int j = 0; j < 3; j++) {
+				int a = vertof[poly.sa[j]];
+				int b = vertof[poly.sa[(j + 1) % 3]];
+				if (a >= 0 && b >= 0 && a != b && !tri.isConstraint(a, b)) {
+					tri.insertConstraint(a, b);
+				}
+			}
+		}
+		std::map<std::array<int, 3>, int> slots;
+		for (unsigned t = 0; t < tri.tris.size(); t++) {
+			const Triangulation::Tri& tr = tri.tris[t];
+			if (tr.alive) {
+				std::array<int, 3> key = {{ tr.v[0], tr.v[1], tr.v[2] }};
+				std::sort(key.begin(), key.end());
+				slots[key] = t;
+			}
+		}
+		std::vector<int> labels(tri.tris.size(), -1);
+		int matched = 0;
+		for (unsigned i = 0; i < polygons.size(); i++) {
+			int v[3];
+			for (int j = 0; j < 3; j++) {
+				v[j] = vertof[polygons[i].sa[j]];
+			}
+			if (v[0] < 0 || v[1] < 0 || v[2] < 0 ||
+				!tri.isConstraint(v[0], v[1]) || !tri.isConstraint(v[1], v[2]) || !tri.isConstraint(v[2], v[0])) {
+				continue;
+			}
+			std::array<int, 3> key = {{ v[0], v[1], v[2] }};
+			std::sort(key.begin(), key.end());
+			std::map<std::array<int, 3>, int>::iterator slot = slots.find(key);
+			if (slot != slots.end() && labels[slot->second] < 0) {
+				labels[slot->second] = i;
+				matched++;
+			}
+		}
+		refiner.setLabels(labels);
+		// The budget counts the polygons left alone too
+		options.triangles -= (int)polygons.size() - matched;
+	}
+	int before = tri.vertexCount();
+	int inserted = refiner.run(options);
+
+	owner.resize(tri.vertexCount(), -1);
+	rpoints.reserve(rpoints.size() + inserted);
+	for (int v = before; v < tri.vertexCount(); v++) {
+		sf::Vector2f point((float)tri.x[v], (float)tri.y[v]);
+		rpoints.push_back(Point(point, 5));
+		journal.addPoint(point, rpoints.back().size, rpoints.back().color);
+		owner[v] = rpoints.size() - 1;
+		ids.push_back(owner[v]);
+	}
+	if (fresh) {
+		std::vector<std::array<int, 3> > result;
+		std::vector<sf::Color> colors;
+		refiner.result(result, colors);
+		for (std::array<int, 3>& t : result) {
+			for (int j = 0; j < 3; j++) {
+				t[j] = owner[t[j]];
+			}
+		}
+		replacePolygons(ids, result, &colors);
+		std::cout << "Refined to " << result.size() << " polygons (" << inserted << " new points) in "
+			<< clock.getElapsedTime().asMilliseconds() << " ms\n";
+		return;
+	}
+	// A split polygon keeps its slot for its first piece, the other pieces
+	// go on top of the draw order
+	std::vector<std::array<int, 3> > created;
+	std::vector<sf::Color> colors;
+	std::vector<int> labels;
+	refiner.created(created, colors, labels);
+	std::vector<bool> split(polygons.size(), false);
+	int changed = 0;
+	polygons.reserve(polygons.size() + created.size());
+	for (unsigned i = 0; i < created.size(); i++) {
+		int a = owner[created[i][0]];
+		int b = owner[created[i][1]];
+		int c = owner[created[i][2]];
+		int label = labels[i];
+		if (label >= 0 && !split[label]) {
+			split[label] = true;
+			changed++;
+			Poly& poly = polygons[label];
+			poly.sa[0] = a;
+			poly.sa[1] = b;
+			poly.sa[2] = c;
+			poly.updatePointsToArray();
+			poly.fillcolor = colors[i];
+			journal.setPoly(label, a, b, c, poly.fillcolor);
+		}
+		else {
+			Poly poly(&rpoints[a], &rpoints[b], &rpoints[c], a, b, c, colors[i]);
+			journal.addPoly(a, b, c, poly.fillcolor);
+			polygons.push_back(poly);
+		}
+	}
+	clearSelection();
+	for (Poly& poly : polygons) {
+		poly.updatePointers(rpoints);
+	}
+	if (gouraud) {
+		shadeVertices();
+	}
+	std::cout << "Refined " << changed << " polygons into " << created.size() << " (" << inserted << " new points), "
+		<< polygons.size() << " polygons in " << clock.getElapsedTime().asMilliseconds() << " ms\n";
+}
+
+// On F
+// Flips the shared edge of every pair of polygons forming a convex quad
+// when the other diagonal lowers the squared color error, until no flip
+// helps. Points stay where they are; flipped polygons get their mean color.
+void Engine::optimizeDiagonals() {
+	sf::Clock clock;
+	if (polygons.empty()) {
+		std::cout << "No polygons to optimize\n";
+		return;
+	}
+	if (colorstats.empty()) {
+		colorstats.build(img);
+	}
+	std::vector<sf::Vector2f> pts;
+	for (Point& point : rpoints) {
+		pts.push_back(getClampedImgPoint(point.vector));
+	}
+	std::vector<std::array<int, 3> > tris;
+	for (Poly& poly : polygons) {
+		std::array<int, 3> t = {{ poly.sa[0], poly.sa[1], poly.sa[2] }};
+		tris.push_back(t);
+	}
+	Triangulation tri;
+	tri.assign(pts, tris);
+	std::vector<int> changed;
+	FlipStats stats = optimizeFlips(tri, colorstats, &changed);
+	std::sort(changed.begin(), changed.end());
+	changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+	for (int t : changed) {
+		Poly& poly = polygons[t];
+		const Triangulation::Tri& tr = tri.tris[t];
+		sf::Vector2f v[3];
+		for (int j = 0; j < 3; j++) {
+			poly.sa[j] = tr.v[j] - 3;
+			v[j] = pts[poly.sa[j]];
+		}
+		poly.updatePointsToArray();
+		poly.fillcolor = colorstats.triangle(v[0], v[1], v[2]).mean();
+		journal.setPoly(t, poly.sa[0], poly.sa[1], poly.sa[2], poly.fillcolor);
+	}
+	for (Poly& poly : polygons) {
+		poly.updatePointers(rpoints);
+	}
+	if (gouraud) {
+		shadeVertices();
+	}
+	std::cout << "Flipped " << stats.flips << " diagonals (" << stats.evaluated << " tried), error "
+		<< stats.before << " -> " << stats.after << " in " << clock.getElapsedTime().asMilliseconds() << " ms\n";
+}
+
+// While dragging with keepvalid set
+// Re-triangulates the area around the point if its polygons fold over their
+// neighbours. Only the polygons near the point are copied for the repair:
+// those within the box around its one-ring, grown by its size, which holds
+// every triangle repairVertex can reach. Only the polygons that got new
+// corners are recolored, and with Gouraud shading their corners reshaded.
+void Engine::repairAround(int index) {
+	sf::Vector2f at = getClampedImgPoint(rpoints[index].vector);
+	sf::FloatRect box(at, sf::Vector2f(0, 0));
+	bool ring = false;
+	for (Poly& poly : polygons) {
+		if (poly.sa[0] != index && poly.sa[1] != index && poly.sa[2] != index) {
+			continue;
+		}
+		ring = true;
+		for (int j = 0; j < 3; j++) {
+			sf::Vector2f c = getClampedImgPoint(rpoints[poly.sa[j]].vector);
+			float right = std::max(box.left + box.width, c.x);
+			float bottom = std::max(box.top + box.height, c.y);
+			box.left = std::min(box.left, c.x);
+			box.top = std::min(box.top, c.y);
+			box.width = right - box.left;
+			box.height = bottom - box.top;
+		}
+	}
+	if (!ring) {
+		return;
+	}
+	float margin = std::max(box.width, box.height);
+	// Local copies of the nearby polygons; ids maps their points back
+	std::vector<int> slots;
+	std::vector<int> ids;
+	std::map<int, int> local;
+	std::vector<sf::Vector2f> pts;
+	std::vector<std::array<int, 3> > tris;
+	for (unsigned i = 0; i < polygons.size(); i++) {
+		const Poly& poly = polygons[i];
+		sf::Vector2f c[3];
+		for (int j = 0; j < 3; j++) {
+			c[j] = getClampedImgPoint(rpoints[poly.sa[j]].vector);
+		}
+		float left = std::min(c[0].x, std::min(c[1].x, c[2].x));
+		float right = std::max(c[0].x, std::max(c[1].x, c[2].x));
+		float top = std::min(c[0].y, std::min(c[1].y, c[2].y));
+		float bottom = std::max(c[0].y, std::max(c[1].y, c[2].y));
+		if (right < box.left - margin || left > box.left + box.width + margin ||
+			bottom < box.top - margin || top > box.top + box.height + margin) {
+			continue;
+		}
+		std::array<int, 3> t;
+		for (int j = 0; j < 3; j++) {
+			std::map<int, int>::iterator found = local.find(poly.sa[j]);
+			if (found == local.end()) {
+				found = local.insert(std::make_pair(poly.sa[j], (int)ids.size())).first;
+				ids.push_back(poly.sa[j]);
+				pts.push_back(c[j]);
+			}
+			t[j] = found->second;
+		}
+		slots.push_back(i);
+		tris.push_back(t);
+	}
+	std::vector<int> changed;
+	repairVertex(pts, tris, local[index], &changed);
+	if (changed.empty()) {
+		return;
+	}
+	if (colorstats.empty()) {
+		colorstats.build(img);
+	}
+	for (int t : changed) {
+		Poly& poly = polygons[slots[t]];
+		for (int j = 0; j < 3; j++) {
+			poly.sa[j] = ids[tris[t][j]];
+		}
+		poly.updatePointsToArray();
+		poly.updatePointers(rpoints);
+		poly.fillcolor = colorstats.triangle(pts[tris[t][0]], pts[tris[t][1]], pts[tris[t][2]]).mean();
+		journal.setPoly(slots[t], poly.sa[0], poly.sa[1], poly.sa[2], poly.fillcolor);
+	}
+	if (gouraud) {
+		// Fit the colors over the nearby polygons, but only take them for
+		// the corners of the repaired ones
+		Document doc;
+		doc.size = img.getSize();
+		doc.points.resize(pts.size());
+		for (unsigned i = 0; i < pts.size(); i++) {
+			doc.points[i].vector = pts[i];
+			doc.points[i].size = rpoints[ids[i]].size;
+			doc.points[i].color = rpoints[ids[i]].color;
+		}
+		doc.polygons.resize(tris.size());
+		for (unsigned i = 0; i < tris.size(); i++) {
+			for (int j = 0; j < 3; j++) {
+				doc.polygons[i].sa[j] = tris[i][j];
+			}
+		}
+		sampleVertexColors(doc, colorstats);
+		std::vector<bool> touched(pts.size(), false);
+		for (int t : changed) {
+			for (int j = 0; j < 3; j++) {
+				touched[tris[t][j]] = true;
+			}
+		}
+		for (unsigned i = 0; i < pts.size(); i++) {
+			if (touched[i] && rpoints[ids[i]].color != doc.points[i].color) {
+				rpoints[ids[i]].color = doc.points[i].color;
+				journal.setPointColor(ids[i], rpoints[ids[i]].color);
+			}
+		}
+	}
+}
+
+// On L
+// Writes the mesh simplified to simplifyoptions.triangles polygons as
+// <image>.<count>.vertices and .svg. The open document is not changed.
+void Engine::exportSimplified() {
+	sf::Clock clock;
+	if (colorstats.empty()) {
+		colorstats.build(img);
+	}
+	SimplifyStats stats;
+	Document doc = simplifyDocument(snapshot(), colorstats, simplifyoptions, &stats);
+	std::string base = vfile.substr(0, vfile.size() - std::string(".vertices").size()) + "." + std::to_string(simplifyoptions.triangles);
+	if (!writeFileAtomic(base + ".vertices", documentToJSON(doc)) || !writeFileAtomic(base + ".svg", documentToSVG(doc))) {
+		std::cout << "Could not write " << base << ".vertices/.svg\n";
+		return;
+	}
+	std::cout << "Wrote " << base << ".vertices/.svg: " << polygons.size() << " -> " << doc.polygons.size() << " polygons ("
+		<< stats.collapses << " collapses) in " << clock.getElapsedTime().asMilliseconds() << " ms\n";
+}
+
+// On K
+// Clusters the polygon colors (weighted by area) into paletteoptions.colors
+// swatches, or snaps them to the fixed palette typed into the status panel,
+// and recolors every polygon with its closest swatch.
+void Engine::quantizeColors() {
+	sf::Clock clock;
+	if (polygons.empty()) {
+		std::cout << "No polygons to quantize\n";
+		return;
+	}
+	std::vector<sf::Color> fixed;
+	if (fixedpalette[0] != 0 && !parsePalette(fixedpalette, fixed)) {
+		std::cout << "Could not read the fixed palette, expected #rrggbb colors\n";
+		return;
+	}
+	Document doc = snapshot();
+	PaletteStats stats;
+	std::vector<int> changed = quantizeDocument(doc, paletteoptions, fixed.empty() ? NULL : &fixed, &stats);
+	for (int t : changed) {
+		polygons[t].fillcolor = doc.polygons[t].fillcolor;
+		journal.setColor(t, polygons[t].fillcolor);
+	}
+	palette = doc.palette;
+	journal.setPalette(palette);
+	std::cout << "Quantized to " << palette.size() << " colors (" << stats.iterations << " rounds), " << stats.changed
+		<< " polygons changed, RMS error " << stats.error << " in " << clock.getElapsedTime().asMilliseconds() << " ms\n";
+}
+
+// On V, and after T, R and F while Gouraud shading is on
+// Sets every point's color to the mean image color of the polygons around it.
+void Engine::shadeVertices() {
+	if (colorstats.empty()) {
+		colorstats.build(img);
+	}
+	Document doc = snapshot();
+	for (int i : sampleVertexColors(doc, colorstats)) {
+		rpoints[i].color = doc.points[i].color;
+		journal.setPointColor(i, rpoints[i].color);
+	}
+}
+
 // On left click
 void Engine::onLeftClick(sf::Vector2f point) {
+	ProfileScope scope(PHASE_LEFTCLICK);
 	for (Poly& polygon : polygons) {
 		polygon.selected = false;
 	}
@@ -597,6 +1781,7 @@ void Engine::onLeftClick(sf::Vector2f point) {
 		pdraginitpt = mpos;
 		pdragoffset.x = rpoints[nindex].vector.x - mpos.x;
 		pdragoffset.y = rpoints[nindex].vector.y - mpos.y;
+		pdragstart = rpoints[nindex].vector;
 		dragflag = true; // When dragflag is true then dragging occurs
 						 // Set mouse position to middle of desired selected point
 						 // This fixes mouse clicks moving points on accident
@@ -620,6 +1805,7 @@ void Engine::onLeftClick(sf::Vector2f point) {
 					sf::Color::Green));
 				int offset = polygons.size() - 1;
 				polygons[offset].fillcolor = avgClr(rpoints[polygons[offset].s1], rpoints[polygons[offset].s2], rpoints[polygons[offset].s3], 10);
+				journal.addPoly(polygons[offset].s1, polygons[offset].s2, polygons[offset].s3, polygons[offset].fillcolor);
 				clearSelection();
 			}
 		}
@@ -627,6 +1813,12 @@ void Engine::onLeftClick(sf::Vector2f point) {
 	// Create a new point
 	if (!ispointnear) {
 		rpoints.push_back(Point(point, 5));
+		journal.addPoint(point, rpoints.back().size, rpoints.back().color);
+		if (gouraud) {
+			sf::Vector2f pixel = getClampedImgPoint(point);
+			rpoints.back().color = img.getPixel(std::min((unsigned)pixel.x, img.getSize().x - 1), std::min((unsigned)pixel.y, img.getSize().y - 1));
+			journal.setPointColor(rpoints.size() - 1, rpoints.back().color);
+		}
 		spointsin.push_back(rpoints.size() - 1);
 		spoint = NULL;
 		spoints.push_back(&(rpoints[rpoints.size() - 1]));
@@ -640,6 +1832,7 @@ void Engine::onLeftClick(sf::Vector2f point) {
 				sf::Color::Green));
 			int offset = polygons.size() - 1;
 			polygons[offset].fillcolor = avgClr(rpoints[polygons[offset].s1], rpoints[polygons[offset].s2], rpoints[polygons[offset].s3], 10);
+			journal.addPoly(polygons[offset].s1, polygons[offset].s2, polygons[offset].s3, polygons[offset].fillcolor);
 			clearSelection();
 		}
 	}
@@ -722,35 +1915,17 @@ sf::Color Engine::chooseColor() {
 // Returns the average color from the area between 3 points.
 // Due to speed, it uses random samples.
 sf::Color Engine::avgClr(Point& p1, Point& p2, Point& p3, int samples){
-	int r = 0;
-	int g = 0;
-	int b = 0;
-	for (int i = 0; i < samples; i++){
-		sf::Vector2f pixel = randPt(p1, p2, p3);
-		sf::Color color = img.getPixel(pixel.x, pixel.y);
-		r += color.r;
-		g += color.g;
-		b += color.b;
-	}
-	r /= samples;
-	g /= samples;
-	b /= samples;
-	return sf::Color(r, g, b, 255);
+	return sampleTriangleColor(img, p1.vector, p2.vector, p3.vector, samples, rng);
 }
 
 // Return a random point inside 3 points.
 sf::Vector2f Engine::randPt(Point& p1, Point& p2, Point& p3){
-	sf::Vector2f point;
-	double r1 = randdbl(0, 1);
-	double r2 = randdbl(0, 1);
-	point.x = (1 - sqrt(r1)) * p1.vector.x + (sqrt(r1) * (1 - r2)) * p2.vector.x + (sqrt(r1) * r2) * p3.vector.x;
-	point.y = (1 - sqrt(r1)) * p1.vector.y + (sqrt(r1) * (1 - r2)) * p2.vector.y + (sqrt(r1) * r2) * p3.vector.y;
-	return point;
+	return randomTrianglePoint(p1.vector, p2.vector, p3.vector, rng);
 }
 
 // Convert window (view) coordinates to global (real) coordinates.
 sf::Vector2f Engine::windowToGlobalPos(const sf::Vector2f& vec) {
-	sf::Vector2u winSize = window->getSize();
+	sf::Vector2u winSize = input.winsize;
 	sf::Vector2f center = view.getCenter();
 	sf::Vector2f point = vec;
 	point.x -= winSize.x / 2;
@@ -764,7 +1939,7 @@ sf::Vector2f Engine::windowToGlobalPos(const sf::Vector2f& vec) {
 
 // Convert global (real) coordiantes to window (view) coordinates.
 sf::Vector2f Engine::globalToWindowPos(const sf::Vector2f& vec) {
-	sf::Vector2u winSize = window->getSize();
+	sf::Vector2u winSize = input.winsize;
 	sf::Vector2f center = view.getCenter();
 	sf::Vector2f point = vec;
 	point.x -= center.x;
@@ -776,9 +1951,9 @@ sf::Vector2f Engine::globalToWindowPos(const sf::Vector2f& vec) {
 	return point;
 };
 
-// Get the mouse position as a float.
+// Get the mouse position as a float, as polled at the start of the frame.
 sf::Vector2f Engine::getMPosFloat() {
-	sf::Vector2i mposi = sf::Mouse::getPosition(*window);
+	sf::Vector2i mposi = input.mouse;
 	sf::Vector2f mpos;
 	mpos.x = mposi.x;
 	mpos.y = mposi.y;
@@ -787,137 +1962,219 @@ sf::Vector2f Engine::getMPosFloat() {
 
 // Clamps a point to the image boundaries.
 sf::Vector2f Engine::getClampedImgPoint(const sf::Vector2f& vec){
-	sf::Vector2f result = vec;
-	if (result.x < 0 || result.x > img.getSize().x){
-		if (result.x < 0){
-			result.x = 0;
+	return clampToImage(vec, img.getSize());
+}
+
+
+/*////////////////////////////////////////////////////////////////////////////
+//// Saving functions
+*/////////////////////////////////////////////////////////////////////////////
+
+// Copies the points and polygons into a document, clamping points to the image.
+// This is the only part of a save that runs on the editor thread.
+Document Engine::snapshot(){
+	return snapshotMesh(rpoints, polygons, img.getSize(), palette, gouraud);
+}
+
+// Replaces the points and polygons with the contents of a document.
+void Engine::setDocument(const Document& doc){
+	buildMesh(doc, rpoints, polygons, viewzoom);
+	palette = doc.palette;
+	gouraud = doc.gouraud;
+	clearSelection();
+}
+
+// Appends pending edits to the journal so they are on disk right away,
+// then queues a checkpoint for the autosave thread to write.
+// Only one checkpoint is in flight at a time; the journal keeps the edits
+// made while it is being written.
+void Engine::saveAsync(){
+	ProfileScope scope(PHASE_SAVE);
+	journal.flush();
+	if (journal.isCheckpointing()){
+		return;
+	}
+	sf::Clock clock;
+	Document doc = snapshot();
+	snapshotTime = clock.getElapsedTime().asSeconds() * 1000.0f;
+	doc.sequence = journal.beginCheckpoint();
+	autosave.submit(doc);
+}
+
+// Runs once per frame: writes this frame's journal records and restarts
+// the journal once the in-flight checkpoint is on disk.
+void Engine::updateJournal(){
+	journal.flush();
+	if (journal.isCheckpointing()){
+		AutosaveStats stats = autosave.getStats();
+		if (stats.savedSequence >= journal.checkpointSequence()){
+			journal.endCheckpoint();
 		}
-		else if (result.x > img.getSize().x) {
-			result.x = img.getSize().x;
+		else if (!stats.busy){
+			journal.abortCheckpoint();
 		}
 	}
-	if (result.y < 0 || result.y > img.getSize().y){
-		if (result.y < 0){
-			result.y = 0;
+}
+
+// On E
+// Snapshots the document and rasterizes it to pfile on a background thread.
+void Engine::exportRaster(){
+	if (pngexport.valid()){
+		std::cout << "PNG export already running\n";
+		return;
+	}
+	std::cout << "Exporting PNG to " << pfile << " (E)\n";
+	Document doc = snapshot();
+	RasterOptions options = pngoptions;
+	std::string filename = pfile;
+	exportcancel = CancelToken();
+	CancelToken cancel = exportcancel;
+	pngexport = std::async(std::launch::async, [doc, options, filename, cancel](){
+		Tracer::nameThread("PNG export");
+		TraceScope scope("Export PNG", "operation");
+		sf::Clock clock;
+		bool ok = exportPNG(doc, filename, options, &cancel);
+		printf("PNG export %s in %.1f ms\n", ok ? "finished" : cancel.cancelled() ? "cancelled" : "FAILED", clock.getElapsedTime().asSeconds() * 1000.0f);
+		return ok;
+	});
+}
+
+// Runs once per frame: collects a finished PNG export.
+void Engine::updateExport(){
+	if (pngexport.valid() && pngexport.wait_for(std::chrono::seconds(0)) == std::future_status::ready){
+		pngexport.get();
+	}
+}
+
+// On A (selected polygons) and Shift+A (all of them)
+// Samples new fill colors on the thread pool while the editor keeps running;
+// updateRecolor applies them once every polygon is done.
+void Engine::recolorPolygons(bool all) {
+	if (recolor.valid()) {
+		std::cout << "Recolor already running\n";
+		return;
+	}
+	std::shared_ptr<RecolorJob> job = std::make_shared<RecolorJob>();
+	for (unsigned i = 0; i < polygons.size(); i++) {
+		if (!all && !polygons[i].selected) {
+			continue;
 		}
-		else if (result.y > img.getSize().y){
-			result.y = img.getSize().y;
+		job->polys.push_back(i);
+		for (int j = 0; j < 3; j++) {
+			job->corners.push_back(polygons[i].sa[j]);
+			job->positions.push_back(rpoints[polygons[i].sa[j]].vector);
 		}
 	}
-	return result;
+	if (job->polys.empty()) {
+		std::cout << "Can't change color - no polygon selected\n";
+		return;
+	}
+	// A fresh seed each time, so pressing A again gives a slightly different color
+	unsigned seed = rng();
+	const sf::Image* image = &img;
+	recolorjob = job;
+	recolorreport = 0;
+	recolorclock.restart();
+	recolor = std::async(std::launch::async, [job, image, seed](){
+		Tracer::nameThread("Recolor");
+		TraceScope scope("Recolor", "operation");
+		sampleTriangleColors(*image, job->positions, job->polys, seed, RECOLORSAMPLES, job->colors, &job->done, &job->cancel);
+	});
 }
 
+// Runs once per frame: reports the progress of a running recolor and
+// applies its colors once it is done.
+void Engine::updateRecolor(){
+	if (!recolor.valid()){
+		return;
+	}
+	RecolorJob& job = *recolorjob;
+	int total = (int)job.polys.size();
+	bool ready = recolor.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+	// A replay applies the colors on the frame the recording did
+	if (replaying){
+		ready = input.recolored;
+		if (ready){
+			recolor.wait();
+		}
+	}
+	if (!ready){
+		int percent = (int)(100LL * job.done / total);
+		if (recolorclock.getElapsedTime().asMilliseconds() >= 500 && percent >= recolorreport + 10){
+			std::cout << "Recoloring " << percent << "%\n";
+			recolorreport = percent;
+		}
+		return;
+	}
+	recolor.get();
+	int skipped = 0;
+	for (int k = 0; k < total; k++){
+		int t = job.polys[k];
+		bool same = t < (int)polygons.size();
+		for (int j = 0; j < 3 && same; j++){
+			int s = job.corners[k * 3 + j];
+			same = polygons[t].sa[j] == s && s < (int)rpoints.size() && rpoints[s].vector == job.positions[k * 3 + j];
+		}
+		if (!same){
+			skipped++;
+			continue;
+		}
+		if (polygons[t].fillcolor != job.colors[k]){
+			polygons[t].fillcolor = job.colors[k];
+			journal.setColor(t, polygons[t].fillcolor);
+		}
+	}
+	std::cout << "Recolored " << total - skipped << " polygons in " << recolorclock.getElapsedTime().asMilliseconds() << " ms";
+	if (skipped > 0){
+		std::cout << " (" << skipped << " changed meanwhile, left alone)";
+	}
+	std::cout << "\n";
+	recolorjob.reset();
+	input.recolored = true;
+}
 
-/*////////////////////////////////////////////////////////////////////////////
-//// Saving functions
-*/////////////////////////////////////////////////////////////////////////////
-
-// Saves the SVG of the image.
-void Engine::saveVector(std::string filename){
-	std::fstream sfilestrm;
-	sfilestrm.open(sfile, std::ios::out | std::fstream::trunc);
-	char headerc[350];
-	const char *hdr = "<?xml version=\"1.0\" standalone=\"no\"?>\n<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" \"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\"><svg width=\"%d\" height=\"%d\" viewBox=\"0 0 %d %d\" xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\">\n<style type=\"text/css\"> polygon { stroke-width: .5; stroke-linejoin: round; } </style>";
-	snprintf(headerc, sizeof(headerc), hdr,
-		image.getSize().x,
-		image.getSize().y,
-		image.getSize().x,
-		image.getSize().y);
-	std::string header = headerc;
-	std::string footer = "\n</svg>";
-	sfilestrm << header;
-	for (unsigned i = 0; i < polygons.size(); i++){
-		Poly& p = polygons[i];
-		std::string pointslist = "";
-		for (int j = 0; j < 3; j++){
-			pointslist += std::to_string(rpoints[p.sa[j]].vector.x);
-			pointslist += ",";
-			pointslist += std::to_string(rpoints[p.sa[j]].vector.y);
-			pointslist += " ";
-		}
-		std::string color = "rgb(";
-		color += std::to_string(p.fillcolor.r);
-		color += ",";
-		color += std::to_string(p.fillcolor.g);
-		color += ",";
-		color += std::to_string(p.fillcolor.b);
-		color += ")";
-		std::string polygon = "";
-		polygon += "<polygon style=\"fill:";
-		polygon += color;
-		polygon += ";stroke:";
-		polygon += color;
-		polygon += "\"";
-		polygon += " points=\"";
-		polygon += pointslist;
-		polygon += "\"/>\n";
-		sfilestrm << polygon;
-	}
-	sfilestrm << footer;
-}
-
-// Saves the JSON of the points, polygons, colors
-void Engine::saveJSON(){
-	// Clamp all points to bounds
-	for (Point& point : rpoints){
-		point.vector = getClampedImgPoint(point.vector);
-	}
-	Json::Value rootobj;
-	for (unsigned i = 0; i < rpoints.size(); i++){
-		rootobj["rpoints"][i]["vector"]["x"] = rpoints[i].vector.x;
-		rootobj["rpoints"][i]["vector"]["y"] = rpoints[i].vector.y;
-		rootobj["rpoints"][i]["size"] = rpoints[i].size;
-		rootobj["rpoints"][i]["color"] = rpoints[i].color.toInteger();
-	}
-	for (unsigned i = 0; i < polygons.size(); i++){
-		for (int j = 0; j < 3; j++){
-			rootobj["polygons"][i]["pointindices"][j] = polygons[i].sa[j];
-		}
-		rootobj["polygons"][i]["color"] = polygons[i].fillcolor.toInteger();
-	}
-	std::fstream vfilestrm;
-	vfilestrm.open(vfile, std::ios::out | std::ios::trunc);
-	vfilestrm << rootobj << std::endl;
-}
-
-// Loads the JSON into the engine variables.
-void Engine::loadJSON(){
-	rpoints.clear();
-	polygons.clear();
-	std::fstream vfilestrm;
-	vfilestrm.open(vfile, std::ios::in);
-	Json::Value rootobj;
-	if (vfilestrm.peek() == std::fstream::traits_type::eof()) {
+// Runs once per frame: while livemetrics is on, scores the edits made
+// since the last update every METRICSINTERVAL ms. Only the tiles under
+// changed polygons are rendered again, so this stays cheap between edits.
+void Engine::updateMetrics(){
+	if (!livemetrics || metricsclock.getElapsedTime().asMilliseconds() < METRICSINTERVAL){
 		return;
 	}
-	vfilestrm >> rootobj;
-	Json::Value jsonpolygons;
-	Json::Value jsonrpoints;
-	jsonpolygons = rootobj["polygons"];
-	jsonrpoints = rootobj["rpoints"];
-	for (unsigned i = 0; i < jsonrpoints.size(); i++){
-		Point p;
-		p.vector.x = rootobj["rpoints"][i]["vector"]["x"].asFloat();
-		p.vector.y = rootobj["rpoints"][i]["vector"]["y"].asFloat();
-		p.size = rootobj["rpoints"][i]["size"].asFloat();
-		int c = rootobj["rpoints"][i]["color"].asInt64();
-		p.color = sf::Color(c);
-		rpoints.push_back(p);
-	}
-	for (unsigned i = 0; i < jsonpolygons.size(); i++){
-		int ptl[3];
-		for (int j = 0; j < 3; j++){
-			ptl[j] = rootobj["polygons"][i]["pointindices"][j].asInt();
-		}
-		int c = rootobj["polygons"][i]["color"].asInt64();
-		sf::Color color = sf::Color(c);
-		Poly p = Poly(&rpoints[ptl[0]],
-					  &rpoints[ptl[1]],
-					  &rpoints[ptl[2]],ptl[0], ptl[1], ptl[2], color);
-		p.updatePointsToArray();
-		p.updateCenter();
-		p.updateCShape(viewzoom);
-		polygons.push_back(p);
-	}
-	std::cout << "total polygons loaded: " << polygons.size() << "\n";
+	metricsclock.restart();
+	if (metrics.empty()){
+		metrics.reset(img);
+	}
+	fidelity = metrics.update(snapshot());
+}
+
+// Runs once per frame: measures what the image, mesh and frame buffers
+// hold (the counted tags keep themselves up to date) and warns about
+// budgets that were exceeded.
+void Engine::updateMemory(){
+	int stage = imagestage;
+	sf::Vector2u size = img.getSize();
+	long long pixels = stage >= IMAGE_DECODED ? 4LL * size.x * size.y : 0;
+	Memory::set(MEM_IMAGE, pixels);
+	long long textures = stage == IMAGE_FULL ? pixels : 0;
+	if (stage >= IMAGE_PREVIEW) {
+		textures += 4LL * preview.getSize().x * preview.getSize().y;
+	}
+	Memory::set(MEM_TEXTURE, textures);
+	Memory::set(MEM_POINTS, rpoints.capacity() * sizeof(Point) + (spoints.capacity() + nspoints.capacity()) * sizeof(Point*)
+		+ spointsin.capacity() * sizeof(int));
+	Memory::set(MEM_POLYGONS, polygons.capacity() * sizeof(Poly));
+	Memory::set(MEM_SHAPES, rpoints.size() * pointshapebytes + polygons.size() * polyshapebytes);
+	Memory::set(MEM_FRAMES, renderer->frameBytes());
+	Memory::checkBudgets();
+}
+
+// Runs on a loader thread: reads the JSON into loaddoc and replays
+// whatever the journal recorded after that checkpoint.
+// Returns the number of edits replayed.
+int Engine::loadJSON(){
+	Tracer::nameThread("Mesh loader");
+	TraceScope scope("Read mesh", "load");
+	loadDocumentJSON(vfile, loaddoc);
+	loadrecords.clear();
+	return replayJournal(jfile, loaddoc, &loadrecords);
 }
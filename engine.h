@@ -2,35 +2,77 @@
 #include "stdafx.h"
 #include "poly.h"
 #include "point.h"
+#include "document.h"
+#include "autosave.h"
+#include "journal.h"
+#include "raster.h"
+#include "seeding.h"
+#include "colorstats.h"
+#include "refine.h"
+#include "simplify.h"
+#include "metrics.h"
+#include "palette.h"
+#include "shading.h"
+#include "sampler.h"
+#include "threadpool.h"
+#include "renderer.h"
+#include "profiler.h"
+#include "trace.h"
+#include "recording.h"
+#include "memory.h"
 #include <stdio.h>
 #include <iostream>
 #include <fstream>
+#include <future>
 class Engine {
 public:
-	Engine(int aaLevel);
+	Engine(int aaLevel, const std::string& _recordfile = "", const std::string& _replayfile = "");
 	~Engine();
 
 	// Member functions
 	// ------------------------
 
 	void run();
+	void pollInput();                   // mouse, window and camera state for this frame
+	bool nextEvent(sf::Event& event);   // from the window, or the recording while replaying
+	void startRecording();
+	void shutdown();                    // final save, stop the threads and exit
 	void handleEvents(sf::Event event); 
 	void update();			            
 	void draw();                        
 	int  load();         
+	bool loadImage();                   // decode and upload the image (loader thread)
+	void updateLoad();                  // take over what the loader threads have finished
 	
-	void handleCamera();                
 	void smoothnessToggle();            
 	void clearSelection();              
 	void deleteSelection();
+	void triangulate();                 // Delaunay mesh over the selected (or all) points
+	void generatePoints();              // seed points from the image detail
+	void refine();                      // split the worst matching triangles
+	void optimizeDiagonals();           // flip edges to fit the image better
+	void repairAround(int index);       // unfold the polygons around a moved point
+	void exportSimplified();            // write a lower density copy of the mesh
+	void quantizeColors();              // reduce the polygon colors to a palette
+	void shadeVertices();               // sample the point colors for Gouraud shading
+	void recolorPolygons(bool all);     // re-average the selected (or all) polygons in the background
+	void updateRecolor();
+	int  keepEdges(Triangulation& tri, const std::vector<int>& vertof); // constrain tri to the polygon edges
+	int  replacePolygons(const std::vector<int>& ids, const std::vector<std::array<int, 3> >& tris, const std::vector<sf::Color>* colors);
 	void onLeftClick(sf::Vector2f point);
 	void onRightClick(sf::Vector2f point);
 	void onMiddleClick(sf::Vector2f point);
 	sf::Color chooseColor();
 	
-	void saveJSON();
-	void loadJSON();
-	void saveVector(std::string filename); // save vector image
+	int  loadJSON();
+	void saveAsync();                      // flush the journal and queue a checkpoint
+	void updateJournal();
+	void exportRaster();                   // render the polygons to pfile
+	void updateExport();
+	void updateMetrics();                  // rescore the mesh against the image (livemetrics)
+	void updateMemory();                   // measure the image, mesh and frames, warn over budget
+	Document snapshot();
+	void setDocument(const Document& doc);
 
 	sf::Vector2f getMPosFloat();
 	sf::Vector2f windowToGlobalPos(const sf::Vector2f& vec);
@@ -40,6 +82,10 @@ public:
 	sf::Vector2f getClampedImgPoint(const sf::Vector2f& vec);
 
 	void createColorPickerGUI();
+	void createStatusGUI();
+	void createLoadingGUI();
+	void createProfilerGUI();
+	void createMemoryGUI();
 	void handleGUItoggleEvent(sf::Event);
 	// Members
 	// -------------------------
@@ -47,17 +93,56 @@ public:
 	// Main engine window.
 	sf::RenderWindow* window;
 
-	// Filenames: file is the image to load, vfile is the JSON, sfile is the SVG.
+	// Filenames: file is the image to load, vfile is the JSON, sfile is the SVG, jfile is the edit journal,
+	// pfile is the rasterized PNG export, tfile the trace recorded with F4.
 	std::string file;                   
 	std::string vfile;                  
 	std::string sfile;                  
+	std::string jfile;
+	std::string pfile;
+	std::string tfile;
          
-	// Image data: image is the raw texture, img is a image to get pixel data from, drawimg is the drawable
+	// Image data: image is the texture uploaded from img (drawn by the renderer), img is the decoded pixels used for color sampling
+	// decodeTime/uploadTime: Load timings in ms
 	sf::Texture image;                  
 	sf::Image   img;                      
-	sf::Sprite  drawimg;                 
+	float decodeTime = 0;
+	float uploadTime = 0;
 
-	// The view used for camera controls
+	// Background loading (load()): imageload decodes img and uploads the
+	// textures, advancing imagestage (IMAGE_* in engine.cpp) as it goes;
+	// img can be read once it is IMAGE_DECODED. meshload reads the mesh into
+	// loaddoc, and loadrecords the journal records replayed into it. Until
+	// loaded, nothing can be edited or saved.
+	std::future<bool> imageload;
+	std::future<int>  meshload;
+	std::atomic<int>  imagestage{ 0 };
+	sf::Texture preview;
+	Document    loaddoc;
+	std::string loadrecords;
+	bool        loaded = false;
+	sf::Clock   loadclock;
+
+	// Random source for color sampling (avgClr, randPt)
+	SampleRng rng;
+
+	// Draws the frames filled by draw() on its own thread
+	Renderer* renderer = NULL;
+
+	// Input recording (--record) and replay (--replay). input is what this
+	// frame polled, or the recorded frame being replayed; replayevent is the
+	// next of its events to handle. frameclock times the editor thread's
+	// work in each frame.
+	InputRecorder recorder;
+	InputReplay   replay;
+	std::string   recordfile;
+	bool          replaying = false;
+	InputFrame    input;
+	size_t        replayevent = 0;
+	sf::Clock     inputclock;
+	sf::Clock     frameclock;
+
+	// The view used for camera controls, copied from the renderer every frame
 	sf::View view;                       
 
 	// Vectors: 
@@ -102,10 +187,98 @@ public:
 	sf::Vector2f vdraginitpt;           
 	sf::Vector2f pdragoffset;           
 	sf::Vector2f pdraginitpt;           
+	sf::Vector2f pdragstart;
 	sf::Vector2f cmpos;                 
 	int nindex;             
 
 	// GUI flags
 	bool showColorPickerGUI = false;
+	bool showStatusGUI      = false;
+	bool showProfilerGUI    = false;
+	bool showMemoryGUI      = false;
+
+	// Background saving:
+	// autosave: Worker thread writing the .svg/.vertices snapshots
+	// journal: Edits since the last checkpoint, appended every frame
+	// snapshotTime: Time the editor thread spent copying the last snapshot, in ms
+	Autosave autosave;
+	Journal  journal;
+	float    snapshotTime = 0;
+
+	// Automatic point placement settings (G)
+	SeedOptions seedoptions;
+
+	// Triangulation settings (T, R): keep the edges of the current polygons
+	// whose color changes by at least keepcontrast across them
+	bool keepedges    = false;
+	int  keepcontrast = 0;
+
+	// Re-triangulate around the dragged point whenever its polygons fold over
+	bool keepvalid = false;
+
+	// Refinement settings (R) and the image prefix sums it scores triangles with
+	RefineOptions refineoptions;
+	ColorStats    colorstats;
+
+	// Target for the simplified copies written on L
+	SimplifyOptions simplifyoptions;
+
+	// PSNR/SSIM of the mesh against the image, kept up to date while
+	// livemetrics is on; metricsclock spaces the updates out
+	FidelityMetrics metrics;
+	FidelityStats   fidelity;
+	bool      livemetrics = false;
+	sf::Clock metricsclock;
+
+	// Gouraud shading (V): polygons are drawn with their point colors
+	// blended across them instead of their fill color
+	bool gouraud = false;
+
+	// Palette settings (K), the swatches the colors were last quantized to,
+	// and the status panel text for snapping to a fixed palette instead
+	PaletteOptions paletteoptions;
+	std::vector<sf::Color> palette;
+	char fixedpalette[256] = "";
+
+	// Recolor running in the background (A, Shift+A). It keeps the corners
+	// the polygons had when it started, so polygons edited in the meantime
+	// are left alone when the colors come in.
+	struct RecolorJob {
+		std::vector<int> polys;
+		std::vector<int> corners;              // 3 point indices per polygon
+		std::vector<sf::Vector2f> positions;   // And their positions
+		std::vector<sf::Color> colors;
+		std::atomic<int> done;                 // Polygons sampled so far
+		CancelToken cancel;
+		RecolorJob() : done(0) {}
+	};
+	std::shared_ptr<RecolorJob> recolorjob;
+	std::future<void> recolor;
+	sf::Clock recolorclock;
+	int recolorreport = 0; // Last progress printed, in percent
+
+	// PNG export settings and the export running in the background, if any
+	// (cancelled on exit)
+	RasterOptions     pngoptions;
+	std::future<bool> pngexport;
+	CancelToken       exportcancel;
+
+	// Thread pool counters at the last status panel refresh, and how busy
+	// the workers were over the second before it
+	PoolStats   poolstats;
+	std::string poolusage;
+	sf::Clock   poolclock;
+	// Frames the render thread drew and this thread built per second, over
+	// the same second
+	long long framesdrawn = 0;
+	long long framesbuilt = 0;
+	float drawrate  = 0;
+	float buildrate = 0;
+	// operator new calls at the end of the last frame, for the trace
+	long long frameallocations = 0;
+	// Heap bytes the SFML shape of one point and of one polygon hold on
+	// to, measured once at startup
+	long long pointshapebytes = 0;
+	long long polyshapebytes  = 0;
 };
 
@@ -0,0 +1,108 @@
+#include "stdafx.h"
+#include "flips.h"
+#include <deque>
+
+// A flip has to win by more than this (relative) to count, so rounding
+// noise cannot flip an edge back and forth
+#define FLIPEPSILON 1e-9
+
+static TriangleStats triangleStats(const Triangulation& tri, const ColorStats& stats, int a, int b, int c){
+	return stats.triangle(sf::Vector2f((float)tri.x[a], (float)tri.y[a]),
+		sf::Vector2f((float)tri.x[b], (float)tri.y[b]),
+		sf::Vector2f((float)tri.x[c], (float)tri.y[c]));
+}
+
+static bool isFinite(const Triangulation& tri, int t){
+	const Triangulation::Tri& tr = tri.tris[t];
+	return tr.alive && !tri.isSuper(tr.v[0]) && !tri.isSuper(tr.v[1]) && !tri.isSuper(tr.v[2]);
+}
+
+FlipStats optimizeFlips(Triangulation& tri, const ColorStats& stats, std::vector<int>* changed){
+	FlipStats result;
+	int count = (int)tri.tris.size();
+	std::vector<double> error(count, 0);
+	for (int t = 0; t < count; t++){
+		if (isFinite(tri, t)){
+			const Triangulation::Tri& tr = tri.tris[t];
+			error[t] = triangleStats(tri, stats, tr.v[0], tr.v[1], tr.v[2]).error();
+			result.before += error[t];
+		}
+	}
+
+	// Work queue of edges as t * 3 + i, each edge queued once from the side
+	// with the lower slot
+	std::deque<int> queue;
+	std::vector<bool> queued(count * 3, false);
+	auto push = [&](int t, int i){
+		int nb = tri.tris[t].n[i];
+		if (nb < 0){
+			return;
+		}
+		if (nb < t){
+			int j = tri.backIndex(t, i);
+			if (j < 0){
+				return;
+			}
+			t = nb;
+			i = j;
+		}
+		if (!queued[t * 3 + i]){
+			queued[t * 3 + i] = true;
+			queue.push_back(t * 3 + i);
+		}
+	};
+	for (int t = 0; t < count; t++){
+		if (isFinite(tri, t)){
+			for (int i = 0; i < 3; i++){
+				push(t, i);
+			}
+		}
+	}
+
+	while (!queue.empty()){
+		int t = queue.front() / 3;
+		int i = queue.front() % 3;
+		queue.pop_front();
+		queued[t * 3 + i] = false;
+		int nb = tri.tris[t].n[i];
+		int j = tri.backIndex(t, i);
+		if (nb < 0 || j < 0 || !isFinite(tri, t) || !isFinite(tri, nb)){
+			continue;
+		}
+		// t = (a, b, d), nb = (c, d, b); the other diagonal is a-c
+		const Triangulation::Tri& ta = tri.tris[t];
+		int a = ta.v[i];
+		int b = ta.v[(i + 1) % 3];
+		int d = ta.v[(i + 2) % 3];
+		int c = tri.tris[nb].v[j];
+		if (tri.orient(a, b, tri.x[c], tri.y[c]) <= 0 || tri.orient(c, d, tri.x[a], tri.y[a]) <= 0){
+			continue;
+		}
+		result.evaluated++;
+		double e1 = triangleStats(tri, stats, a, b, c).error();
+		double e2 = triangleStats(tri, stats, c, d, a).error();
+		double old = error[t] + error[nb];
+		if (e1 + e2 >= old - FLIPEPSILON * (old + 1)){
+			continue;
+		}
+		tri.flip(t, i);
+		// flip() leaves t = (a, b, c) and nb = (c, d, a)
+		error[t] = e1;
+		error[nb] = e2;
+		result.flips++;
+		if (changed != NULL){
+			changed->push_back(t);
+			changed->push_back(nb);
+		}
+		push(t, 0);
+		push(t, 2);
+		push(nb, 0);
+		push(nb, 2);
+	}
+	for (int t = 0; t < count; t++){
+		if (isFinite(tri, t)){
+			result.after += error[t];
+		}
+	}
+	return result;
+}
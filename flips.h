@@ -0,0 +1,20 @@
+#pragma once
+#include "stdafx.h"
+#include "colorstats.h"
+#include "delaunay.h"
+#include <vector>
+
+struct FlipStats {
+	int flips = 0;
+	int evaluated = 0;    // Quads whose other diagonal was scored
+	double before = 0;    // Total squared color error of the mesh
+	double after = 0;
+};
+
+// Flips the diagonal of convex quads (two triangles sharing an edge)
+// whenever the other diagonal fits the image with a lower total squared
+// color error, until no flip helps. Every triangle is scored once up front;
+// after a flip only the four outer edges of its quad are queued again, so
+// the work stays near the changes. Triangles with super vertices are left
+// alone. changed receives the slots of flipped triangles (may repeat).
+FlipStats optimizeFlips(Triangulation& tri, const ColorStats& stats, std::vector<int>* changed = NULL);
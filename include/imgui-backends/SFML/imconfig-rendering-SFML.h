@@ -1,5 +1,7 @@
 // You should somehow get this into your imconfig.h file.
 
+#define ImDrawIdx unsigned int
+
 #define IMGUI_OVERRIDE_DRAWVERT_STRUCT_LAYOUT struct ImDrawVert\
 {\
     ImVec2  pos;\
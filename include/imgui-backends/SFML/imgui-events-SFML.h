@@ -85,18 +85,26 @@ namespace ImGui
             ImImpl::ImImpl_timeElapsed.restart();
         }
 
-        static void UpdateImGui()
+        // Starts a frame from input polled by the caller, so it can be
+        // recorded and replayed
+        static void UpdateImGui(const sf::Vector2i& mouse, bool left, bool right, float deltatime)
         {
             ImGuiIO& io = ImGui::GetIO();
+            io.DeltaTime = deltatime;
+            io.MousePos = ImVec2((float)mouse.x, (float)mouse.y);
+            io.MouseDown[0] = ImImpl::ImImpl_mousePressed[0] || left;
+            io.MouseDown[1] = ImImpl::ImImpl_mousePressed[1] || right;
+            ImGui::NewFrame();
+        }
+
+        static inline void UpdateImGui()
+        {
             static double time = 0.0f;
             const double current_time = ImImpl::ImImpl_timeElapsed.getElapsedTime().asSeconds();
-            io.DeltaTime = (float)(current_time - time);
+            float deltatime = (float)(current_time - time);
             time = current_time;
-            sf::Vector2i mouse = sf::Mouse::getPosition(*ImImpl::ImImpl_window);
-            io.MousePos = ImVec2((float)mouse.x, (float)mouse.y);
-            io.MouseDown[0] = ImImpl::ImImpl_mousePressed[0] || sf::Mouse::isButtonPressed(sf::Mouse::Left);
-            io.MouseDown[1] = ImImpl::ImImpl_mousePressed[1] || sf::Mouse::isButtonPressed(sf::Mouse::Right);
-            ImGui::NewFrame();
+            UpdateImGui(sf::Mouse::getPosition(*ImImpl::ImImpl_window), sf::Mouse::isButtonPressed(sf::Mouse::Left),
+                sf::Mouse::isButtonPressed(sf::Mouse::Right), deltatime);
         }
     }
 }
@@ -1,11 +1,29 @@
 #ifndef IMGUI_SFML_RENDERING_BACKEND
 #define IMGUI_SFML_RENDERING_BACKEND
 #include <vector>
+#include <string>
+#include <cstddef>
 #include <SFML/OpenGL.hpp>
+#include <SFML/Window/Context.hpp>
 #include <SFML/Graphics/Texture.hpp>
 #include <SFML/Graphics/RenderTarget.hpp>
 #include <iostream>
 #include <memory>
+
+// Buffer objects are GL 1.5, newer than the gl.h some platforms ship
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+#ifndef GL_ARRAY_BUFFER
+#define GL_ARRAY_BUFFER 0x8892
+#endif
+#ifndef GL_ELEMENT_ARRAY_BUFFER
+#define GL_ELEMENT_ARRAY_BUFFER 0x8893
+#endif
+#ifndef GL_STREAM_DRAW
+#define GL_STREAM_DRAW 0x88E0
+#endif
+
 namespace ImGui
 {
     namespace ImImpl
@@ -13,43 +31,137 @@ namespace ImGui
         static sf::RenderTarget* ImImpl_rtarget;
         static sf::Texture* ImImpl_fontTex;
 
+        typedef void (APIENTRY *ImImpl_GenBuffersFn)(GLsizei n, GLuint* buffers);
+        typedef void (APIENTRY *ImImpl_DeleteBuffersFn)(GLsizei n, const GLuint* buffers);
+        typedef void (APIENTRY *ImImpl_BindBufferFn)(GLenum target, GLuint buffer);
+        typedef void (APIENTRY *ImImpl_BufferDataFn)(GLenum target, ptrdiff_t size, const void* data, GLenum usage);
+        typedef void (APIENTRY *ImImpl_BufferSubDataFn)(GLenum target, ptrdiff_t offset, ptrdiff_t size, const void* data);
+        static ImImpl_GenBuffersFn ImImpl_glGenBuffers;
+        static ImImpl_DeleteBuffersFn ImImpl_glDeleteBuffers;
+        static ImImpl_BindBufferFn ImImpl_glBindBuffer;
+        static ImImpl_BufferDataFn ImImpl_glBufferData;
+        static ImImpl_BufferSubDataFn ImImpl_glBufferSubData;
+
+        // Streaming vertex and index buffers, 0 until the first frame (or
+        // for good, without GL 1.5, which falls back to client-side arrays)
+        static bool ImImpl_glLoaded = false;
+        static GLuint ImImpl_vbo = 0;
+        static GLuint ImImpl_ibo = 0;
+        static size_t ImImpl_vboSize = 0;
+        static size_t ImImpl_iboSize = 0;
+
+        static sf::GlFunctionPointer ImImpl_GetGLFunction(const char* name)
+        {
+            sf::GlFunctionPointer f = sf::Context::getFunction(name);
+            if (!f)
+                f = sf::Context::getFunction((std::string(name) + "ARB").c_str());
+            return f;
+        }
+
+        // Needs the target's context to be current
+        static void ImImpl_CreateBuffers()
+        {
+            ImImpl_glLoaded = true;
+            ImImpl_glGenBuffers = (ImImpl_GenBuffersFn)ImImpl_GetGLFunction("glGenBuffers");
+            ImImpl_glDeleteBuffers = (ImImpl_DeleteBuffersFn)ImImpl_GetGLFunction("glDeleteBuffers");
+            ImImpl_glBindBuffer = (ImImpl_BindBufferFn)ImImpl_GetGLFunction("glBindBuffer");
+            ImImpl_glBufferData = (ImImpl_BufferDataFn)ImImpl_GetGLFunction("glBufferData");
+            ImImpl_glBufferSubData = (ImImpl_BufferSubDataFn)ImImpl_GetGLFunction("glBufferSubData");
+            if (!ImImpl_glGenBuffers || !ImImpl_glDeleteBuffers || !ImImpl_glBindBuffer || !ImImpl_glBufferData || !ImImpl_glBufferSubData)
+            {
+                std::cout << "No OpenGL buffer objects, drawing ImGui from client memory\n";
+                return;
+            }
+            ImImpl_glGenBuffers(1, &ImImpl_vbo);
+            ImImpl_glGenBuffers(1, &ImImpl_ibo);
+        }
+
+        // Orphans the buffer every frame (so the driver never waits for the
+        // previous frame's draws) and grows it by half when it is too small
+        static void ImImpl_StreamBuffer(GLenum target, size_t& capacity, size_t size)
+        {
+            if (size > capacity)
+                capacity = size + size / 2;
+            ImImpl_glBufferData(target, (ptrdiff_t)capacity, NULL, GL_STREAM_DRAW);
+        }
+
+        // Draws with whatever the target's own drawing left set up, which is
+        // what ImGui needs as well (alpha blending, texturing and the three
+        // client arrays on, culling and depth test off), and puts back only
+        // what it changes: the matrices, the texture binding, the array
+        // pointers (a client-side push) and the scissor test. That keeps
+        // SFML's state cache valid, so neither glPushAttrib nor a full
+        // resetGLStates() is needed; the one reset is on the first frame,
+        // in case the target has not drawn anything yet.
         static void ImImpl_RenderDrawLists(ImDrawData* draw_data)
         {
             if (draw_data->CmdListsCount == 0)
                 return;
 
-            ImImpl_rtarget->pushGLStates();
+            static bool states_set = false;
+            if (!states_set)
+            {
+                ImImpl_rtarget->resetGLStates();
+                states_set = true;
+            }
+            if (!ImImpl_glLoaded)
+                ImImpl_CreateBuffers();
+            bool buffered = ImImpl_vbo != 0;
 
             GLint last_texture;
             glGetIntegerv(GL_TEXTURE_BINDING_2D, &last_texture);
-            glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_TRANSFORM_BIT);
-            glEnable(GL_BLEND);
-            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-            glDisable(GL_CULL_FACE);
-            glDisable(GL_DEPTH_TEST);
+            glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
             glEnable(GL_SCISSOR_TEST);
-            glEnableClientState(GL_VERTEX_ARRAY);
-            glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-            glEnableClientState(GL_COLOR_ARRAY);
-            glEnable(GL_TEXTURE_2D);
 
+            glMatrixMode(GL_TEXTURE);
+            glPushMatrix();
+            glLoadIdentity();
             glMatrixMode(GL_PROJECTION);
             glPushMatrix();
             glLoadIdentity();
-            glOrtho(0.0f, ImGui::GetIO().DisplaySize.x, ImGui::GetIO().DisplaySize.y, 0.0f, -1.0f, +1.0f);
+            // Size of the target rather than io.DisplaySize, the lists may be drawn on another thread than the one running ImGui
+            sf::Vector2u target_size = ImImpl_rtarget->getSize();
+            glOrtho(0.0f, (float)target_size.x, (float)target_size.y, 0.0f, -1.0f, +1.0f);
             glMatrixMode(GL_MODELVIEW);
             glPushMatrix();
             glLoadIdentity();
 
-            sf::RenderStates states;
-            states.blendMode = sf::BlendMode(sf::BlendMode::SrcAlpha, sf::BlendMode::OneMinusSrcAlpha);
+            // All lists go into one vertex and one index buffer, each at its own offset
+            if (buffered)
+            {
+                ImImpl_glBindBuffer(GL_ARRAY_BUFFER, ImImpl_vbo);
+                ImImpl_glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ImImpl_ibo);
+                ImImpl_StreamBuffer(GL_ARRAY_BUFFER, ImImpl_vboSize, draw_data->TotalVtxCount * sizeof(ImDrawVert));
+                ImImpl_StreamBuffer(GL_ELEMENT_ARRAY_BUFFER, ImImpl_iboSize, draw_data->TotalIdxCount * sizeof(ImDrawIdx));
+            }
+            const GLenum idx_type = sizeof(ImDrawIdx) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+            size_t vtx_offset = 0;
+            size_t idx_offset = 0;
+            ImTextureID bound = NULL;
+            bool any_bound = false;
 
             #define OFFSETOF(TYPE, ELEMENT) ((size_t)&(((TYPE *)0)->ELEMENT))
             for (int n = 0; n < draw_data->CmdListsCount; n++)
             {
                 const ImDrawList* cmd_list = draw_data->CmdLists[n];
-                const unsigned char* vtx_buffer = (const unsigned char*)&cmd_list->VtxBuffer.front();
-                const ImDrawIdx* idx_buffer = &cmd_list->IdxBuffer.front();
+                size_t vtx_bytes = cmd_list->VtxBuffer.Size * sizeof(ImDrawVert);
+                size_t idx_bytes = cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx);
+                const unsigned char* vtx_buffer;
+                const unsigned char* idx_buffer;
+                if (buffered)
+                {
+                    ImImpl_glBufferSubData(GL_ARRAY_BUFFER, (ptrdiff_t)vtx_offset, (ptrdiff_t)vtx_bytes, cmd_list->VtxBuffer.Data);
+                    ImImpl_glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, (ptrdiff_t)idx_offset, (ptrdiff_t)idx_bytes, cmd_list->IdxBuffer.Data);
+                    vtx_buffer = (const unsigned char*)vtx_offset;
+                    idx_buffer = (const unsigned char*)idx_offset;
+                }
+                else
+                {
+                    vtx_buffer = (const unsigned char*)cmd_list->VtxBuffer.Data;
+                    idx_buffer = (const unsigned char*)cmd_list->IdxBuffer.Data;
+                }
+                vtx_offset += vtx_bytes;
+                idx_offset += idx_bytes;
                 glVertexPointer(2, GL_FLOAT, sizeof(ImDrawVert), (void*)(vtx_buffer + OFFSETOF(ImDrawVert, pos)));
                 glTexCoordPointer(2, GL_FLOAT, sizeof(ImDrawVert), (void*)(vtx_buffer + OFFSETOF(ImDrawVert, uv)));
                 glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(ImDrawVert), (void*)(vtx_buffer + OFFSETOF(ImDrawVert, col)));
@@ -63,30 +175,37 @@ namespace ImGui
                     }
                     else
                     {
-                        sf::Vector2u win_size = ImImpl_rtarget->getSize();
-                        sf::Texture::bind(ImImpl::ImImpl_fontTex);
-                        glScissor((int)pcmd->ClipRect.x, (int)(win_size.y - pcmd->ClipRect.w), (int)(pcmd->ClipRect.z - pcmd->ClipRect.x), (int)(pcmd->ClipRect.w - pcmd->ClipRect.y));
-                        glDrawElements(GL_TRIANGLES, (GLsizei)pcmd->ElemCount, GL_UNSIGNED_SHORT, idx_buffer);
+                        if (!any_bound || pcmd->TextureId != bound)
+                        {
+                            const sf::Texture* texture = (const sf::Texture*)pcmd->TextureId;
+                            glBindTexture(GL_TEXTURE_2D, texture ? texture->getNativeHandle() : 0);
+                            bound = pcmd->TextureId;
+                            any_bound = true;
+                        }
+                        glScissor((int)pcmd->ClipRect.x, (int)(target_size.y - pcmd->ClipRect.w), (int)(pcmd->ClipRect.z - pcmd->ClipRect.x), (int)(pcmd->ClipRect.w - pcmd->ClipRect.y));
+                        glDrawElements(GL_TRIANGLES, (GLsizei)pcmd->ElemCount, idx_type, idx_buffer);
                     }
-                    idx_buffer += pcmd->ElemCount;
+                    idx_buffer += pcmd->ElemCount * sizeof(ImDrawIdx);
                 }
             }
             #undef OFFSETOF
 
             // Restore modified state
-            glDisableClientState(GL_COLOR_ARRAY);
-            glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-            glDisableClientState(GL_VERTEX_ARRAY);
-            glBindTexture(GL_TEXTURE_2D, last_texture);
-            glMatrixMode(GL_MODELVIEW);
+            if (buffered)
+            {
+                ImImpl_glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+                ImImpl_glBindBuffer(GL_ARRAY_BUFFER, 0);
+            }
+            glPopClientAttrib();
+            if (any_bound)
+                glBindTexture(GL_TEXTURE_2D, last_texture);
+            glDisable(GL_SCISSOR_TEST);
+            glMatrixMode(GL_TEXTURE);
             glPopMatrix();
             glMatrixMode(GL_PROJECTION);
             glPopMatrix();
-            glPopAttrib();
-
-            ImImpl_rtarget->popGLStates();
-
-            ImImpl_rtarget->resetGLStates();
+            glMatrixMode(GL_MODELVIEW);
+            glPopMatrix();
         }
     }
     namespace SFML
@@ -103,20 +222,30 @@ namespace ImGui
             ImImpl::ImImpl_fontTex = new sf::Texture;
             ImImpl::ImImpl_fontTex->create(width, height);
             ImImpl::ImImpl_fontTex->update(pixels);
-            io.Fonts->TexID = (void*)&ImImpl::ImImpl_fontTex;
+            // Texture IDs are sf::Texture pointers
+            io.Fonts->TexID = (void*)ImImpl::ImImpl_fontTex;
             io.Fonts->ClearInputData();
             io.Fonts->ClearTexData();
         }
-        static void UpdateImGuiRendering()
+        static inline void UpdateImGuiRendering()
         {
                 ImGuiIO& io = ImGui::GetIO();
                 io.DisplaySize = ImVec2(float(ImImpl::ImImpl_rtarget->getSize().x), float(ImImpl::ImImpl_rtarget->getSize().y));
         }
+        // Needs the target's context to be current, to delete the buffers
         static void Shutdown()
         {
             ImGuiIO& io = ImGui::GetIO();
             io.Fonts->TexID = nullptr;
             delete ImImpl::ImImpl_fontTex;
+            if (ImImpl::ImImpl_vbo != 0)
+            {
+                ImImpl::ImImpl_glDeleteBuffers(1, &ImImpl::ImImpl_vbo);
+                ImImpl::ImImpl_glDeleteBuffers(1, &ImImpl::ImImpl_ibo);
+                ImImpl::ImImpl_vbo = ImImpl::ImImpl_ibo = 0;
+                ImImpl::ImImpl_vboSize = ImImpl::ImImpl_iboSize = 0;
+            }
+            ImImpl::ImImpl_glLoaded = false;
 
             ImImpl::ImImpl_rtarget = nullptr;
             ImGui::Shutdown();
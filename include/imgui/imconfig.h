@@ -51,6 +51,9 @@ namespace ImGui
 
 // BACKEND APPENDING
 
+// 32 bit indices, so a draw list can hold more than 65536 vertices (long lists)
+#define ImDrawIdx unsigned int
+
 #define IMGUI_OVERRIDE_DRAWVERT_STRUCT_LAYOUT struct ImDrawVert\
 {\
     ImVec2  pos;\
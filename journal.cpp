@@ -0,0 +1,336 @@
+#include "stdafx.h"
+#include "journal.h"
+#include <sstream>
+#include <cstdio>
+
+#define JOURNALHEADER "polyedit-journal"
+
+static std::string journalHeader(unsigned sequence){
+	return std::string(JOURNALHEADER) + " " + std::to_string(sequence) + "\n";
+}
+
+Journal::Journal(){
+}
+
+Journal::~Journal(){
+	close();
+}
+
+bool Journal::open(const std::string& _filename, unsigned _sequence, const std::string& records){
+	close();
+	filename = _filename;
+	sequence = _sequence;
+	checkpointing = 0;
+	pending.clear();
+	held.clear();
+	heldcount = 0;
+	headerwritten = false;
+	if (records.empty()){
+		// The file is only created once there is something to put in it
+		recordCount = 0;
+		return true;
+	}
+	// Drops whatever followed the last good record
+	if (!writeFileAtomic(filename, journalHeader(sequence) + records)){
+		return false;
+	}
+	headerwritten = true;
+	byteCount = records.size();
+	file.open(filename, std::ios::out | std::ios::app | std::ios::binary);
+	return (bool)file;
+}
+
+void Journal::close(){
+	flush();
+	if (file.is_open()){
+		file.close();
+	}
+}
+
+void Journal::append(const std::string& record){
+	pending += record;
+	recordCount++;
+	if (checkpointing){
+		held += record;
+		heldcount++;
+	}
+}
+
+void Journal::addPoint(const sf::Vector2f& v, float size, const sf::Color& color){
+	char buf[96];
+	snprintf(buf, sizeof(buf), "p %.9g %.9g %.9g %08x\n", v.x, v.y, size, (unsigned)color.toInteger());
+	append(buf);
+}
+
+void Journal::movePoint(int index, const sf::Vector2f& v){
+	char buf[80];
+	snprintf(buf, sizeof(buf), "m %d %.9g %.9g\n", index, v.x, v.y);
+	append(buf);
+}
+
+void Journal::addPoly(int a, int b, int c, const sf::Color& color){
+	char buf[80];
+	snprintf(buf, sizeof(buf), "t %d %d %d %08x\n", a, b, c, (unsigned)color.toInteger());
+	append(buf);
+}
+
+void Journal::setColor(int index, const sf::Color& color){
+	char buf[48];
+	snprintf(buf, sizeof(buf), "c %d %08x\n", index, (unsigned)color.toInteger());
+	append(buf);
+}
+
+void Journal::setPoly(int index, int a, int b, int c, const sf::Color& color){
+	char buf[96];
+	snprintf(buf, sizeof(buf), "r %d %d %d %d %08x\n", index, a, b, c, (unsigned)color.toInteger());
+	append(buf);
+}
+
+void Journal::erase(const std::vector<int>& polys, const std::vector<int>& points){
+	std::string record = "d " + std::to_string(polys.size());
+	for (int i : polys){
+		record += " " + std::to_string(i);
+	}
+	record += " " + std::to_string(points.size());
+	for (int i : points){
+		record += " " + std::to_string(i);
+	}
+	append(record + "\n");
+}
+
+void Journal::sendToBack(int index){
+	append("b " + std::to_string(index) + "\n");
+}
+
+void Journal::sendToFront(int index){
+	append("f " + std::to_string(index) + "\n");
+}
+
+void Journal::setPalette(const std::vector<sf::Color>& palette){
+	std::string record = "k " + std::to_string(palette.size());
+	for (const sf::Color& color : palette){
+		char buf[16];
+		snprintf(buf, sizeof(buf), " %08x", (unsigned)color.toInteger());
+		record += buf;
+	}
+	append(record + "\n");
+}
+
+void Journal::setPointColor(int index, const sf::Color& color){
+	char buf[48];
+	snprintf(buf, sizeof(buf), "v %d %08x\n", index, (unsigned)color.toInteger());
+	append(buf);
+}
+
+void Journal::setShading(bool gouraud){
+	append(gouraud ? "g 1\n" : "g 0\n");
+}
+
+void Journal::flush(){
+	if (pending.empty()){
+		return;
+	}
+	if (!file.is_open()){
+		// Replaces any journal left over from an older checkpoint
+		if (!headerwritten && !writeFileAtomic(filename, journalHeader(sequence))){
+			return;
+		}
+		headerwritten = true;
+		file.open(filename, std::ios::out | std::ios::app | std::ios::binary);
+		if (!file){
+			return;
+		}
+	}
+	file.write(pending.data(), pending.size());
+	file.flush();
+	byteCount += pending.size();
+	pending.clear();
+}
+
+unsigned Journal::beginCheckpoint(){
+	flush();
+	checkpointing = sequence + 1;
+	held.clear();
+	heldcount = 0;
+	return checkpointing;
+}
+
+// The snapshot is on disk: rewrite the journal so it only holds what was
+// recorded after the snapshot was taken.
+void Journal::endCheckpoint(){
+	if (!checkpointing){
+		return;
+	}
+	flush();
+	file.close();
+	sequence = checkpointing;
+	checkpointing = 0;
+	std::string contents = journalHeader(sequence) + held;
+	headerwritten = writeFileAtomic(filename, contents);
+	recordCount = heldcount;
+	byteCount = held.size();
+	held.clear();
+	heldcount = 0;
+	if (headerwritten){
+		file.open(filename, std::ios::out | std::ios::app | std::ios::binary);
+	}
+}
+
+// The snapshot never made it to disk, keep appending to the old journal.
+void Journal::abortCheckpoint(){
+	checkpointing = 0;
+	held.clear();
+	heldcount = 0;
+}
+
+static bool validPoly(const Document& doc, int i){
+	return i >= 0 && i < (int)doc.polygons.size();
+}
+
+static bool validPoint(const Document& doc, int i){
+	return i >= 0 && i < (int)doc.points.size();
+}
+
+int replayJournal(const std::string& filename, Document& doc, std::string* applied){
+	std::ifstream in(filename, std::ios::in | std::ios::binary);
+	if (!in){
+		return 0;
+	}
+	std::string line;
+	std::getline(in, line);
+	std::istringstream header(line);
+	std::string magic;
+	unsigned journalseq = 0;
+	if (!(header >> magic >> journalseq) || magic != JOURNALHEADER || journalseq != doc.sequence){
+		return 0;
+	}
+	int count = 0;
+	while (std::getline(in, line)){
+		// A last line without a newline was cut off mid-write
+		if (in.eof()){
+			break;
+		}
+		std::istringstream rec(line);
+		char op = 0;
+		rec >> op;
+		bool ok = false;
+		if (op == 'p'){
+			DocPoint p;
+			unsigned c;
+			ok = (bool)(rec >> p.vector.x >> p.vector.y >> p.size >> std::hex >> c);
+			if (ok){
+				p.color = sf::Color(c);
+				doc.points.push_back(p);
+			}
+		}
+		else if (op == 'm'){
+			int i;
+			sf::Vector2f v;
+			ok = (rec >> i >> v.x >> v.y) && validPoint(doc, i);
+			if (ok){
+				doc.points[i].vector = v;
+			}
+		}
+		else if (op == 't'){
+			DocPoly p;
+			unsigned c;
+			ok = (rec >> p.sa[0] >> p.sa[1] >> p.sa[2] >> std::hex >> c) &&
+				validPoint(doc, p.sa[0]) && validPoint(doc, p.sa[1]) && validPoint(doc, p.sa[2]);
+			if (ok){
+				p.fillcolor = sf::Color(c);
+				doc.polygons.push_back(p);
+			}
+		}
+		else if (op == 'c'){
+			int i;
+			unsigned c;
+			ok = (rec >> i >> std::hex >> c) && validPoly(doc, i);
+			if (ok){
+				doc.polygons[i].fillcolor = sf::Color(c);
+			}
+		}
+		else if (op == 'r'){
+			int i;
+			int sa[3];
+			unsigned c;
+			ok = (rec >> i >> sa[0] >> sa[1] >> sa[2] >> std::hex >> c) && validPoly(doc, i) &&
+				validPoint(doc, sa[0]) && validPoint(doc, sa[1]) && validPoint(doc, sa[2]);
+			if (ok){
+				for (int k = 0; k < 3; k++){
+					doc.polygons[i].sa[k] = sa[k];
+				}
+				doc.polygons[i].fillcolor = sf::Color(c);
+			}
+		}
+		else if (op == 'd'){
+			std::vector<int> polys;
+			std::vector<int> points;
+			unsigned n = 0;
+			ok = (bool)(rec >> n);
+			for (unsigned k = 0; ok && k < n; k++){
+				int i;
+				ok = (rec >> i) && validPoly(doc, i);
+				polys.push_back(i);
+			}
+			ok = ok && (rec >> n);
+			for (unsigned k = 0; ok && k < n; k++){
+				int i;
+				ok = (rec >> i) && validPoint(doc, i);
+				points.push_back(i);
+			}
+			if (ok){
+				eraseFromDocument(doc, polys, points);
+			}
+		}
+		else if (op == 'b' || op == 'f'){
+			int i;
+			ok = (rec >> i) && validPoly(doc, i);
+			if (ok){
+				DocPoly p = doc.polygons[i];
+				doc.polygons.erase(doc.polygons.begin() + i);
+				if (op == 'b'){
+					doc.polygons.insert(doc.polygons.begin(), p);
+				}
+				else {
+					doc.polygons.push_back(p);
+				}
+			}
+		}
+		else if (op == 'k'){
+			std::vector<sf::Color> palette;
+			unsigned n = 0;
+			ok = (bool)(rec >> n);
+			for (unsigned k = 0; ok && k < n; k++){
+				unsigned c;
+				ok = (bool)(rec >> std::hex >> c);
+				palette.push_back(sf::Color(c));
+			}
+			if (ok){
+				doc.palette = palette;
+			}
+		}
+		else if (op == 'v'){
+			int i;
+			unsigned c;
+			ok = (rec >> i >> std::hex >> c) && validPoint(doc, i);
+			if (ok){
+				doc.points[i].color = sf::Color(c);
+			}
+		}
+		else if (op == 'g'){
+			int gouraud;
+			ok = (bool)(rec >> gouraud);
+			if (ok){
+				doc.gouraud = gouraud != 0;
+			}
+		}
+		if (!ok){
+			break;
+		}
+		if (applied != NULL){
+			*applied += line + "\n";
+		}
+		count++;
+	}
+	return count;
+}
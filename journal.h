@@ -0,0 +1,82 @@
+#pragma once
+#include "stdafx.h"
+#include "document.h"
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Append-only log of edits made since the last full checkpoint (.vertices).
+// Each edit is one short text line; a save only has to append the lines
+// written since the previous save. The first line holds the checkpoint
+// number the records apply to, so a stale journal is never replayed.
+//
+// Records:
+//   p x y size color   add point
+//   m i x y            move point i
+//   t a b c color      add polygon with point indices a b c
+//   c i color          set color of polygon i
+//   r i a b c color    replace points and color of polygon i
+//   d n i.. k j..      delete n polygons and k points (like deleteSelection)
+//   b i / f i          send polygon i to the back / front of the draw order
+//   k n color..        replace the palette with n swatches
+//   v i color          set color of point i
+//   g 0|1              flat / Gouraud shading
+class Journal {
+public:
+	Journal();
+	~Journal();
+
+	// Starts journaling on top of checkpoint _sequence. records are the ones
+	// just replayed from the file (see replayJournal); if there are any, the
+	// file is rewritten to hold only them, so new records never follow a
+	// cut-off or malformed one.
+	bool open(const std::string& _filename, unsigned _sequence, const std::string& records = std::string());
+	void close();
+
+	void addPoint(const sf::Vector2f& v, float size, const sf::Color& color);
+	void movePoint(int index, const sf::Vector2f& v);
+	void addPoly(int a, int b, int c, const sf::Color& color);
+	void setColor(int index, const sf::Color& color);
+	void setPoly(int index, int a, int b, int c, const sf::Color& color);
+	void erase(const std::vector<int>& polys, const std::vector<int>& points);
+	void sendToBack(int index);
+	void sendToFront(int index);
+	void setPalette(const std::vector<sf::Color>& palette);
+	void setPointColor(int index, const sf::Color& color);
+	void setShading(bool gouraud);
+
+	// Appends buffered records to the file. Cost is proportional to the
+	// number of edits since the last flush.
+	void flush();
+
+	// Compaction: beginCheckpoint returns the sequence number to stamp on
+	// the snapshot. Once that snapshot is on disk, endCheckpoint restarts
+	// the journal on top of it with only the records made in the meantime.
+	unsigned beginCheckpoint();
+	void endCheckpoint();
+	void abortCheckpoint();
+	bool isCheckpointing() { return checkpointing != 0; }
+	unsigned checkpointSequence() { return checkpointing; }
+
+	// Records on top of the checkpoint on disk.
+	int recordCount = 0;
+	size_t byteCount = 0;
+
+private:
+	void append(const std::string& record);
+
+	std::string filename;
+	std::ofstream file;
+	unsigned sequence = 0;
+	unsigned checkpointing = 0;
+	bool headerwritten = false;
+	std::string pending; // Not yet written to the file
+	std::string held;    // Made after the in-flight checkpoint's snapshot
+	int heldcount = 0;
+};
+
+// Applies the records in filename to doc if the journal belongs to
+// doc.sequence. Returns the number of records applied; a truncated or
+// malformed record ends the replay. The applied records are appended to
+// applied, if given.
+int replayJournal(const std::string& filename, Document& doc, std::string* applied = NULL);
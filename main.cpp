@@ -1,22 +1,78 @@
 #include "stdafx.h"
 #include "engine.h"
+#include "memory.h"
+#include "batch.h"
+#include "bench.h"
+#include "threadpool.h"
+#include "trace.h"
+#include <cstdlib>
 #include <sstream>
+#include <cstring>
 
 int main(int argc, char* argv[]){
-	int aalevel;
-	// No arguments -> no AA
-	if (argc == 1) {
-		aalevel = 0;
+	if (argc > 1 && (strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0)) {
+		printUsage(argv[0]);
+		return 0;
 	}
-	// Argument -> AA
-	else if (argc > 1) {
-		std::istringstream stream(argv[1]);
+	// Headless benchmarks on synthetic meshes
+	if (isBenchCommand(argc, argv)) {
+		BenchOptions options;
+		if (!parseBenchArgs(argc, argv, options)) {
+			printUsage(argv[0]);
+			return 1;
+		}
+		return runBench(options);
+	}
+	// Headless batch mode, no window or dialogs
+	if (isBatchCommand(argc, argv)) {
+		BatchOptions options;
+		if (!parseBatchArgs(argc, argv, options)) {
+			printUsage(argv[0]);
+			return 1;
+		}
+		return runBatch(options);
+	}
+	int aalevel = 0;
+	std::string record;
+	std::string replay;
+	for (int i = 1; i < argc; i++) {
+		// Size of the thread pool for sampling, export and analysis
+		if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			ThreadPool::setThreads(atoi(argv[++i]));
+			continue;
+		}
+		// Record a trace from startup (F4 stops it)
+		if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+			if (!Tracer::start(argv[++i])) {
+				printf("Could not write %s\n", argv[i]);
+			}
+			continue;
+		}
+		// Record the input once the image is loaded, or replay a recording
+		if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+			record = argv[++i];
+			continue;
+		}
+		if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+			replay = argv[++i];
+			continue;
+		}
+		// Memory budgets to warn about (F5 shows them)
+		if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+			if (!Memory::parseBudgets(argv[++i])) {
+				printUsage(argv[0]);
+				return 1;
+			}
+			continue;
+		}
+		// Argument -> AA
+		std::istringstream stream(argv[i]);
 		if (!(stream >> aalevel)) {
 			aalevel = 0;
 		}
 	}
 	printf("Running at AA level %d\n", aalevel);
-	Engine engine = Engine(aalevel);
+	Engine engine(aalevel, record, replay);
 	engine.run();
 	return 0;
 }
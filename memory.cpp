@@ -0,0 +1,219 @@
+#include "stdafx.h"
+#include "memory.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <sstream>
+#ifdef __APPLE__
+#include <malloc/malloc.h>
+#else
+#include <malloc.h>
+#endif
+
+// In front of every ImGui allocation: its size, keeping 16 byte alignment
+#define IMGUIHEADER 16
+
+static const char* tagnames[MEM_COUNT] = {
+	"heap", "image", "texture", "points", "polygons", "shapes", "frames", "json", "imgui",
+};
+
+static std::atomic<long long> live[MEM_COUNT];
+static std::atomic<long long> peak[MEM_COUNT];
+static std::atomic<long long> budgets[MEM_COUNT];
+static std::atomic<bool> warned[MEM_COUNT];
+
+static std::atomic<long long> allocated(0);
+static std::atomic<long long> freed(0);
+
+// Tag of the innermost MemoryScope on this thread (-1 for none), what it
+// has counted so far, and the thread's own total
+static thread_local int scopetag = -1;
+static thread_local long long scopebytes = 0;
+static thread_local long long threadbytes = 0;
+
+// What malloc really set aside for p, so frees match allocations without
+// storing sizes
+static size_t usableSize(void* p){
+#if defined(_WIN32)
+	return _msize(p);
+#elif defined(__APPLE__)
+	return malloc_size(p);
+#else
+	return malloc_usable_size(p);
+#endif
+}
+
+static void raisePeak(int tag, long long value){
+	long long old = peak[tag].load(std::memory_order_relaxed);
+	while (value > old && !peak[tag].compare_exchange_weak(old, value, std::memory_order_relaxed)){
+	}
+}
+
+static void count(long long bytes){
+	raisePeak(MEM_HEAP, live[MEM_HEAP].fetch_add(bytes, std::memory_order_relaxed) + bytes);
+	threadbytes += bytes;
+	if (scopetag >= 0){
+		Memory::add(scopetag, bytes);
+		scopebytes += bytes;
+	}
+}
+
+void* operator new(std::size_t size){
+	void* p = std::malloc(size > 0 ? size : 1);
+	if (p == NULL){
+		throw std::bad_alloc();
+	}
+	allocated.fetch_add(1, std::memory_order_relaxed);
+	count((long long)usableSize(p));
+	return p;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) throw(){
+	void* p = std::malloc(size > 0 ? size : 1);
+	if (p != NULL){
+		allocated.fetch_add(1, std::memory_order_relaxed);
+		count((long long)usableSize(p));
+	}
+	return p;
+}
+
+void operator delete(void* p) throw(){
+	if (p != NULL){
+		freed.fetch_add(1, std::memory_order_relaxed);
+		count(-(long long)usableSize(p));
+		std::free(p);
+	}
+}
+
+void operator delete(void* p, const std::nothrow_t&) throw(){
+	operator delete(p);
+}
+
+const char* Memory::tagName(int tag){
+	return tagnames[tag];
+}
+
+void Memory::set(int tag, long long bytes){
+	live[tag].store(bytes, std::memory_order_relaxed);
+	raisePeak(tag, bytes);
+}
+
+void Memory::add(int tag, long long bytes){
+	raisePeak(tag, live[tag].fetch_add(bytes, std::memory_order_relaxed) + bytes);
+}
+
+std::vector<MemoryStats> Memory::stats(){
+	std::vector<MemoryStats> out(MEM_COUNT);
+	for (int t = 0; t < MEM_COUNT; t++){
+		out[t].name = tagnames[t];
+		out[t].live = live[t].load(std::memory_order_relaxed);
+		out[t].peak = peak[t].load(std::memory_order_relaxed);
+		out[t].budget = budgets[t].load(std::memory_order_relaxed);
+	}
+	return out;
+}
+
+void Memory::resetPeaks(){
+	for (int t = 0; t < MEM_COUNT; t++){
+		peak[t].store(live[t].load(std::memory_order_relaxed), std::memory_order_relaxed);
+		warned[t] = false;
+	}
+}
+
+void Memory::setBudget(int tag, long long bytes){
+	budgets[tag] = bytes;
+	warned[tag] = false;
+}
+
+bool Memory::parseBudgets(const std::string& list){
+	std::istringstream entries(list);
+	std::string entry;
+	while (std::getline(entries, entry, ',')){
+		size_t equals = entry.find('=');
+		std::string name = entry.substr(0, equals);
+		int tag = 0;
+		while (tag < MEM_COUNT && name != tagnames[tag]){
+			tag++;
+		}
+		double mb = equals == std::string::npos ? -1 : atof(entry.c_str() + equals + 1);
+		if (tag == MEM_COUNT || mb < 0){
+			printf("--budget takes name=MB entries (heap, image, texture, points, polygons, shapes, frames, json, imgui), got %s\n", entry.c_str());
+			return false;
+		}
+		setBudget(tag, (long long)(mb * 1024 * 1024));
+	}
+	return true;
+}
+
+int Memory::checkBudgets(){
+	int over = 0;
+	for (int t = 0; t < MEM_COUNT; t++){
+		long long budget = budgets[t].load(std::memory_order_relaxed);
+		long long most = peak[t].load(std::memory_order_relaxed);
+		if (budget > 0 && most > budget && !warned[t].exchange(true)){
+			printf("Warning: %s memory peaked at %.1f MB, over its budget of %.1f MB\n", tagnames[t], most / 1048576.0, budget / 1048576.0);
+			over++;
+		}
+	}
+	return over;
+}
+
+void Memory::print(){
+	printf("%-9s %10s %10s %10s\n", "memory", "live MB", "peak MB", "budget MB");
+	for (const MemoryStats& s : stats()){
+		if (s.peak == 0 && s.budget == 0){
+			continue;
+		}
+		printf("%-9s %10.1f %10.1f", s.name, s.live / 1048576.0, s.peak / 1048576.0);
+		if (s.budget > 0){
+			printf(" %10.1f%s", s.budget / 1048576.0, s.peak > s.budget ? "  over" : "");
+		}
+		printf("\n");
+	}
+}
+
+long long Memory::allocations(){
+	return allocated.load(std::memory_order_relaxed);
+}
+
+long long Memory::frees(){
+	return freed.load(std::memory_order_relaxed);
+}
+
+long long Memory::threadBytes(){
+	return threadbytes;
+}
+
+void* Memory::imguiAlloc(size_t size){
+	char* p = (char*)std::malloc(size + IMGUIHEADER);
+	if (p == NULL){
+		return NULL;
+	}
+	memcpy(p, &size, sizeof(size));
+	add(MEM_IMGUI, (long long)size);
+	return p + IMGUIHEADER;
+}
+
+void Memory::imguiFree(void* ptr){
+	if (ptr == NULL){
+		return;
+	}
+	char* p = (char*)ptr - IMGUIHEADER;
+	size_t size;
+	memcpy(&size, p, sizeof(size));
+	add(MEM_IMGUI, -(long long)size);
+	std::free(p);
+}
+
+MemoryScope::MemoryScope(int _tag) : tag(_tag), outertag(scopetag), outerbytes(scopebytes){
+	scopetag = tag;
+	scopebytes = 0;
+}
+
+MemoryScope::~MemoryScope(){
+	Memory::add(tag, -scopebytes);
+	// What this scope counted shows up in the outer one's total as well
+	scopetag = outertag;
+	scopebytes = outerbytes + scopebytes;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// What memory is used for. Heap counts every operator new allocation; the
+// others are measured or counted separately and are mostly parts of it
+// (the textures are on the GPU instead).
+enum MemoryTag {
+	MEM_HEAP,
+	MEM_IMAGE,     // Decoded image pixels
+	MEM_TEXTURE,   // Image and preview textures
+	MEM_POINTS,    // rpoints and the selection
+	MEM_POLYGONS,
+	MEM_SHAPES,    // SFML shapes held by the points and polygons
+	MEM_FRAMES,    // Frames handed to the render thread
+	MEM_JSON,      // Documents being converted to or from JSON
+	MEM_IMGUI,     // Everything ImGui allocates, including the copied draw lists
+	MEM_COUNT
+};
+
+struct MemoryStats {
+	const char* name;
+	long long live   = 0;  // Bytes
+	long long peak   = 0;
+	long long budget = 0;  // 0 for none
+};
+
+// Live and peak bytes per tag, with soft budgets that print a warning the
+// first time a tag's peak goes over them. Everything here is safe to call
+// from any thread.
+class Memory {
+public:
+	static const char* tagName(int tag);
+
+	// Replaces the live bytes of a tag that is measured rather than counted.
+	static void set(int tag, long long bytes);
+	// Adds to (or with a negative count, takes from) a counted tag.
+	static void add(int tag, long long bytes);
+	static std::vector<MemoryStats> stats();
+	// Starts every peak over from the live bytes.
+	static void resetPeaks();
+
+	static void setBudget(int tag, long long bytes);
+	// Reads budgets in MB like "heap=4096,json=512". Returns false (after
+	// printing why) on a bad entry.
+	static bool parseBudgets(const std::string& list);
+	// Warns about every tag whose peak went over its budget since it was
+	// last warned about, returns how many there were.
+	static int checkBudgets();
+	// Prints the tags that were used, in MB.
+	static void print();
+
+	// operator new calls since the program started, and how many of them
+	// were deleted.
+	static long long allocations();
+	static long long frees();
+	// Bytes the calling thread allocated minus what it freed.
+	static long long threadBytes();
+
+	// For ImGui's io.MemAllocFn and io.MemFreeFn, counted under MEM_IMGUI.
+	static void* imguiAlloc(size_t size);
+	static void imguiFree(void* p);
+};
+
+// Counts what the calling thread allocates and frees while it lives under
+// tag as well as under the heap, for work whose memory can't be measured
+// from outside (a JSON tree). Whatever is still allocated when it ends
+// stops counting under the tag, so the tag's live bytes are the work in
+// progress and its peak the most any of it needed.
+class MemoryScope {
+public:
+	explicit MemoryScope(int _tag);
+	~MemoryScope();
+
+private:
+	int tag;
+	int outertag;
+	long long outerbytes;
+};
@@ -0,0 +1,58 @@
+#include "stdafx.h"
+#include "mesh.h"
+#include <algorithm>
+
+sf::Vector2f clampToImage(const sf::Vector2f& vec, const sf::Vector2u& size){
+	return sf::Vector2f(std::min(std::max(vec.x, 0.0f), (float)size.x), std::min(std::max(vec.y, 0.0f), (float)size.y));
+}
+
+Document snapshotMesh(const std::vector<Point>& points, const std::vector<Poly>& polygons, const sf::Vector2u& size,
+	const std::vector<sf::Color>& palette, bool gouraud){
+	Document doc;
+	doc.size = size;
+	doc.points.resize(points.size());
+	for (unsigned i = 0; i < points.size(); i++){
+		doc.points[i].vector = clampToImage(points[i].vector, size);
+		doc.points[i].size = points[i].size;
+		doc.points[i].color = points[i].color;
+	}
+	doc.polygons.resize(polygons.size());
+	for (unsigned i = 0; i < polygons.size(); i++){
+		for (int j = 0; j < 3; j++){
+			doc.polygons[i].sa[j] = polygons[i].sa[j];
+		}
+		doc.polygons[i].fillcolor = polygons[i].fillcolor;
+	}
+	doc.palette = palette;
+	doc.gouraud = gouraud;
+	return doc;
+}
+
+void buildMesh(const Document& doc, std::vector<Point>& points, std::vector<Poly>& polygons, float zoom){
+	points.clear();
+	polygons.clear();
+	points.reserve(doc.points.size());
+	for (const DocPoint& dp : doc.points){
+		points.push_back(Point(dp.vector, dp.color, dp.size));
+	}
+	polygons.reserve(doc.polygons.size());
+	for (const DocPoly& dp : doc.polygons){
+		Poly p = Poly(&points[dp.sa[0]],
+					  &points[dp.sa[1]],
+					  &points[dp.sa[2]], dp.sa[0], dp.sa[1], dp.sa[2], dp.fillcolor);
+		p.updatePointsToArray();
+		p.updateCenter();
+		p.updateCShape(zoom);
+		polygons.push_back(p);
+	}
+}
+
+void updateMesh(std::vector<Point>& points, std::vector<Poly>& polygons, const sf::Vector2u& size){
+	// safeguard bandaid fix for spoly FIX ME
+	for (Poly& polygon : polygons){
+		polygon.updateCenter();
+	}
+	for (Point& point : points){
+		point.vector = clampToImage(point.vector, size);
+	}
+}
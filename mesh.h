@@ -0,0 +1,23 @@
+#pragma once
+#include "stdafx.h"
+#include "document.h"
+#include "point.h"
+#include "poly.h"
+#include <vector>
+
+// Conversions between the editor's points and polygons and a Document,
+// and the work Engine::update does on them every frame. Engine and the
+// benchmarks both call these, so the benchmarks time the editor's code.
+
+// Clamps vec to the image of the given size.
+sf::Vector2f clampToImage(const sf::Vector2f& vec, const sf::Vector2u& size);
+
+// Copies the points and polygons into a document, clamping points to the image.
+Document snapshotMesh(const std::vector<Point>& points, const std::vector<Poly>& polygons, const sf::Vector2u& size,
+	const std::vector<sf::Color>& palette, bool gouraud);
+
+// Replaces points and polygons with those of doc, with shapes for zoom.
+void buildMesh(const Document& doc, std::vector<Point>& points, std::vector<Poly>& polygons, float zoom);
+
+// Recomputes the polygon centers and pulls the points back into the image.
+void updateMesh(std::vector<Point>& points, std::vector<Poly>& polygons, const sf::Vector2u& size);
@@ -0,0 +1,209 @@
+#include "stdafx.h"
+#include "metrics.h"
+#include "parallel.h"
+#include "raster.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Edge of the tiles the sums are kept for, in pixels (a multiple of the
+// window step)
+#define METRICSTILE 64
+// SSIM window size and the step between windows
+#define SSIMWINDOW 8
+#define SSIMSTEP 4
+// SSIM stabilizers for 8 bit values, (0.01 * 255)^2 and (0.03 * 255)^2
+#define SSIMC1 6.5025
+#define SSIMC2 58.5225
+
+static float lumaOf(const sf::Uint8* p){
+	return 0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2];
+}
+
+// Whether two polygons cover the same pixels with the same colors
+static bool samePoly(const Document& a, const DocPoly& pa, const Document& b, const DocPoly& pb){
+	if (pa.fillcolor != pb.fillcolor){
+		return false;
+	}
+	for (int j = 0; j < 3; j++){
+		bool va = pa.sa[j] >= 0 && pa.sa[j] < (int)a.points.size();
+		bool vb = pb.sa[j] >= 0 && pb.sa[j] < (int)b.points.size();
+		if (va != vb || (va && a.points[pa.sa[j]].vector != b.points[pb.sa[j]].vector)){
+			return false;
+		}
+		if (a.gouraud && va && a.points[pa.sa[j]].color != b.points[pb.sa[j]].color){
+			return false;
+		}
+	}
+	return true;
+}
+
+void FidelityMetrics::reset(const sf::Image& img, int _threads){
+	image = &img;
+	threads = _threads;
+	w = (int)img.getSize().x;
+	h = (int)img.getSize().y;
+	tilesx = (w + METRICSTILE - 1) / METRICSTILE;
+	tilesy = (h + METRICSTILE - 1) / METRICSTILE;
+	scored = false;
+	last = Document();
+	pixels.assign(w * h * 4, 0);
+	luma.resize(w * h);
+	const sf::Uint8* src = img.getPixelsPtr();
+	for (int i = 0; i < w * h; i++){
+		luma[i] = lumaOf(src + i * 4);
+	}
+	squares.assign(tilesx * tilesy, 0);
+	ssims.assign(tilesx * tilesy, 0);
+	windows.assign(tilesx * tilesy, 0);
+	result = FidelityStats();
+}
+
+// Marks the tiles under poly, grown by margin pixels up and to the left
+void FidelityMetrics::dirty(const Document& doc, const DocPoly& poly, std::vector<bool>& tiles, int margin) const {
+	float minx = (float)w, miny = (float)h, maxx = 0, maxy = 0;
+	for (int j = 0; j < 3; j++){
+		if (poly.sa[j] < 0 || poly.sa[j] >= (int)doc.points.size()){
+			return;
+		}
+		const sf::Vector2f& v = doc.points[poly.sa[j]].vector;
+		minx = std::min(minx, v.x);
+		miny = std::min(miny, v.y);
+		maxx = std::max(maxx, v.x);
+		maxy = std::max(maxy, v.y);
+	}
+	int tx0 = std::max(0, ((int)std::floor(minx) - 1 - margin) / METRICSTILE);
+	int ty0 = std::max(0, ((int)std::floor(miny) - 1 - margin) / METRICSTILE);
+	int tx1 = std::min(tilesx - 1, ((int)std::ceil(maxx) + 1) / METRICSTILE);
+	int ty1 = std::min(tilesy - 1, ((int)std::ceil(maxy) + 1) / METRICSTILE);
+	for (int ty = ty0; ty <= ty1; ty++){
+		for (int tx = tx0; tx <= tx1; tx++){
+			tiles[ty * tilesx + tx] = true;
+		}
+	}
+}
+
+void FidelityMetrics::scoreTile(int tile){
+	int x0 = (tile % tilesx) * METRICSTILE;
+	int y0 = (tile / tilesx) * METRICSTILE;
+	int x1 = std::min(x0 + METRICSTILE, w);
+	int y1 = std::min(y0 + METRICSTILE, h);
+	const sf::Uint8* src = image->getPixelsPtr();
+	double sum = 0;
+	for (int y = y0; y < y1; y++){
+		const sf::Uint8* p = &pixels[(y * w + x0) * 4];
+		const sf::Uint8* q = src + (y * w + x0) * 4;
+		for (int x = x0; x < x1; x++, p += 4, q += 4){
+			int dr = p[0] - q[0];
+			int dg = p[1] - q[1];
+			int db = p[2] - q[2];
+			sum += dr * dr + dg * dg + db * db;
+		}
+	}
+	squares[tile] = sum;
+
+	// Windows whose top left corner lies in this tile; they reach into the
+	// tiles right and below, which is why edits dirty the scores of the
+	// tiles up and left of them too
+	double ssim = 0;
+	int count = 0;
+	const double n = SSIMWINDOW * SSIMWINDOW;
+	for (int wy = y0; wy < y1 && wy + SSIMWINDOW <= h; wy += SSIMSTEP){
+		for (int wx = x0; wx < x1 && wx + SSIMWINDOW <= w; wx += SSIMSTEP){
+			double sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+			for (int y = wy; y < wy + SSIMWINDOW; y++){
+				for (int x = wx; x < wx + SSIMWINDOW; x++){
+					double a = lumaOf(&pixels[(y * w + x) * 4]);
+					double b = luma[y * w + x];
+					sx += a;
+					sy += b;
+					sxx += a * a;
+					syy += b * b;
+					sxy += a * b;
+				}
+			}
+			double mx = sx / n;
+			double my = sy / n;
+			double vx = sxx / n - mx * mx;
+			double vy = syy / n - my * my;
+			double cov = sxy / n - mx * my;
+			ssim += ((2 * mx * my + SSIMC1) * (2 * cov + SSIMC2)) / ((mx * mx + my * my + SSIMC1) * (vx + vy + SSIMC2));
+			count++;
+		}
+	}
+	ssims[tile] = ssim;
+	windows[tile] = count;
+}
+
+FidelityStats FidelityMetrics::update(const Document& doc){
+	sf::Clock clock;
+	if (image == NULL || (int)doc.size.x != w || (int)doc.size.y != h){
+		return result;
+	}
+	if (doc.gouraud != last.gouraud){
+		scored = false;
+	}
+	int count = tilesx * tilesy;
+	std::vector<bool> render(count, !scored);
+	std::vector<bool> score(count, !scored);
+	if (scored){
+		size_t shared = std::min(last.polygons.size(), doc.polygons.size());
+		for (size_t i = 0; i < shared; i++){
+			if (!samePoly(last, last.polygons[i], doc, doc.polygons[i])){
+				dirty(last, last.polygons[i], render, 0);
+				dirty(doc, doc.polygons[i], render, 0);
+				dirty(last, last.polygons[i], score, SSIMWINDOW - 1);
+				dirty(doc, doc.polygons[i], score, SSIMWINDOW - 1);
+			}
+		}
+		for (size_t i = shared; i < last.polygons.size(); i++){
+			dirty(last, last.polygons[i], render, 0);
+			dirty(last, last.polygons[i], score, SSIMWINDOW - 1);
+		}
+		for (size_t i = shared; i < doc.polygons.size(); i++){
+			dirty(doc, doc.polygons[i], render, 0);
+			dirty(doc, doc.polygons[i], score, SSIMWINDOW - 1);
+		}
+	}
+	std::vector<int> rendertiles;
+	std::vector<int> scoretiles;
+	for (int tile = 0; tile < count; tile++){
+		if (render[tile]){
+			rendertiles.push_back(tile);
+		}
+		if (score[tile]){
+			scoretiles.push_back(tile);
+		}
+	}
+	if (!rendertiles.empty()){
+		// Same tiles as the metrics so each render fills exactly one of them
+		RasterOptions options;
+		options.supersample = 1;
+		options.tilesize = METRICSTILE;
+		options.threads = threads;
+		Rasterizer rasterizer(doc, options);
+		parallelFor((int)rendertiles.size(), [&](int i){
+			rasterizer.renderTile(rendertiles[i], &pixels[0], w);
+		}, threads);
+		parallelFor((int)scoretiles.size(), [&](int i){
+			scoreTile(scoretiles[i]);
+		}, threads);
+	}
+	last = doc;
+	scored = true;
+
+	double sum = 0;
+	double ssim = 0;
+	int total = 0;
+	for (int tile = 0; tile < count; tile++){
+		sum += squares[tile];
+		ssim += ssims[tile];
+		total += windows[tile];
+	}
+	result.mse = w * h > 0 ? sum / (3.0 * w * h) : 0;
+	result.psnr = result.mse > 0 ? 10 * std::log10(255.0 * 255.0 / result.mse) : std::numeric_limits<double>::infinity();
+	result.ssim = total > 0 ? ssim / total : 1;
+	result.tiles = (int)rendertiles.size();
+	result.time = clock.getElapsedTime().asSeconds() * 1000.0f;
+	return result;
+}
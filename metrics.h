@@ -0,0 +1,52 @@
+#pragma once
+#include "stdafx.h"
+#include "document.h"
+#include <vector>
+
+struct FidelityStats {
+	double mse  = 0;  // Mean squared error per RGB channel
+	double psnr = 0;  // In dB, infinite when the images match exactly
+	double ssim = 0;  // Mean SSIM of the luma, 1 for a perfect match
+	int tiles = 0;    // Tiles the last update rendered
+	float time = 0;   // Milliseconds the last update took
+};
+
+// How closely a mesh reproduces its source image: PSNR over the RGB
+// channels and SSIM over luma, using 8x8 windows every 4 pixels (the usual
+// fast variant of SSIM). The mesh is rendered with one sample at each pixel
+// center, the same pixels ColorStats averages over, and pixels no polygon
+// covers count as black.
+//
+// Error sums are kept per raster tile. update() compares the document with
+// the one it scored last and only renders and scores again the tiles under
+// polygons that moved, changed color, or were added or removed.
+class FidelityMetrics {
+public:
+	// Keeps a pointer to img, which must outlive the metrics, and forgets
+	// any earlier results.
+	void reset(const sf::Image& img, int threads = 0);
+	bool empty() const { return image == NULL; }
+
+	// Scores doc, which has to be the size of the image.
+	FidelityStats update(const Document& doc);
+	const FidelityStats& stats() const { return result; }
+
+private:
+	void scoreTile(int tile);
+	void dirty(const Document& doc, const DocPoly& poly, std::vector<bool>& tiles, int margin) const;
+
+	const sf::Image* image = NULL;
+	int threads = 0;
+	int w = 0;
+	int h = 0;
+	int tilesx = 0;
+	int tilesy = 0;
+	bool scored = false;
+	Document last;                  // What the tile sums below describe
+	std::vector<sf::Uint8> pixels;  // Rendering of last, RGBA like sf::Image
+	std::vector<float> luma;        // Of the image
+	std::vector<double> squares;    // Per tile: summed squared RGB error
+	std::vector<double> ssims;      // Per tile: summed SSIM of the windows starting in it
+	std::vector<int> windows;
+	FidelityStats result;
+};
@@ -0,0 +1,271 @@
+#include "stdafx.h"
+#include "palette.h"
+#include "parallel.h"
+#include "sampler.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <unordered_map>
+
+// Colors per parallel work item when assigning them to swatches
+#define PALETTECHUNK 4096
+
+struct Weighted {
+	double rgb[3];
+	double weight;
+};
+
+static double distance2(const double* a, const double* b){
+	double dr = a[0] - b[0];
+	double dg = a[1] - b[1];
+	double db = a[2] - b[2];
+	return dr * dr + dg * dg + db * db;
+}
+
+static int nearest(const double* rgb, const std::vector<double>& centers, int k){
+	int index = 0;
+	double d = distance2(rgb, &centers[0]);
+	for (int j = 1; j < k; j++){
+		double e = distance2(rgb, &centers[j * 3]);
+		if (e < d){
+			d = e;
+			index = j;
+		}
+	}
+	return index;
+}
+
+static sf::Color toColor(const double* rgb){
+	return sf::Color((sf::Uint8)std::min(255L, std::max(0L, std::lround(rgb[0]))),
+		(sf::Uint8)std::min(255L, std::max(0L, std::lround(rgb[1]))),
+		(sf::Uint8)std::min(255L, std::max(0L, std::lround(rgb[2]))));
+}
+
+std::vector<sf::Color> findPalette(const std::vector<sf::Color>& colors, const std::vector<double>& weights, const PaletteOptions& options, PaletteStats* stats){
+	// Merge identical colors, most meshes repeat a lot of them
+	std::unordered_map<sf::Uint32, int> merged;
+	std::vector<Weighted> items;
+	for (unsigned i = 0; i < colors.size(); i++){
+		if (!(weights[i] > 0)){
+			continue;
+		}
+		const sf::Color& c = colors[i];
+		sf::Uint32 key = (c.r << 16) | (c.g << 8) | c.b;
+		std::unordered_map<sf::Uint32, int>::iterator found = merged.find(key);
+		if (found != merged.end()){
+			items[found->second].weight += weights[i];
+			continue;
+		}
+		merged[key] = (int)items.size();
+		Weighted item = { { (double)c.r, (double)c.g, (double)c.b }, weights[i] };
+		items.push_back(item);
+	}
+	int n = (int)items.size();
+	int k = std::min(options.colors, n);
+	std::vector<sf::Color> palette;
+	if (k <= 0){
+		return palette;
+	}
+	if (k == n){
+		for (const Weighted& item : items){
+			palette.push_back(toColor(item.rgb));
+		}
+		return palette;
+	}
+
+	// k-means++: every further seed is picked with a chance proportional to
+	// weight times squared distance from the seeds so far
+	SampleRng rng(options.seed);
+	std::vector<double> centers;
+	std::vector<double> closest(n, 0);
+	double total = 0;
+	for (const Weighted& item : items){
+		total += item.weight;
+	}
+	for (int j = 0; j < k; j++){
+		double pick = std::uniform_real_distribution<double>(0, total)(rng);
+		int chosen = n - 1;
+		for (int i = 0; i < n; i++){
+			pick -= j == 0 ? items[i].weight : items[i].weight * closest[i];
+			if (pick <= 0){
+				chosen = i;
+				break;
+			}
+		}
+		centers.insert(centers.end(), items[chosen].rgb, items[chosen].rgb + 3);
+		total = 0;
+		for (int i = 0; i < n; i++){
+			double d = distance2(items[i].rgb, &centers[j * 3]);
+			closest[i] = j == 0 ? d : std::min(closest[i], d);
+			total += items[i].weight * closest[i];
+		}
+		if (total <= 0){
+			// Every color is already a seed
+			k = j + 1;
+			break;
+		}
+	}
+
+	// Lloyd rounds: assign in chunks, each with its own sums, then merge
+	std::vector<int> assign(n, -1);
+	int chunks = (n + PALETTECHUNK - 1) / PALETTECHUNK;
+	std::vector<std::vector<double> > sums(chunks);
+	std::vector<int> moved(chunks);
+	int iterations = 0;
+	for (int round = 0; round < options.iterations; round++){
+		parallelFor(chunks, [&](int c){
+			std::vector<double>& sum = sums[c];
+			sum.assign(k * 4, 0);
+			moved[c] = 0;
+			int end = std::min(n, (c + 1) * PALETTECHUNK);
+			for (int i = c * PALETTECHUNK; i < end; i++){
+				const Weighted& item = items[i];
+				int j = nearest(item.rgb, centers, k);
+				if (assign[i] != j){
+					assign[i] = j;
+					moved[c]++;
+				}
+				for (int ch = 0; ch < 3; ch++){
+					sum[j * 4 + ch] += item.rgb[ch] * item.weight;
+				}
+				sum[j * 4 + 3] += item.weight;
+			}
+		}, options.threads);
+		iterations++;
+		int changes = 0;
+		for (int c = 0; c < chunks; c++){
+			changes += moved[c];
+		}
+		if (changes == 0){
+			break;
+		}
+		for (int j = 0; j < k; j++){
+			double s[4] = { 0, 0, 0, 0 };
+			for (int c = 0; c < chunks; c++){
+				for (int ch = 0; ch < 4; ch++){
+					s[ch] += sums[c][j * 4 + ch];
+				}
+			}
+			if (s[3] > 0){
+				for (int ch = 0; ch < 3; ch++){
+					centers[j * 3 + ch] = s[ch] / s[3];
+				}
+				continue;
+			}
+			// Empty swatch: move it to the color worst served right now
+			int worst = 0;
+			double cost = -1;
+			for (int i = 0; i < n; i++){
+				double d = items[i].weight * distance2(items[i].rgb, &centers[assign[i] * 3]);
+				if (d > cost){
+					cost = d;
+					worst = i;
+				}
+			}
+			std::copy(items[worst].rgb, items[worst].rgb + 3, &centers[j * 3]);
+		}
+	}
+	for (int j = 0; j < k; j++){
+		palette.push_back(toColor(&centers[j * 3]));
+	}
+	if (stats != NULL){
+		stats->iterations = iterations;
+	}
+	return palette;
+}
+
+std::vector<int> nearestSwatches(const std::vector<sf::Color>& colors, const std::vector<sf::Color>& palette, int threads){
+	std::vector<int> out(colors.size(), 0);
+	if (palette.empty()){
+		return out;
+	}
+	std::vector<double> centers;
+	for (const sf::Color& c : palette){
+		centers.push_back(c.r);
+		centers.push_back(c.g);
+		centers.push_back(c.b);
+	}
+	int n = (int)colors.size();
+	int k = (int)palette.size();
+	parallelFor((n + PALETTECHUNK - 1) / PALETTECHUNK, [&](int c){
+		int end = std::min(n, (c + 1) * PALETTECHUNK);
+		for (int i = c * PALETTECHUNK; i < end; i++){
+			double rgb[3] = { (double)colors[i].r, (double)colors[i].g, (double)colors[i].b };
+			out[i] = nearest(rgb, centers, k);
+		}
+	}, threads);
+	return out;
+}
+
+std::vector<int> quantizeDocument(Document& doc, const PaletteOptions& options, const std::vector<sf::Color>* fixed, PaletteStats* stats){
+	std::vector<sf::Color> colors;
+	std::vector<double> weights;
+	int npoints = (int)doc.points.size();
+	for (const DocPoly& p : doc.polygons){
+		colors.push_back(p.fillcolor);
+		double area = 0;
+		if (p.sa[0] >= 0 && p.sa[1] >= 0 && p.sa[2] >= 0 && p.sa[0] < npoints && p.sa[1] < npoints && p.sa[2] < npoints){
+			const sf::Vector2f& a = doc.points[p.sa[0]].vector;
+			const sf::Vector2f& b = doc.points[p.sa[1]].vector;
+			const sf::Vector2f& c = doc.points[p.sa[2]].vector;
+			area = std::abs((b.x - a.x) * (double)(c.y - a.y) - (b.y - a.y) * (double)(c.x - a.x)) / 2;
+		}
+		weights.push_back(area);
+	}
+	PaletteStats result;
+	std::vector<sf::Color> palette = fixed != NULL ? *fixed : findPalette(colors, weights, options, &result);
+	std::vector<int> changed;
+	if (palette.empty()){
+		return changed;
+	}
+	std::vector<int> swatch = nearestSwatches(colors, palette, options.threads);
+	double error = 0;
+	double total = 0;
+	for (unsigned i = 0; i < doc.polygons.size(); i++){
+		sf::Color& c = doc.polygons[i].fillcolor;
+		const sf::Color& to = palette[swatch[i]];
+		double dr = c.r - to.r;
+		double dg = c.g - to.g;
+		double db = c.b - to.b;
+		error += weights[i] * (dr * dr + dg * dg + db * db);
+		total += weights[i];
+		if (c != to){
+			c = to;
+			changed.push_back(i);
+		}
+	}
+	doc.palette = palette;
+	result.changed = (int)changed.size();
+	result.error = total > 0 ? std::sqrt(error / (3 * total)) : 0;
+	if (stats != NULL){
+		*stats = result;
+	}
+	return changed;
+}
+
+bool parsePalette(const std::string& text, std::vector<sf::Color>& out){
+	out.clear();
+	size_t i = 0;
+	while (i < text.size()){
+		if (text[i] == ',' || text[i] == ';' || std::isspace((unsigned char)text[i])){
+			i++;
+			continue;
+		}
+		size_t end = i;
+		while (end < text.size() && text[end] != ',' && text[end] != ';' && !std::isspace((unsigned char)text[end])){
+			end++;
+		}
+		std::string token = text.substr(i, end - i);
+		i = end;
+		if (token[0] == '#'){
+			token = token.substr(1);
+		}
+		if (token.size() != 6 || token.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos){
+			return false;
+		}
+		unsigned long rgb = strtoul(token.c_str(), NULL, 16);
+		out.push_back(sf::Color((rgb >> 16) & 0xff, (rgb >> 8) & 0xff, rgb & 0xff));
+	}
+	return !out.empty();
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include "stdafx.h"
+#include "document.h"
+#include <string>
+#include <vector>
+
+struct PaletteOptions {
+	int colors = 16;       // Swatches to find
+	int iterations = 30;   // Most k-means rounds to run
+	unsigned seed = 1;     // For the k-means++ picks
+	int threads = 0;       // 0 uses every core
+};
+
+struct PaletteStats {
+	int iterations = 0;  // k-means rounds run
+	int changed = 0;     // Polygons whose color changed
+	double error = 0;    // RMS distance (per channel) from the old colors, weighted by area
+};
+
+// Clusters colors into at most options.colors swatches with k-means in RGB,
+// each color counting with its weight. Seeds are picked k-means++ style;
+// each round assigns the colors in parallel and stops early once no color
+// changes swatch. Identical colors are merged first, so meshes that already
+// use few colors cost next to nothing.
+std::vector<sf::Color> findPalette(const std::vector<sf::Color>& colors, const std::vector<double>& weights, const PaletteOptions& options, PaletteStats* stats = NULL);
+
+// Index of the closest swatch for every color.
+std::vector<int> nearestSwatches(const std::vector<sf::Color>& colors, const std::vector<sf::Color>& palette, int threads = 0);
+
+// Recolors every polygon of doc with its closest swatch and stores the
+// palette in doc. With fixed, polygons are snapped to that palette;
+// otherwise one is found from the polygon colors weighted by area. Returns
+// the indices of the polygons whose color changed.
+std::vector<int> quantizeDocument(Document& doc, const PaletteOptions& options, const std::vector<sf::Color>* fixed = NULL, PaletteStats* stats = NULL);
+
+// Reads swatches written as #rrggbb (or rrggbb), separated by commas,
+// spaces or new lines. Returns false on anything else.
+bool parsePalette(const std::string& text, std::vector<sf::Color>& out);
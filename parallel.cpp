@@ -0,0 +1,40 @@
+#include "stdafx.h"
+#include "parallel.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+int hardwareThreads(){
+	int n = (int)std::thread::hardware_concurrency();
+	return n > 0 ? n : 1;
+}
+
+void parallelFor(int count, const std::function<void(int)>& fn, int workers, const CancelToken* cancel){
+	if (count <= 0){
+		return;
+	}
+	int threads = ThreadPool::threads();
+	if (workers <= 0 || workers > threads){
+		workers = threads;
+	}
+	if (workers > count){
+		workers = count;
+	}
+	std::atomic<int> next(0);
+	auto work = [&](){
+		for (int i = next++; i < count && (cancel == NULL || !cancel->cancelled()); i = next++){
+			fn(i);
+		}
+	};
+	if (workers == 1){
+		work();
+		return;
+	}
+	TaskGroup group(ThreadPool::shared());
+	for (int t = 1; t < workers; t++){
+		group.run(work);
+	}
+	work();
+	group.wait();
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+
+class CancelToken;
+
+// Number of threads the hardware can run at once (at least 1).
+int hardwareThreads();
+
+// Runs fn(i) for every i in [0, count), spread over up to workers threads
+// (the calling thread is one of them) of the shared ThreadPool. workers <= 0
+// uses all of ThreadPool::threads(). Items are handed out one at a time, so
+// uneven items balance out. Once cancel is cancelled no further items start.
+void parallelFor(int count, const std::function<void(int)>& fn, int workers = 0, const CancelToken* cancel = NULL);
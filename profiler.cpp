@@ -0,0 +1,65 @@
+#include "stdafx.h"
+#include "profiler.h"
+#include <algorithm>
+
+// Timings kept per phase, about 1.5 seconds of frames at 144 fps
+#define PROFILEWINDOW 240
+
+static const char* phasenames[PHASE_COUNT] = {
+	"Frame", "Events", "GUI", "Update", "Draw", "Background", "ImGui",
+	"Render", "Display",
+	"Left click", "Delete", "Save", "Save SVG", "Triangulate", "Refine",
+};
+
+const char* Profiler::phaseName(int phase){
+	return phasenames[phase];
+}
+
+Profiler& Profiler::shared(){
+	static Profiler profiler;
+	return profiler;
+}
+
+Profiler::Profiler() : on(false), samples(PHASE_COUNT, std::vector<float>(PROFILEWINDOW)), next(PHASE_COUNT, 0){
+}
+
+// Turning it on starts from empty windows, so stale timings from an
+// earlier session don't show
+void Profiler::enable(bool _on){
+	std::lock_guard<std::mutex> lock(mutex);
+	if (_on && !on){
+		std::fill(next.begin(), next.end(), 0);
+	}
+	on = _on;
+}
+
+void Profiler::record(int phase, float ms){
+	std::lock_guard<std::mutex> lock(mutex);
+	samples[phase][next[phase] % PROFILEWINDOW] = ms;
+	next[phase]++;
+}
+
+std::vector<PhaseStats> Profiler::stats(){
+	std::vector<PhaseStats> out(PHASE_COUNT);
+	std::vector<float> sorted;
+	std::lock_guard<std::mutex> lock(mutex);
+	for (int p = 0; p < PHASE_COUNT; p++){
+		PhaseStats& s = out[p];
+		s.name = phasenames[p];
+		s.samples = std::min(next[p], PROFILEWINDOW);
+		if (s.samples == 0){
+			continue;
+		}
+		s.last = samples[p][(next[p] - 1) % PROFILEWINDOW];
+		sorted.assign(samples[p].begin(), samples[p].begin() + s.samples);
+		std::sort(sorted.begin(), sorted.end());
+		s.min = sorted.front();
+		double sum = 0;
+		for (float ms : sorted){
+			sum += ms;
+		}
+		s.avg = (float)(sum / s.samples);
+		s.p99 = sorted[std::min(s.samples - 1, (int)(s.samples * 0.99f))];
+	}
+	return out;
+}
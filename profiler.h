@@ -0,0 +1,89 @@
+#pragma once
+#include "trace.h"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+// Timed phases. The editor thread's frame is split into the first group,
+// the render thread's into the second; the rest are operations that only
+// run on some frames.
+enum ProfilePhase {
+	PHASE_TICK,       // Editor thread frame, without the pacing sleep
+	PHASE_EVENTS,
+	PHASE_GUI,        // Building the ImGui panels
+	PHASE_UPDATE,
+	PHASE_DRAW,       // Filling the frame data
+	PHASE_BACKGROUND, // Journal, exports, recolor, metrics, autosave
+	PHASE_IMGUI,      // ImGui::Render() and copying its draw lists
+	PHASE_RENDER,     // Render thread: drawing one frame
+	PHASE_DISPLAY,    // Render thread: display(), including the frame rate wait
+	PHASE_LEFTCLICK,
+	PHASE_DELETE,
+	PHASE_SAVE,       // Snapshot for the background save
+	PHASE_SAVEVECTOR, // Autosave thread: building and writing the SVG
+	PHASE_TRIANGULATE,
+	PHASE_REFINE,
+	PHASE_COUNT
+};
+
+struct PhaseStats {
+	const char* name;
+	int samples = 0;  // In the window below
+	float last = 0;   // Milliseconds
+	float min = 0;
+	float avg = 0;
+	float p99 = 0;
+};
+
+// Keeps the last PROFILEWINDOW timings of every phase. Recording is off
+// until enable(true); while it is off (and no trace is being recorded), a
+// ProfileScope costs two relaxed atomic loads.
+class Profiler {
+public:
+	static Profiler& shared();
+	static const char* phaseName(int phase);
+
+	void enable(bool on);
+	bool enabled() const { return on.load(std::memory_order_relaxed); }
+	void record(int phase, float ms);
+	std::vector<PhaseStats> stats();
+
+private:
+	Profiler();
+
+	std::atomic<bool> on;
+	std::mutex mutex;
+	std::vector<std::vector<float> > samples;  // Ring buffer per phase
+	std::vector<int> next;                     // Total recorded per phase
+};
+
+// Times its own lifetime into a phase, and records it as a trace event
+// while a trace is being recorded.
+class ProfileScope {
+public:
+	explicit ProfileScope(int _phase) : phase(Profiler::shared().enabled() || Tracer::recording() ? _phase : -1){
+		if (phase >= 0){
+			start = std::chrono::steady_clock::now();
+		}
+	}
+	~ProfileScope(){
+		stop();
+	}
+	// Records now instead of at the end of the scope.
+	void stop(){
+		if (phase >= 0){
+			std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+			if (Profiler::shared().enabled()){
+				std::chrono::duration<float, std::milli> ms = end - start;
+				Profiler::shared().record(phase, ms.count());
+			}
+			Tracer::complete(Profiler::phaseName(phase), phase < PHASE_LEFTCLICK ? "frame" : "operation", Tracer::micros(start), Tracer::micros(end));
+			phase = -1;
+		}
+	}
+
+private:
+	int phase;
+	std::chrono::steady_clock::time_point start;
+};
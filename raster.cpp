@@ -0,0 +1,213 @@
+#include "stdafx.h"
+#include "raster.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+
+Rasterizer::Rasterizer(const Document& _doc, const RasterOptions& _options) : doc(_doc), options(_options) {
+	if (options.supersample < 1){
+		options.supersample = 1;
+	}
+	if (options.tilesize < 8){
+		options.tilesize = 8;
+	}
+	size.x = std::max(1, (int)std::lround(doc.size.x * options.scale));
+	size.y = std::max(1, (int)std::lround(doc.size.y * options.scale));
+	tilesx = (size.x + options.tilesize - 1) / options.tilesize;
+	tilesy = (size.y + options.tilesize - 1) / options.tilesize;
+	bins.resize(tilesx * tilesy);
+
+	// Transform into sample space and bin by bounding box
+	double tofsample = options.scale * options.supersample;
+	double tilesamples = options.tilesize * options.supersample;
+	int npoints = (int)doc.points.size();
+	tris.reserve(doc.polygons.size());
+	for (const DocPoly& p : doc.polygons){
+		if (p.sa[0] < 0 || p.sa[1] < 0 || p.sa[2] < 0 ||
+			p.sa[0] >= npoints || p.sa[1] >= npoints || p.sa[2] >= npoints){
+			continue;
+		}
+		Tri tri;
+		sf::Color corner[3];
+		for (int i = 0; i < 3; i++){
+			tri.x[i] = doc.points[p.sa[i]].vector.x * tofsample;
+			tri.y[i] = doc.points[p.sa[i]].vector.y * tofsample;
+			corner[i] = doc.points[p.sa[i]].color;
+		}
+		double area = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) - (tri.y[1] - tri.y[0]) * (tri.x[2] - tri.x[0]);
+		if (area == 0){
+			continue;
+		}
+		if (area < 0){
+			std::swap(tri.x[1], tri.x[2]);
+			std::swap(tri.y[1], tri.y[2]);
+			std::swap(corner[1], corner[2]);
+			area = -area;
+		}
+		tri.color = p.fillcolor;
+		tri.color.a = 255;
+		tri.shaded = doc.gouraud;
+		if (tri.shaded){
+			double ex = tri.x[1] - tri.x[0], ey = tri.y[1] - tri.y[0];
+			double fx = tri.x[2] - tri.x[0], fy = tri.y[2] - tri.y[0];
+			for (int ch = 0; ch < 3; ch++){
+				double c0 = ch == 0 ? corner[0].r : ch == 1 ? corner[0].g : corner[0].b;
+				double du = (ch == 0 ? corner[1].r : ch == 1 ? corner[1].g : corner[1].b) - c0;
+				double dv = (ch == 0 ? corner[2].r : ch == 1 ? corner[2].g : corner[2].b) - c0;
+				tri.base[ch] = (float)c0;
+				tri.dx[ch] = (float)((du * fy - dv * ey) / area);
+				tri.dy[ch] = (float)((dv * ex - du * fx) / area);
+			}
+		}
+		double minx = std::min(tri.x[0], std::min(tri.x[1], tri.x[2]));
+		double maxx = std::max(tri.x[0], std::max(tri.x[1], tri.x[2]));
+		double miny = std::min(tri.y[0], std::min(tri.y[1], tri.y[2]));
+		double maxy = std::max(tri.y[0], std::max(tri.y[1], tri.y[2]));
+		int tx0 = std::max(0, (int)std::floor(minx / tilesamples));
+		int tx1 = std::min(tilesx - 1, (int)std::floor(maxx / tilesamples));
+		int ty0 = std::max(0, (int)std::floor(miny / tilesamples));
+		int ty1 = std::min(tilesy - 1, (int)std::floor(maxy / tilesamples));
+		if (tx0 > tx1 || ty0 > ty1){
+			continue;
+		}
+		int index = (int)tris.size();
+		tris.push_back(tri);
+		for (int ty = ty0; ty <= ty1; ty++){
+			for (int tx = tx0; tx <= tx1; tx++){
+				bins[ty * tilesx + tx].push_back(index);
+			}
+		}
+	}
+}
+
+sf::IntRect Rasterizer::tileRect(int tile){
+	int tx = tile % tilesx;
+	int ty = tile / tilesx;
+	sf::IntRect rect;
+	rect.left = tx * options.tilesize;
+	rect.top = ty * options.tilesize;
+	rect.width = std::min(options.tilesize, (int)size.x - rect.left);
+	rect.height = std::min(options.tilesize, (int)size.y - rect.top);
+	return rect;
+}
+
+void Rasterizer::renderTile(int tile, sf::Uint8* pixels, unsigned stride){
+	sf::IntRect rect = tileRect(tile);
+	int ss = options.supersample;
+	int sw = rect.width * ss;
+	int sh = rect.height * ss;
+	int sx0 = rect.left * ss;
+	int sy0 = rect.top * ss;
+	// Topmost triangle per sample, later triangles draw over earlier ones
+	std::vector<int> samples(sw * sh, -1);
+	for (int t : bins[tile]){
+		const Tri& tri = tris[t];
+		double minx = std::min(tri.x[0], std::min(tri.x[1], tri.x[2]));
+		double maxx = std::max(tri.x[0], std::max(tri.x[1], tri.x[2]));
+		double miny = std::min(tri.y[0], std::min(tri.y[1], tri.y[2]));
+		double maxy = std::max(tri.y[0], std::max(tri.y[1], tri.y[2]));
+		// Samples sit at pixel centers (+0.5) in sample space
+		int x0 = std::max(sx0, (int)std::ceil(minx - 0.5));
+		int x1 = std::min(sx0 + sw - 1, (int)std::floor(maxx - 0.5));
+		int y0 = std::max(sy0, (int)std::ceil(miny - 0.5));
+		int y1 = std::min(sy0 + sh - 1, (int)std::floor(maxy - 0.5));
+		if (x0 > x1 || y0 > y1){
+			continue;
+		}
+		// Edge i runs from vertex i to vertex i+1. A sample exactly on an edge
+		// belongs to the triangle that owns the edge (top-left rule), so two
+		// triangles sharing an edge never both claim or both skip it.
+		double dx[3], dy[3];
+		bool owned[3];
+		for (int i = 0; i < 3; i++){
+			int j = (i + 1) % 3;
+			dx[i] = tri.x[j] - tri.x[i];
+			dy[i] = tri.y[j] - tri.y[i];
+			owned[i] = dy[i] < 0 || (dy[i] == 0 && dx[i] > 0);
+		}
+		for (int y = y0; y <= y1; y++){
+			double py = y + 0.5;
+			double row[3];
+			for (int i = 0; i < 3; i++){
+				row[i] = dx[i] * (py - tri.y[i]);
+			}
+			int* line = &samples[(y - sy0) * sw];
+			for (int x = x0; x <= x1; x++){
+				double px = x + 0.5;
+				bool inside = true;
+				for (int i = 0; i < 3 && inside; i++){
+					double e = row[i] - dy[i] * (px - tri.x[i]);
+					inside = e > 0 || (e == 0 && owned[i]);
+				}
+				if (inside){
+					line[x - sx0] = t;
+				}
+			}
+		}
+	}
+	// Resolve samples to pixels
+	int total = ss * ss;
+	for (int py = 0; py < rect.height; py++){
+		sf::Uint8* out = pixels + ((rect.top + py) * stride + rect.left) * 4;
+		for (int px = 0; px < rect.width; px++){
+			int r = 0, g = 0, b = 0, covered = 0;
+			for (int sy = 0; sy < ss; sy++){
+				const int* line = &samples[(py * ss + sy) * sw + px * ss];
+				for (int sx = 0; sx < ss; sx++){
+					if (line[sx] < 0){
+						continue;
+					}
+					const Tri& tri = tris[line[sx]];
+					if (tri.shaded){
+						double x = sx0 + px * ss + sx + 0.5 - tri.x[0];
+						double y = sy0 + py * ss + sy + 0.5 - tri.y[0];
+						int c[3];
+						for (int ch = 0; ch < 3; ch++){
+							c[ch] = std::max(0, std::min(255, (int)std::lround(tri.base[ch] + tri.dx[ch] * x + tri.dy[ch] * y)));
+						}
+						r += c[0];
+						g += c[1];
+						b += c[2];
+					}
+					else {
+						r += tri.color.r;
+						g += tri.color.g;
+						b += tri.color.b;
+					}
+					covered++;
+				}
+			}
+			if (covered > 0){
+				out[0] = (sf::Uint8)((r + covered / 2) / covered);
+				out[1] = (sf::Uint8)((g + covered / 2) / covered);
+				out[2] = (sf::Uint8)((b + covered / 2) / covered);
+				out[3] = (sf::Uint8)((covered * 255 + total / 2) / total);
+			}
+			else {
+				out[0] = out[1] = out[2] = out[3] = 0;
+			}
+			out += 4;
+		}
+	}
+}
+
+bool Rasterizer::render(sf::Image& out, const CancelToken* cancel){
+	std::vector<sf::Uint8> pixels(size.x * size.y * 4);
+	parallelFor(tilesx * tilesy, [&](int tile){
+		renderTile(tile, &pixels[0], size.x);
+	}, options.threads, cancel);
+	if (cancel != NULL && cancel->cancelled()){
+		return false;
+	}
+	out.create(size.x, size.y, &pixels[0]);
+	return true;
+}
+
+bool exportPNG(const Document& doc, const std::string& filename, const RasterOptions& options, const CancelToken* cancel){
+	Rasterizer rasterizer(doc, options);
+	sf::Image out;
+	if (!rasterizer.render(out, cancel)){
+		return false;
+	}
+	return out.saveToFile(filename);
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include "stdafx.h"
+#include "document.h"
+#include "threadpool.h"
+#include <string>
+#include <vector>
+
+struct RasterOptions {
+	float scale = 1.0f;   // Output pixels per image pixel
+	int supersample = 4;  // Samples per pixel along each axis
+	int tilesize = 64;    // Tile edge in output pixels
+	int threads = 0;      // 0 uses every core
+};
+
+// CPU rasterizer for the low-poly result, no GPU or window needed.
+// Triangles are binned into tiles in draw order, and each tile is
+// rendered on its own with a top-left fill rule, so triangles that
+// share an edge never leave a seam or overlap. Pixels not covered by
+// any polygon stay transparent. Documents in Gouraud mode interpolate
+// the point colors across each triangle.
+class Rasterizer {
+public:
+	Rasterizer(const Document& _doc, const RasterOptions& _options);
+
+	// Renders every tile in parallel into out. Returns false, leaving out
+	// alone, if cancel was cancelled before every tile was done.
+	bool render(sf::Image& out, const CancelToken* cancel = NULL);
+	// Renders one tile into an RGBA buffer laid out like sf::Image
+	// (stride is the width of that buffer in pixels).
+	void renderTile(int tile, sf::Uint8* pixels, unsigned stride);
+	sf::IntRect tileRect(int tile);
+
+	sf::Vector2u size;
+	int tilesx;
+	int tilesy;
+
+private:
+	struct Tri {
+		double x[3], y[3]; // In sample space, counter clockwise
+		sf::Color color;
+		// Gouraud: channel value at vertex 0 and its change per sample in x and y
+		bool shaded;
+		float base[3], dx[3], dy[3];
+	};
+
+	const Document& doc;
+	RasterOptions options;
+	std::vector<Tri> tris;
+	std::vector<std::vector<int> > bins; // Triangle indices per tile, in draw order
+};
+
+// Renders doc and writes it as PNG. Returns false if the write fails or
+// cancel was cancelled first, in which case nothing is written.
+bool exportPNG(const Document& doc, const std::string& filename, const RasterOptions& options, const CancelToken* cancel = NULL);
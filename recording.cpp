@@ -0,0 +1,233 @@
+#include "stdafx.h"
+#include "recording.h"
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+
+#define RECORDINGHEADER "polyedit-input"
+#define RECORDINGVERSION 1
+// Slowest replayed frames listed in the report
+#define REPORTWORST 5
+
+// Floats are written with enough digits to read back exactly, so replayed
+// camera positions match the recorded ones bit for bit
+static std::string exact(float f){
+	char text[32];
+	snprintf(text, sizeof(text), "%.9g", f);
+	return text;
+}
+
+// Fields of the event types the editor and ImGui read; other events are
+// kept by type only.
+static std::string eventText(const sf::Event& event){
+	std::ostringstream out;
+	out << "e " << (int)event.type;
+	switch (event.type){
+	case sf::Event::KeyPressed:
+	case sf::Event::KeyReleased:
+		out << " " << (int)event.key.code << " " << event.key.alt << " " << event.key.control << " " << event.key.shift << " " << event.key.system;
+		break;
+	case sf::Event::TextEntered:
+		out << " " << event.text.unicode;
+		break;
+	case sf::Event::MouseMoved:
+		out << " " << event.mouseMove.x << " " << event.mouseMove.y;
+		break;
+	case sf::Event::MouseButtonPressed:
+	case sf::Event::MouseButtonReleased:
+		out << " " << (int)event.mouseButton.button << " " << event.mouseButton.x << " " << event.mouseButton.y;
+		break;
+	case sf::Event::MouseWheelMoved:
+		out << " " << event.mouseWheel.delta << " " << event.mouseWheel.x << " " << event.mouseWheel.y;
+		break;
+	case sf::Event::MouseWheelScrolled:
+		out << " " << (int)event.mouseWheelScroll.wheel << " " << exact(event.mouseWheelScroll.delta) << " " << event.mouseWheelScroll.x << " " << event.mouseWheelScroll.y;
+		break;
+	case sf::Event::Resized:
+		out << " " << event.size.width << " " << event.size.height;
+		break;
+	default:
+		break;
+	}
+	out << "\n";
+	return out.str();
+}
+
+static bool readEvent(std::istringstream& in, sf::Event& event){
+	int type;
+	if (!(in >> type) || type < 0 || type >= sf::Event::Count){
+		return false;
+	}
+	event = sf::Event();
+	event.type = (sf::Event::EventType)type;
+	int a, b;
+	switch (event.type){
+	case sf::Event::KeyPressed:
+	case sf::Event::KeyReleased:
+		if (!(in >> a >> event.key.alt >> event.key.control >> event.key.shift >> event.key.system)){
+			return false;
+		}
+		event.key.code = (sf::Keyboard::Key)a;
+		return true;
+	case sf::Event::TextEntered:
+		return (bool)(in >> event.text.unicode);
+	case sf::Event::MouseMoved:
+		return (bool)(in >> event.mouseMove.x >> event.mouseMove.y);
+	case sf::Event::MouseButtonPressed:
+	case sf::Event::MouseButtonReleased:
+		if (!(in >> a >> event.mouseButton.x >> event.mouseButton.y) || a < 0 || a >= sf::Mouse::ButtonCount){
+			return false;
+		}
+		event.mouseButton.button = (sf::Mouse::Button)a;
+		return true;
+	case sf::Event::MouseWheelMoved:
+		return (bool)(in >> event.mouseWheel.delta >> event.mouseWheel.x >> event.mouseWheel.y);
+	case sf::Event::MouseWheelScrolled:
+		if (!(in >> b >> event.mouseWheelScroll.delta >> event.mouseWheelScroll.x >> event.mouseWheelScroll.y)){
+			return false;
+		}
+		event.mouseWheelScroll.wheel = (sf::Mouse::Wheel)b;
+		return true;
+	case sf::Event::Resized:
+		return (bool)(in >> event.size.width >> event.size.height);
+	default:
+		return true;
+	}
+}
+
+bool InputRecorder::start(const std::string& _filename, const std::string& image, unsigned seed, const Document& doc){
+	filename = _filename;
+	frames = 0;
+	if (!writeFileAtomic(filename + ".vertices", documentToJSON(doc))){
+		return false;
+	}
+	file.open(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file){
+		return false;
+	}
+	file << RECORDINGHEADER << " " << RECORDINGVERSION << "\n";
+	file << "seed " << seed << "\n";
+	file << "image " << image << "\n";
+	return true;
+}
+
+// Flushed every frame, so a crash keeps everything up to the frame before it
+void InputRecorder::record(const InputFrame& f){
+	if (!file.is_open()){
+		return;
+	}
+	file << "f " << exact(f.dt) << " " << f.mouse.x << " " << f.mouse.y << " " << f.left << " " << f.right
+		<< " " << f.winsize.x << " " << f.winsize.y << " " << exact(f.center.x) << " " << exact(f.center.y)
+		<< " " << exact(f.size.x) << " " << exact(f.size.y) << " " << exact(f.zoom) << " " << f.recolored
+		<< " " << exact(f.ms) << "\n";
+	for (const sf::Event& event : f.events){
+		file << eventText(event);
+	}
+	file.flush();
+	frames++;
+}
+
+void InputRecorder::stop(){
+	if (file.is_open()){
+		file.close();
+	}
+}
+
+bool InputReplay::open(const std::string& _filename){
+	filename = _filename;
+	mesh = filename + ".vertices";
+	std::ifstream in(filename, std::ios::binary);
+	std::string line;
+	std::string magic;
+	int version = 0;
+	if (!in || !std::getline(in, line) || !(std::istringstream(line) >> magic >> version) || magic != RECORDINGHEADER || version != RECORDINGVERSION){
+		printf("%s is not an input recording\n", filename.c_str());
+		return false;
+	}
+	while (std::getline(in, line)){
+		if (!line.empty() && line.back() == '\r'){
+			line.pop_back();
+		}
+		std::istringstream rec(line);
+		std::string op;
+		rec >> op;
+		bool ok = true;
+		if (op == "seed"){
+			ok = (bool)(rec >> seed);
+		}
+		else if (op == "image"){
+			image = line.size() > 6 ? line.substr(6) : "";
+		}
+		else if (op == "f"){
+			InputFrame f;
+			ok = (bool)(rec >> f.dt >> f.mouse.x >> f.mouse.y >> f.left >> f.right >> f.winsize.x >> f.winsize.y
+				>> f.center.x >> f.center.y >> f.size.x >> f.size.y >> f.zoom >> f.recolored >> f.ms);
+			if (ok){
+				frames.push_back(f);
+			}
+		}
+		else if (op == "e"){
+			sf::Event event;
+			ok = !frames.empty() && readEvent(rec, event);
+			if (ok){
+				frames.back().events.push_back(event);
+			}
+		}
+		else {
+			ok = op.empty();
+		}
+		// A frame cut off by a crash ends the recording
+		if (!ok){
+			printf("Stopped reading %s at a malformed line: %s\n", filename.c_str(), line.c_str());
+			break;
+		}
+	}
+	if (image.empty()){
+		printf("%s names no image\n", filename.c_str());
+		return false;
+	}
+	return true;
+}
+
+static void printStats(const char* label, std::vector<float> ms){
+	if (ms.empty()){
+		return;
+	}
+	double sum = 0;
+	for (float t : ms){
+		sum += t;
+	}
+	std::sort(ms.begin(), ms.end());
+	printf("%-9s total %9.1f ms, avg %7.3f, median %7.3f, p99 %7.3f, max %7.3f ms\n", label, sum, sum / ms.size(),
+		ms[ms.size() / 2], ms[std::min(ms.size() - 1, (size_t)(ms.size() * 0.99))], ms.back());
+}
+
+void InputReplay::report(){
+	size_t count = std::min(times.size(), frames.size());
+	std::vector<float> recorded(count);
+	for (size_t i = 0; i < count; i++){
+		recorded[i] = frames[i].ms;
+	}
+	std::vector<float> replayed(times.begin(), times.begin() + count);
+	printf("Replayed %u of %u frames from %s\n", (unsigned)count, (unsigned)frames.size(), filename.c_str());
+	printStats("Recorded", recorded);
+	printStats("Replayed", replayed);
+	std::vector<size_t> order(count);
+	for (size_t i = 0; i < count; i++){
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b){ return times[a] > times[b]; });
+	for (size_t i = 0; i < order.size() && i < REPORTWORST; i++){
+		size_t k = order[i];
+		printf("  frame %6u: %8.3f ms replayed, %8.3f ms recorded, %u events\n", (unsigned)k, times[k], frames[k].ms, (unsigned)frames[k].events.size());
+	}
+	std::string tsv = filename + ".timings.tsv";
+	std::ofstream out(tsv, std::ios::out | std::ios::binary | std::ios::trunc);
+	out << "frame\tevents\trecorded_ms\treplayed_ms\n";
+	for (size_t i = 0; i < count; i++){
+		out << i << "\t" << frames[i].events.size() << "\t" << frames[i].ms << "\t" << times[i] << "\n";
+	}
+	if (out){
+		printf("Frame timings written to %s\n", tsv.c_str());
+	}
+}
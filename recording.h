@@ -0,0 +1,69 @@
+#pragma once
+#include "stdafx.h"
+#include "document.h"
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Everything from outside the editor thread that one frame depends on:
+// the events it handled and the state it polled. Replaying the frames in
+// order reproduces the session exactly.
+struct InputFrame {
+	float dt = 0;              // Seconds since the previous frame, as ImGui saw them
+	sf::Vector2i mouse;        // Polled position in the window
+	bool left  = false;        // Polled mouse buttons
+	bool right = false;
+	sf::Vector2u winsize;
+	sf::Vector2f center;       // Camera at the start of the frame
+	sf::Vector2f size;
+	float zoom = 1;
+	bool recolored = false;    // A background recolor was applied at the end of this frame
+	float ms = 0;              // Editor thread time of the frame when it was recorded
+	std::vector<sf::Event> events;
+};
+
+// Writes the input of an editing session to a text file, one frame at a
+// time, next to a copy of the mesh it started from (filename + ".vertices").
+//
+//   polyedit-input 1
+//   seed s              sampling seed the session started with
+//   image path          rest of the line
+//   f dt mx my l r w h cx cy sw sh zoom recolored ms
+//   e type fields..     events of the frame above, in order
+class InputRecorder {
+public:
+	// Returns false if either file can't be written.
+	bool start(const std::string& _filename, const std::string& image, unsigned seed, const Document& doc);
+	void record(const InputFrame& frame);
+	void stop();
+	bool recording() const { return file.is_open(); }
+	const std::string& name() const { return filename; }
+
+	int frames = 0;
+
+private:
+	std::string filename;
+	std::ofstream file;
+};
+
+// Reads a recording back and collects the timings of the replayed frames.
+class InputReplay {
+public:
+	// Returns false (after printing why) if filename is not a recording.
+	bool open(const std::string& _filename);
+	bool done() const { return next >= frames.size(); }
+	const InputFrame& advance() { return frames[next++]; }
+	// Editor thread time of the frame just replayed.
+	void time(float ms) { times.push_back(ms); }
+	// Prints the replayed frame times next to the recorded ones and writes
+	// both, frame by frame, to filename + ".timings.tsv".
+	void report();
+
+	std::string filename;
+	std::string image;
+	std::string mesh;  // The mesh the recording started from
+	unsigned seed = 0;
+	std::vector<InputFrame> frames;
+	size_t next = 0;
+	std::vector<float> times;
+};
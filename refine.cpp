@@ -0,0 +1,148 @@
+#include "stdafx.h"
+#include "refine.h"
+#include <algorithm>
+#include <cmath>
+
+// Triangles covering fewer pixel centers than this are never split
+#define REFINEMINPIXELS 4
+
+Refiner::Refiner(Triangulation& _tri, const ColorStats& _stats)
+	: tri(_tri), stats(_stats){
+}
+
+sf::Vector2f Refiner::position(int v) const {
+	return sf::Vector2f((float)tri.x[v], (float)tri.y[v]);
+}
+
+void Refiner::grow(){
+	if (version.size() < tri.tris.size()){
+		version.resize(tri.tris.size(), 0);
+		means.resize(tri.tris.size(), sf::Color::Black);
+		inside.resize(tri.tris.size(), false);
+		fresh.resize(tri.tris.size(), false);
+		if (!labels.empty()){
+			labels.resize(tri.tris.size(), -1);
+		}
+	}
+}
+
+void Refiner::setLabels(const std::vector<int>& _labels){
+	labels = _labels;
+	if (labels.empty()){
+		return;
+	}
+	labels.resize(std::max(labels.size(), tri.tris.size()), -1);
+}
+
+void Refiner::score(int t){
+	version[t]++;
+	const Triangulation::Tri& tr = tri.tris[t];
+	if (tri.isSuper(tr.v[0]) || tri.isSuper(tr.v[1]) || tri.isSuper(tr.v[2])){
+		return;
+	}
+	if (!labels.empty() && labels[t] < 0){
+		return;
+	}
+	if (!inside[t]){
+		inside[t] = true;
+		count++;
+	}
+	TriangleStats s = stats.triangle(position(tr.v[0]), position(tr.v[1]), position(tr.v[2]));
+	means[t] = s.mean();
+	if (s.count < REFINEMINPIXELS){
+		return;
+	}
+	double error = s.error();
+	if (std::sqrt(error / (3 * s.count)) <= options.maxerror){
+		return;
+	}
+	Entry e = { error, t, version[t] };
+	heap.push(e);
+}
+
+int Refiner::run(const RefineOptions& _options){
+	options = _options;
+	heap = std::priority_queue<Entry>();
+	grow();
+	count = 0;
+	for (unsigned t = 0; t < tri.tris.size(); t++){
+		inside[t] = false;
+		fresh[t] = false;
+		if (tri.tris[t].alive){
+			score(t);
+		}
+	}
+	int inserted = 0;
+	while (count < options.triangles && !heap.empty()){
+		Entry e = heap.top();
+		heap.pop();
+		if (!tri.tris[e.tri].alive || version[e.tri] != e.version){
+			continue;
+		}
+		const Triangulation::Tri& tr = tri.tris[e.tri];
+		sf::Vector2f p;
+		if (!stats.errorCentroid(position(tr.v[0]), position(tr.v[1]), position(tr.v[2]), means[e.tri], p)){
+			continue;
+		}
+		int label = -1;
+		if (!labels.empty()){
+			// A point on an edge would open the cavity into the neighbour
+			label = labels[e.tri];
+			if (tri.orient(tr.v[0], tr.v[1], p.x, p.y) <= 0 || tri.orient(tr.v[1], tr.v[2], p.x, p.y) <= 0 ||
+				tri.orient(tr.v[2], tr.v[0], p.x, p.y) <= 0){
+				continue;
+			}
+		}
+		int before = tri.vertexCount();
+		if (tri.insert(p.x, p.y) < before){
+			// Already a vertex there (or outside the triangulation)
+			continue;
+		}
+		inserted++;
+		grow();
+		for (int r : tri.removed){
+			version[r]++;
+			fresh[r] = false;
+			if (inside[r]){
+				inside[r] = false;
+				count--;
+			}
+		}
+		for (int c : tri.created){
+			fresh[c] = true;
+			if (!labels.empty()){
+				labels[c] = label;
+			}
+			score(c);
+		}
+	}
+	return inserted;
+}
+
+void Refiner::result(std::vector<std::array<int, 3> >& out, std::vector<sf::Color>& colors) const {
+	out.clear();
+	colors.clear();
+	for (unsigned t = 0; t < tri.tris.size(); t++){
+		const Triangulation::Tri& tr = tri.tris[t];
+		if (tr.alive && t < inside.size() && inside[t]){
+			std::array<int, 3> v = {{ tr.v[0], tr.v[1], tr.v[2] }};
+			out.push_back(v);
+			colors.push_back(means[t]);
+		}
+	}
+}
+
+void Refiner::created(std::vector<std::array<int, 3> >& out, std::vector<sf::Color>& colors, std::vector<int>& outlabels) const {
+	out.clear();
+	colors.clear();
+	outlabels.clear();
+	for (unsigned t = 0; t < tri.tris.size(); t++){
+		const Triangulation::Tri& tr = tri.tris[t];
+		if (tr.alive && t < inside.size() && inside[t] && fresh[t]){
+			std::array<int, 3> v = {{ tr.v[0], tr.v[1], tr.v[2] }};
+			out.push_back(v);
+			colors.push_back(means[t]);
+			outlabels.push_back(labels.empty() ? -1 : labels[t]);
+		}
+	}
+}
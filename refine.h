@@ -0,0 +1,62 @@
+#pragma once
+#include "stdafx.h"
+#include "colorstats.h"
+#include "delaunay.h"
+#include <array>
+#include <queue>
+#include <vector>
+
+struct RefineOptions {
+	int   triangles = 20000;  // Stop once the mesh has this many triangles
+	float maxerror  = 4.0f;   // Leave triangles whose RMS error per channel is below this
+};
+
+// Error-driven refinement of a triangulation. Triangles are kept in a heap
+// by the squared error of their mean color against the image; the worst one
+// is split by inserting its worst pixel, and only the triangles that
+// insertion created are scored again.
+//
+// With labels set, only the labeled triangles are refined. If every edge
+// of a labeled triangle is a constraint, each insertion stays inside the
+// labeled triangle it splits, so an existing mesh can be refined in place.
+class Refiner {
+public:
+	Refiner(Triangulation& _tri, const ColorStats& _stats);
+
+	// Limits run() to the triangle slots with a label >= 0. Triangles an
+	// insertion creates take the label of the one it split.
+	void setLabels(const std::vector<int>& _labels);
+
+	// Returns the number of points inserted.
+	int run(const RefineOptions& options);
+
+	// Triangles inside the hull (vertex indices) and their mean colors.
+	void result(std::vector<std::array<int, 3> >& out, std::vector<sf::Color>& colors) const;
+	// Only the triangles run() created, with the label of the one they split.
+	void created(std::vector<std::array<int, 3> >& out, std::vector<sf::Color>& colors, std::vector<int>& outlabels) const;
+	int triangleCount() const { return count; }
+
+private:
+	struct Entry {
+		double error;
+		int tri;
+		unsigned version;
+		bool operator<(const Entry& other) const { return error < other.error; }
+	};
+
+	void score(int t);
+	void grow();
+	sf::Vector2f position(int v) const;
+
+	Triangulation& tri;
+	const ColorStats& stats;
+	RefineOptions options;
+	std::priority_queue<Entry> heap;
+	// Per triangle slot; version invalidates heap entries of replaced triangles
+	std::vector<unsigned>  version;
+	std::vector<sf::Color> means;
+	std::vector<bool>      inside;
+	std::vector<bool>      fresh;  // Created by run()
+	std::vector<int>       labels; // Empty when refining everything
+	int count = 0;
+};
@@ -0,0 +1,321 @@
+#include "stdafx.h"
+#include "renderer.h"
+#include "imgui-backends/SFML/imgui-rendering-SFML.h"
+#include <cstring>
+
+// Background color
+#define BGCOLOR sf::Color(125,125,125,255)
+
+// Frame that ImGui::Render() copies its draw lists into
+static FrameData* capturing = NULL;
+
+template<typename T>
+static void copyVector(const ImVector<T>& from, ImVector<T>& to){
+	to.resize(from.Size);
+	if (from.Size > 0){
+		memcpy(to.Data, from.Data, from.Size * sizeof(T));
+	}
+}
+
+// Stands in for the backend's draw function while the editor thread runs
+// ImGui::Render(); the copies are drawn by the render thread later.
+static void captureDrawLists(ImDrawData* data){
+	FrameData& f = *capturing;
+	while ((int)f.gui.size() < data->CmdListsCount){
+		f.gui.emplace_back(new ImDrawList());
+	}
+	for (int i = 0; i < data->CmdListsCount; i++){
+		const ImDrawList* from = data->CmdLists[i];
+		ImDrawList& to = *f.gui[i];
+		copyVector(from->CmdBuffer, to.CmdBuffer);
+		copyVector(from->IdxBuffer, to.IdxBuffer);
+		copyVector(from->VtxBuffer, to.VtxBuffer);
+	}
+	f.guilists = data->CmdListsCount;
+}
+
+void FrameData::clear(){
+	fills.clear();
+	shapes.clear();
+	points.clear();
+	selected.clear();
+	centers.clear();
+	guilists = 0;
+}
+
+long long FrameData::bytes() const{
+	return fills.capacity() * sizeof(sf::Vertex) + (shapes.capacity() + selected.capacity()) * sizeof(FrameShape)
+		+ points.capacity() * sizeof(FramePoint) + centers.capacity() * sizeof(sf::Vector2f);
+}
+
+void fillFrame(FrameData& f, const std::vector<Poly>& polygons, const std::vector<Point>& points, bool wireframe, bool gouraud){
+	for (const Poly& polygon : polygons){
+		const Point* corners[3] = { polygon.p1, polygon.p2, polygon.p3 };
+		sf::Color fill = polygon.fillcolor;
+		fill.a = 255;
+		sf::Color clear = fill;
+		clear.a = 0;
+		if (polygon.selected || wireframe){
+			FrameShape shape = { { corners[0]->vector, corners[1]->vector, corners[2]->vector }, wireframe ? clear : fill, fill };
+			if (polygon.selected){
+				shape.outline = sf::Color::Blue;
+				f.selected.push_back(shape);
+			}
+			else {
+				f.shapes.push_back(shape);
+			}
+		}
+		else {
+			for (int j = 0; j < 3; j++){
+				f.fills.push_back(sf::Vertex(corners[j]->vector, gouraud ? corners[j]->color : fill));
+			}
+		}
+		if (f.showcenters){
+			f.centers.push_back(polygon.center);
+		}
+	}
+	if (f.showpoints){
+		for (const Point& point : points){
+			FramePoint p = { point.vector, point.size, point.selected };
+			f.points.push_back(p);
+		}
+	}
+}
+
+Renderer::Renderer(sf::RenderWindow& _window) : window(_window), running(false), keycamera(true), drawn(0), submitted(0){
+	back = &buffers[0];
+	pending = &buffers[1];
+	front = &buffers[2];
+	polyshape.setPointCount(3);
+	pointshape.setFillColor(sf::Color::Transparent);
+	view = window.getView();
+	ImGui::SFML::SetRenderTarget(window);
+	ImGui::SFML::InitImGuiRendering();
+	ImGui::GetIO().RenderDrawListsFn = captureDrawLists;
+}
+
+Renderer::~Renderer(){
+	if (thread.joinable()){
+		stop();
+	}
+}
+
+void Renderer::start(){
+	// The context can only be current on one thread at a time
+	window.setActive(false);
+	running = true;
+	thread = std::thread(&Renderer::loop, this);
+}
+
+void Renderer::stop(){
+	running = false;
+	if (thread.joinable()){
+		thread.join();
+	}
+	window.setActive(true);
+	ImGui::SFML::Shutdown();
+}
+
+void Renderer::renderGUI(){
+	ProfileScope scope(PHASE_IMGUI);
+	capturing = back;
+	ImGui::Render();
+	capturing = NULL;
+}
+
+void Renderer::submit(){
+	{
+		std::lock_guard<std::mutex> lock(framemutex);
+		std::swap(back, pending);
+		fresh = true;
+	}
+	back->clear();
+	submitted++;
+}
+
+RenderCounts Renderer::counts(){
+	std::lock_guard<std::mutex> lock(framemutex);
+	return lastcounts;
+}
+
+long long Renderer::frameBytes(){
+	std::lock_guard<std::mutex> lock(framemutex);
+	long long bytes = 0;
+	for (const FrameData& f : buffers){
+		bytes += f.bytes();
+	}
+	return bytes;
+}
+
+void Renderer::getCamera(sf::View& _view, float& _zoom){
+	std::lock_guard<std::mutex> lock(cameramutex);
+	_view = view;
+	_zoom = zoom;
+}
+
+void Renderer::moveCamera(const sf::Vector2f& offset){
+	std::lock_guard<std::mutex> lock(cameramutex);
+	view.move(offset);
+}
+
+void Renderer::zoomCamera(float factor){
+	std::lock_guard<std::mutex> lock(cameramutex);
+	view.zoom(factor);
+	zoom *= factor;
+}
+
+void Renderer::resetCamera(const sf::FloatRect& rect){
+	std::lock_guard<std::mutex> lock(cameramutex);
+	view.reset(rect);
+	zoom = 1;
+}
+
+void Renderer::setCamera(const sf::View& _view, float _zoom){
+	std::lock_guard<std::mutex> lock(cameramutex);
+	view = _view;
+	zoom = _zoom;
+}
+
+void Renderer::loop(){
+	Tracer::nameThread("Render");
+	window.setActive(true);
+	while (running){
+		{
+			std::lock_guard<std::mutex> lock(framemutex);
+			if (fresh){
+				std::swap(front, pending);
+				fresh = false;
+			}
+		}
+		handleCamera();
+		RenderCounts c;
+		{
+			ProfileScope scope(PHASE_RENDER);
+			draw(*front, c);
+		}
+		{
+			// Waits out the rest of the frame (the window's frame rate limit)
+			ProfileScope scope(PHASE_DISPLAY);
+			window.display();
+		}
+		{
+			std::lock_guard<std::mutex> lock(framemutex);
+			lastcounts = c;
+		}
+		drawn++;
+	}
+	window.setActive(false);
+}
+
+// Checks input for arrow keys and +/- for camera movement
+void Renderer::handleCamera(){
+	if (!keycamera || !window.hasFocus()){
+		return;
+	}
+	std::lock_guard<std::mutex> lock(cameramutex);
+	if (sf::Keyboard::isKeyPressed(sf::Keyboard::Left)){
+		view.move(sf::Vector2f(-2 * zoom, 0));
+	}
+	if (sf::Keyboard::isKeyPressed(sf::Keyboard::Right)){
+		view.move(sf::Vector2f(2 * zoom, 0));
+	}
+	if (sf::Keyboard::isKeyPressed(sf::Keyboard::Up)){
+		view.move(sf::Vector2f(0, -2 * zoom));
+	}
+	if (sf::Keyboard::isKeyPressed(sf::Keyboard::Down)){
+		view.move(sf::Vector2f(0, 2 * zoom));
+	}
+	if (sf::Keyboard::isKeyPressed(sf::Keyboard::Dash)){
+		zoom *= 1.01f;
+		view.zoom(1.01f);
+	}
+	if (sf::Keyboard::isKeyPressed(sf::Keyboard::Equal)){
+		zoom *= 0.99f;
+		view.zoom(0.99f);
+	}
+}
+
+void Renderer::draw(FrameData& f, RenderCounts& c){
+	sf::View camera;
+	float z;
+	getCamera(camera, z);
+	window.clear(BGCOLOR);
+	window.setView(camera);
+	if (f.image != texture || f.smooth != smooth){
+		texture = f.image;
+		smooth = f.smooth;
+		if (texture != NULL){
+			texture->setSmooth(smooth);
+			sprite.setTexture(*texture, true);
+		}
+	}
+	if (f.showimage && texture != NULL){
+		sf::Vector2u size = texture->getSize();
+		sprite.setScale(f.imagesize.x / size.x, f.imagesize.y / size.y);
+		window.draw(sprite);
+		c.drawcalls++;
+	}
+	if (!f.fills.empty()){
+		window.draw(&f.fills[0], f.fills.size(), sf::Triangles);
+		c.drawcalls++;
+		c.triangles = (int)f.fills.size() / 3;
+	}
+	// Outlines stay one pixel wide at any zoom
+	polyshape.setOutlineThickness(-1 * z);
+	for (const FrameShape& s : f.shapes){
+		for (int j = 0; j < 3; j++){
+			polyshape.setPoint(j, s.corner[j]);
+		}
+		polyshape.setFillColor(s.fill);
+		polyshape.setOutlineColor(s.outline);
+		window.draw(polyshape);
+	}
+	c.shapes += (int)f.shapes.size();
+	if (f.showpoints){
+		pointshape.setOutlineThickness(-1.5f * z);
+		for (const FramePoint& p : f.points){
+			float radius = p.size * z;
+			pointshape.setRadius(radius);
+			pointshape.setPosition(p.vector.x - radius, p.vector.y - radius);
+			pointshape.setOutlineColor(p.selected ? sf::Color::Blue : sf::Color::Green);
+			window.draw(pointshape);
+		}
+		c.shapes += (int)f.points.size();
+	}
+	for (const FrameShape& s : f.selected){
+		for (int j = 0; j < 3; j++){
+			polyshape.setPoint(j, s.corner[j]);
+		}
+		polyshape.setFillColor(s.fill);
+		polyshape.setOutlineColor(s.outline);
+		window.draw(polyshape);
+	}
+	c.shapes += (int)f.selected.size();
+	if (f.showcenters){
+		sf::CircleShape dot(2 * z);
+		dot.setFillColor(sf::Color(255, 255, 255, 127));
+		for (const sf::Vector2f& center : f.centers){
+			dot.setPosition(center);
+			window.draw(dot);
+		}
+		c.shapes += (int)f.centers.size();
+	}
+	c.drawcalls += c.shapes;
+	if (f.guilists > 0){
+		guilists.clear();
+		ImDrawData data;
+		data.Valid = true;
+		for (int i = 0; i < f.guilists; i++){
+			guilists.push_back(f.gui[i].get());
+			data.TotalVtxCount += f.gui[i]->VtxBuffer.Size;
+			data.TotalIdxCount += f.gui[i]->IdxBuffer.Size;
+			c.guicommands += f.gui[i]->CmdBuffer.Size;
+		}
+		c.guivertices = data.TotalVtxCount;
+		c.guielements = data.TotalIdxCount;
+		c.drawcalls += c.guicommands;
+		data.CmdLists = &guilists[0];
+		data.CmdListsCount = f.guilists;
+		ImGui::ImImpl::ImImpl_RenderDrawLists(&data);
+	}
+}
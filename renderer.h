@@ -0,0 +1,145 @@
+#pragma once
+#include "stdafx.h"
+#include "poly.h"
+#include "profiler.h"
+#include "imgui/imgui.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A polygon drawn as a shape rather than batched: the outline is drawn
+// inside the corners, one screen pixel wide.
+struct FrameShape {
+	sf::Vector2f corner[3];
+	sf::Color fill;
+	sf::Color outline;
+};
+
+struct FramePoint {
+	sf::Vector2f vector;
+	float size;
+	bool selected;
+};
+
+// Everything the render thread draws in one frame, in world coordinates.
+// The editor thread fills one in full and hands it over; the render thread
+// never sees a frame that is still being filled, so it never reads the
+// document itself.
+struct FrameData {
+	sf::Texture* image = NULL;  // Stretched over imagesize, so a smaller preview can stand in for the image
+	sf::Vector2f imagesize;
+	bool showimage   = true;
+	bool smooth      = false;
+	bool showpoints  = true;
+	bool showcenters = false;
+	std::vector<sf::Vertex>   fills;     // Unselected polygons as triangles (flat or Gouraud colors)
+	std::vector<FrameShape>   shapes;    // Unselected polygons in wireframe mode
+	std::vector<FramePoint>   points;
+	std::vector<FrameShape>   selected;  // Drawn over the points
+	std::vector<sf::Vector2f> centers;
+	// Copies of the ImGui draw lists, empty when no panel is open
+	std::vector<std::unique_ptr<ImDrawList> > gui;
+	int guilists = 0;
+
+	void clear();
+	// What the vectors above hold on to (the draw lists are ImGui's).
+	long long bytes() const;
+};
+
+// Adds the polygons (and points and centers, if f shows them) to f.
+// wireframe draws every polygon as an outline; gouraud shades the filled
+// ones from their point colors.
+void fillFrame(FrameData& f, const std::vector<Poly>& polygons, const std::vector<Point>& points, bool wireframe, bool gouraud);
+
+// What the render thread drew in its last frame.
+struct RenderCounts {
+	int drawcalls   = 0;  // Draw calls made through SFML, plus one per ImGui command
+	int triangles   = 0;  // In the polygon fill batch
+	int shapes      = 0;  // Polygons, points and centers drawn one by one
+	int guicommands = 0;
+	int guivertices = 0;
+	int guielements = 0;  // ImGui indices
+};
+
+// Draws frames on a thread of its own, which owns the window's GL context
+// from start() to stop(). The editor thread fills frame() and calls
+// submit(); the render thread always draws the newest frame submitted,
+// at the window's frame rate, so a slow edit never holds up drawing and
+// drawing never holds up input.
+//
+// The camera lives here too: the arrow keys and +/- are polled on the
+// render thread, so panning and zooming keep going while the editor
+// thread is busy with a long operation.
+class Renderer {
+public:
+	// Sets up the ImGui backend for window.
+	Renderer(sf::RenderWindow& _window);
+	~Renderer();
+
+	void start();
+	// Joins the render thread, makes the GL context current on the calling
+	// thread again and shuts the ImGui backend down.
+	void stop();
+
+	// The frame being filled by the editor thread. Cleared by submit(),
+	// its buffers are reused.
+	FrameData& frame() { return *back; }
+	// Runs ImGui::Render(), copying the draw lists into frame() to be drawn
+	// with it.
+	void renderGUI();
+	void submit();
+
+	// Camera shared with the editor thread.
+	void getCamera(sf::View& _view, float& _zoom);
+	void moveCamera(const sf::Vector2f& offset);
+	void zoomCamera(float factor);
+	void resetCamera(const sf::FloatRect& rect);
+	void setCamera(const sf::View& _view, float _zoom);
+	// Whether the arrow keys and +/- move the camera (off while replaying
+	// a recording, which sets the camera itself every frame).
+	void setKeyCamera(bool on) { keycamera = on; }
+
+	// Frames drawn and submitted since start().
+	long long framesDrawn() const { return drawn; }
+	long long framesSubmitted() const { return submitted; }
+	RenderCounts counts();
+	// Bytes held by the three frame buffers.
+	long long frameBytes();
+
+private:
+	void loop();
+	void handleCamera();
+	void draw(FrameData& f, RenderCounts& c);
+
+	sf::RenderWindow& window;
+	sf::Texture* texture = NULL;  // The one sprite is set to
+	sf::Sprite sprite;
+	bool smooth = false;
+	std::thread thread;
+	std::atomic<bool> running;
+	std::atomic<bool> keycamera;
+	std::atomic<long long> drawn;
+	std::atomic<long long> submitted;
+
+	// Triple buffer: back is filled by the editor thread, front is drawn,
+	// and pending is the newest complete frame between the two.
+	std::mutex framemutex;
+	FrameData buffers[3];
+	FrameData* back;
+	FrameData* pending;
+	FrameData* front;
+	bool fresh = false;
+
+	std::mutex cameramutex;
+	sf::View view;
+	float zoom = 1.0f;
+
+	RenderCounts lastcounts;  // Under framemutex
+
+	// Reused for the shapes of every frame
+	sf::ConvexShape polyshape;
+	sf::CircleShape pointshape;
+	std::vector<ImDrawList*> guilists;
+};
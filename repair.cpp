@@ -0,0 +1,354 @@
+#include "stdafx.h"
+#include "repair.h"
+#include "delaunay.h"
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+
+// Times the region around the one-ring grows before giving up. Repairs run
+// every frame of a drag, so it rarely has to grow more than a few times.
+#define REPAIRSTEPS 256
+// A point on the mesh outline drags the outline along, and growing the
+// region cannot bring back points it has left behind, so give up sooner
+#define REPAIRRIMSTEPS 4
+
+static unsigned long long edgeKey(int a, int b){
+	if (a > b){
+		std::swap(a, b);
+	}
+	return ((unsigned long long)(unsigned)a << 32) | (unsigned)b;
+}
+
+static int side(const sf::Vector2f& a, const sf::Vector2f& b, const sf::Vector2f& c){
+	double d = ((double)b.x - a.x) * ((double)c.y - a.y) - ((double)b.y - a.y) * ((double)c.x - a.x);
+	return (d > 0) - (d < 0);
+}
+
+bool isFolded(const std::vector<sf::Vector2f>& points, const std::vector<std::array<int, 3> >& tris, const std::vector<int>& slots){
+	// Edge -> slot * 3 + the corner facing it, from the first triangle seen
+	std::unordered_map<unsigned long long, int> edges;
+	for (int s : slots){
+		const std::array<int, 3>& t = tris[s];
+		if (side(points[t[0]], points[t[1]], points[t[2]]) == 0){
+			return true;
+		}
+		for (int i = 0; i < 3; i++){
+			int a = t[(i + 1) % 3];
+			int b = t[(i + 2) % 3];
+			unsigned long long key = edgeKey(a, b);
+			std::unordered_map<unsigned long long, int>::iterator found = edges.find(key);
+			if (found == edges.end()){
+				edges[key] = s * 3 + i;
+				continue;
+			}
+			int c = tris[found->second / 3][found->second % 3];
+			if (side(points[a], points[b], points[t[i]]) * side(points[a], points[b], points[c]) >= 0){
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+struct Side {
+	int a, b; // Edge used by only one of the slots
+	int w;    // Third corner of that slot
+};
+
+static void outline(const std::vector<std::array<int, 3> >& tris, const std::vector<int>& slots, std::vector<Side>& out){
+	std::unordered_map<unsigned long long, int> count;
+	for (int s : slots){
+		for (int i = 0; i < 3; i++){
+			count[edgeKey(tris[s][i], tris[s][(i + 1) % 3])]++;
+		}
+	}
+	out.clear();
+	for (int s : slots){
+		for (int i = 0; i < 3; i++){
+			int a = tris[s][i];
+			int b = tris[s][(i + 1) % 3];
+			if (count[edgeKey(a, b)] == 1){
+				Side side = { a, b, tris[s][(i + 2) % 3] };
+				out.push_back(side);
+			}
+		}
+	}
+}
+
+// Triangles on each side of an edge (-1 if none) among the ones near the
+// repair
+typedef std::unordered_map<unsigned long long, std::pair<int, int> > Adjacency;
+
+static void link(Adjacency& adjacency, const std::vector<std::array<int, 3> >& tris, int s){
+	for (int i = 0; i < 3; i++){
+		unsigned long long key = edgeKey(tris[s][i], tris[s][(i + 1) % 3]);
+		Adjacency::iterator found = adjacency.find(key);
+		if (found == adjacency.end()){
+			adjacency[key] = std::make_pair(s, -1);
+		}
+		else if (found->second.second < 0){
+			found->second.second = s;
+		}
+	}
+}
+
+// Adds the triangles across the outline (edges) of slots. With a target, only
+// across the edges that have it on their far side, so a point that jumped
+// several triangles away is reached along a strip instead of a growing
+// disc; across all of them if no edge faces it. Returns how many were added.
+static int grow(const std::vector<sf::Vector2f>& points, const Adjacency& adjacency, const std::vector<Side>& edges,
+	std::vector<int>& slots, std::vector<bool>& in, int target){
+	int added = 0;
+	for (int pass = 0; pass < 2 && added == 0; pass++){
+		for (const Side& e : edges){
+			if (pass == 0 && (target < 0 || e.w == target ||
+				side(points[e.a], points[e.b], points[e.w]) * side(points[e.a], points[e.b], points[target]) >= 0)){
+				continue;
+			}
+			Adjacency::const_iterator found = adjacency.find(edgeKey(e.a, e.b));
+			if (found == adjacency.end()){
+				continue;
+			}
+			int across[2] = { found->second.first, found->second.second };
+			for (int s : across){
+				if (s >= 0 && !in[s]){
+					in[s] = true;
+					slots.push_back(s);
+					added++;
+				}
+			}
+		}
+	}
+	return added;
+}
+
+// Whether the outline goes around v. Always true when v is on the
+// outline itself, since then the outline moves with it.
+static bool encloses(const std::vector<sf::Vector2f>& points, const std::vector<Side>& edges, int v){
+	const sf::Vector2f& p = points[v];
+	bool inside = false;
+	for (const Side& e : edges){
+		if (e.a == v || e.b == v){
+			return true;
+		}
+		const sf::Vector2f& a = points[e.a];
+		const sf::Vector2f& b = points[e.b];
+		if ((a.y > p.y) != (b.y > p.y) && p.x < a.x + (b.x - a.x) * ((double)p.y - a.y) / ((double)b.y - a.y)){
+			inside = !inside;
+		}
+	}
+	return inside;
+}
+
+// Constrained Delaunay triangulation of the area the slots cover, with the
+// points where they are now. Fails unless the outline is a simple polygon
+// that the triangles fill with every corner used, so the result can stand
+// in for the slots one for one.
+static bool retriangulate(const std::vector<sf::Vector2f>& points, const std::vector<std::array<int, 3> >& tris, const std::vector<int>& slots,
+	const std::vector<Side>& edges, std::vector<std::array<int, 3> >& out){
+	std::vector<int> corners;
+	for (int s : slots){
+		corners.insert(corners.end(), tris[s].begin(), tris[s].end());
+	}
+	std::sort(corners.begin(), corners.end());
+	corners.erase(std::unique(corners.begin(), corners.end()), corners.end());
+	sf::FloatRect bounds(points[corners[0]], sf::Vector2f(0, 0));
+	for (int c : corners){
+		float right = std::max(bounds.left + bounds.width, points[c].x);
+		float bottom = std::max(bounds.top + bounds.height, points[c].y);
+		bounds.left = std::min(bounds.left, points[c].x);
+		bounds.top = std::min(bounds.top, points[c].y);
+		bounds.width = right - bounds.left;
+		bounds.height = bottom - bounds.top;
+	}
+
+	Triangulation tri;
+	tri.begin(bounds);
+	std::unordered_map<int, int> local;
+	std::vector<int> meshof(3, -1);
+	for (int c : corners){
+		int id = tri.insert(points[c].x, points[c].y);
+		if (id < (int)meshof.size()){
+			// Outside the bounds or on top of another corner
+			return false;
+		}
+		meshof.push_back(c);
+		local[c] = id;
+	}
+	for (const Side& e : edges){
+		if (!tri.insertConstraint(local[e.a], local[e.b])){
+			return false;
+		}
+	}
+
+	// Everything reachable from the super triangle without crossing the
+	// outline is outside
+	std::vector<bool> outside(tri.tris.size(), false);
+	std::vector<int> stack;
+	for (int t = 0; t < (int)tri.tris.size(); t++){
+		const Triangulation::Tri& tr = tri.tris[t];
+		if (tr.alive && (tri.isSuper(tr.v[0]) || tri.isSuper(tr.v[1]) || tri.isSuper(tr.v[2]))){
+			outside[t] = true;
+			stack.push_back(t);
+		}
+	}
+	while (!stack.empty()){
+		int t = stack.back();
+		stack.pop_back();
+		const Triangulation::Tri& tr = tri.tris[t];
+		for (int i = 0; i < 3; i++){
+			int nb = tr.n[i];
+			if (nb >= 0 && !outside[nb] && !tri.isConstraint(tr.v[(i + 1) % 3], tr.v[(i + 2) % 3])){
+				outside[nb] = true;
+				stack.push_back(nb);
+			}
+		}
+	}
+	out.clear();
+	std::vector<bool> used(meshof.size(), false);
+	for (int t = 0; t < (int)tri.tris.size(); t++){
+		const Triangulation::Tri& tr = tri.tris[t];
+		if (!tr.alive || outside[t]){
+			continue;
+		}
+		if (tri.isSuper(tr.v[0]) || tri.isSuper(tr.v[1]) || tri.isSuper(tr.v[2])){
+			return false;
+		}
+		std::array<int, 3> mt = {{ meshof[tr.v[0]], meshof[tr.v[1]], meshof[tr.v[2]] }};
+		out.push_back(mt);
+		for (int i = 0; i < 3; i++){
+			used[tr.v[i]] = true;
+		}
+	}
+	if (out.size() != slots.size()){
+		return false;
+	}
+	for (int id = 3; id < (int)meshof.size(); id++){
+		if (!used[id]){
+			return false;
+		}
+	}
+	return true;
+}
+
+static std::array<int, 3> sorted(std::array<int, 3> t){
+	std::sort(t.begin(), t.end());
+	return t;
+}
+
+// Puts the new triangles into the slots, leaving the ones that did not
+// change where they were
+static void place(std::vector<std::array<int, 3> >& tris, const std::vector<int>& slots, const std::vector<std::array<int, 3> >& fresh, std::vector<int>& changed){
+	std::map<std::array<int, 3>, int> old;
+	for (int s : slots){
+		old[sorted(tris[s])] = s;
+	}
+	std::vector<bool> taken(fresh.size(), false);
+	std::vector<bool> kept(tris.size(), false);
+	for (unsigned i = 0; i < fresh.size(); i++){
+		std::map<std::array<int, 3>, int>::iterator found = old.find(sorted(fresh[i]));
+		if (found != old.end() && !kept[found->second]){
+			kept[found->second] = true;
+			taken[i] = true;
+		}
+	}
+	unsigned next = 0;
+	for (int s : slots){
+		if (kept[s]){
+			continue;
+		}
+		while (taken[next]){
+			next++;
+		}
+		tris[s] = fresh[next++];
+		changed.push_back(s);
+	}
+}
+
+bool repairVertex(const std::vector<sf::Vector2f>& points, std::vector<std::array<int, 3> >& tris, int v, std::vector<int>* changed){
+	std::vector<int> region;
+	std::vector<bool> inregion(tris.size(), false);
+	sf::FloatRect box(points[v], sf::Vector2f(0, 0));
+	for (int s = 0; s < (int)tris.size(); s++){
+		const std::array<int, 3>& t = tris[s];
+		if (t[0] != v && t[1] != v && t[2] != v){
+			continue;
+		}
+		region.push_back(s);
+		inregion[s] = true;
+		for (int c : t){
+			float right = std::max(box.left + box.width, points[c].x);
+			float bottom = std::max(box.top + box.height, points[c].y);
+			box.left = std::min(box.left, points[c].x);
+			box.top = std::min(box.top, points[c].y);
+			box.width = right - box.left;
+			box.height = bottom - box.top;
+		}
+	}
+	if (region.empty()){
+		return true;
+	}
+	// Only the triangles around the box spanned by the one-ring and where v
+	// is now can take part; link those once instead of searching the mesh
+	// every time the region grows
+	float margin = std::max(box.width, box.height) / 2;
+	Adjacency adjacency;
+	for (int s = 0; s < (int)tris.size(); s++){
+		const std::array<int, 3>& t = tris[s];
+		float left = std::min(points[t[0]].x, std::min(points[t[1]].x, points[t[2]].x));
+		float right = std::max(points[t[0]].x, std::max(points[t[1]].x, points[t[2]].x));
+		float top = std::min(points[t[0]].y, std::min(points[t[1]].y, points[t[2]].y));
+		float bottom = std::max(points[t[0]].y, std::max(points[t[1]].y, points[t[2]].y));
+		if (right >= box.left - margin && left <= box.left + box.width + margin &&
+			bottom >= box.top - margin && top <= box.top + box.height + margin){
+			link(adjacency, tris, s);
+		}
+	}
+
+	std::vector<Side> edges;
+	std::vector<int> area = region;
+	std::vector<bool> inarea = inregion;
+	outline(tris, area, edges);
+	grow(points, adjacency, edges, area, inarea, -1);
+	if (!isFolded(points, tris, area)){
+		return true;
+	}
+
+	std::vector<std::array<int, 3> > fresh;
+	std::vector<std::array<int, 3> > old;
+	std::vector<int> placed;
+	bool rim = false;
+	for (int step = 0; step <= (rim ? REPAIRRIMSTEPS : REPAIRSTEPS); step++){
+		outline(tris, region, edges);
+		for (const Side& e : edges){
+			rim = rim || e.a == v || e.b == v;
+		}
+		if (encloses(points, edges, v) && retriangulate(points, tris, region, edges, fresh)){
+			old.clear();
+			for (int s : region){
+				old.push_back(tris[s]);
+			}
+			placed.clear();
+			place(tris, region, fresh, placed);
+			// The new triangles fill the region; check they also meet the
+			// ones around it properly (an outline point can swing over them)
+			area = region;
+			inarea = inregion;
+			grow(points, adjacency, edges, area, inarea, -1);
+			if (!isFolded(points, tris, area)){
+				if (changed != NULL){
+					changed->insert(changed->end(), placed.begin(), placed.end());
+				}
+				return true;
+			}
+			for (unsigned i = 0; i < region.size(); i++){
+				tris[region[i]] = old[i];
+			}
+		}
+		// One full layer first, then toward wherever v went
+		if (grow(points, adjacency, edges, region, inregion, step > 0 ? v : -1) == 0){
+			break;
+		}
+	}
+	return false;
+}
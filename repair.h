@@ -0,0 +1,19 @@
+#pragma once
+#include "stdafx.h"
+#include <array>
+#include <vector>
+
+// Whether any of the given triangle slots is flat or folds over a
+// neighbour in the set: two triangles sharing an edge must have their
+// other corners on opposite sides of it.
+bool isFolded(const std::vector<sf::Vector2f>& points, const std::vector<std::array<int, 3> >& tris, const std::vector<int>& slots);
+
+// Call after moving vertex v. If the triangles around v (or the ones next
+// to them) are folded, the smallest region around v that can hold it is
+// triangulated again: first just the one-ring, then one layer more, then
+// growing toward where v went. The region is redone as a constrained
+// Delaunay triangulation of its outline, so the rest of the mesh is not
+// touched and the triangle count stays the same. Triangles that keep their
+// corners keep their slots; the slots that got new corners are added to
+// changed. Returns false if the mesh around v is still folded.
+bool repairVertex(const std::vector<sf::Vector2f>& points, std::vector<std::array<int, 3> >& tris, int v, std::vector<int>* changed = NULL);
@@ -0,0 +1,67 @@
+#include "stdafx.h"
+#include "sampler.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+
+// Triangles per parallel work item in sampleTriangleColors
+#define SAMPLECHUNK 2048
+
+sf::Vector2f randomTrianglePoint(const sf::Vector2f& a, const sf::Vector2f& b, const sf::Vector2f& c, SampleRng& rng){
+	std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+	float r1 = std::sqrt(dist(rng));
+	float r2 = dist(rng);
+	sf::Vector2f point;
+	point.x = (1 - r1) * a.x + (r1 * (1 - r2)) * b.x + (r1 * r2) * c.x;
+	point.y = (1 - r1) * a.y + (r1 * (1 - r2)) * b.y + (r1 * r2) * c.y;
+	return point;
+}
+
+sf::Color sampleTriangleColor(const sf::Image& img, const sf::Vector2f& a, const sf::Vector2f& b, const sf::Vector2f& c, int samples, SampleRng& rng){
+	sf::Vector2u size = img.getSize();
+	if (samples < 1 || size.x == 0 || size.y == 0){
+		return sf::Color::Black;
+	}
+	const sf::Uint8* pixels = img.getPixelsPtr();
+	int r = 0;
+	int g = 0;
+	int bl = 0;
+	for (int i = 0; i < samples; i++){
+		sf::Vector2f pixel = randomTrianglePoint(a, b, c, rng);
+		int x = (int)pixel.x;
+		int y = (int)pixel.y;
+		x = x < 0 ? 0 : (x >= (int)size.x ? size.x - 1 : x);
+		y = y < 0 ? 0 : (y >= (int)size.y ? size.y - 1 : y);
+		const sf::Uint8* p = pixels + (y * size.x + x) * 4;
+		r += p[0];
+		g += p[1];
+		bl += p[2];
+	}
+	return sf::Color(r / samples, g / samples, bl / samples, 255);
+}
+
+unsigned polygonSeed(unsigned seed, unsigned index){
+	// splitmix-style scramble so neighbouring indices get unrelated streams
+	unsigned z = seed + 0x9E3779B9u * (index + 1);
+	z = (z ^ (z >> 16)) * 0x85EBCA6Bu;
+	z = (z ^ (z >> 13)) * 0xC2B2AE35u;
+	z ^= z >> 16;
+	// minstd_rand rejects a zero seed
+	return z == 0 ? 1 : z;
+}
+
+void sampleTriangleColors(const sf::Image& img, const std::vector<sf::Vector2f>& corners, const std::vector<int>& index, unsigned seed, int samples,
+	std::vector<sf::Color>& out, std::atomic<int>* done, const CancelToken* cancel, int threads){
+	int count = (int)index.size();
+	out.resize(count);
+	parallelFor((count + SAMPLECHUNK - 1) / SAMPLECHUNK, [&](int chunk){
+		int end = std::min(count, (chunk + 1) * SAMPLECHUNK);
+		for (int i = chunk * SAMPLECHUNK; i < end; i++){
+			SampleRng rng(polygonSeed(seed, index[i]));
+			out[i] = sampleTriangleColor(img, corners[i * 3], corners[i * 3 + 1], corners[i * 3 + 2], samples, rng);
+		}
+		if (done != NULL){
+			*done += end - chunk * SAMPLECHUNK;
+		}
+	}, threads, cancel);
+}
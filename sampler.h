@@ -0,0 +1,30 @@
+#pragma once
+#include "stdafx.h"
+#include "threadpool.h"
+#include <atomic>
+#include <random>
+#include <vector>
+
+// Random number generator used for color sampling. Each thread (or each
+// polygon, for reproducible results) owns its own; nothing here touches
+// the global rand() state, so sampling is safe to run in parallel.
+typedef std::minstd_rand SampleRng;
+
+// Returns a uniformly distributed random point inside the triangle a, b, c.
+sf::Vector2f randomTrianglePoint(const sf::Vector2f& a, const sf::Vector2f& b, const sf::Vector2f& c, SampleRng& rng);
+
+// Returns the average color of img under the triangle a, b, c from random
+// samples. Points outside the image take the color of the nearest edge pixel.
+sf::Color sampleTriangleColor(const sf::Image& img, const sf::Vector2f& a, const sf::Vector2f& b, const sf::Vector2f& c, int samples, SampleRng& rng);
+
+// Seed for polygon index under a base seed, so a polygon gets the same
+// samples no matter which thread or in which order it is processed.
+unsigned polygonSeed(unsigned seed, unsigned index);
+
+// sampleTriangleColor for many triangles at once (corners 3 * i to 3 * i + 2
+// into out[i]), in chunks on the thread pool. Triangle i samples with
+// polygonSeed(seed, index[i]). done, if given, counts the finished triangles
+// for progress displays. Once cancel is cancelled the remaining chunks are
+// skipped and their colors left as they were.
+void sampleTriangleColors(const sf::Image& img, const std::vector<sf::Vector2f>& corners, const std::vector<int>& index, unsigned seed, int samples,
+	std::vector<sf::Color>& out, std::atomic<int>* done = NULL, const CancelToken* cancel = NULL, int threads = 0);
@@ -0,0 +1,303 @@
+#include "stdafx.h"
+#include "seeding.h"
+#include "parallel.h"
+#include "sampler.h"
+#include <algorithm>
+#include <cmath>
+
+// Points per unit area of a saturated Poisson-disk set with minimum
+// distance 1 (random packing gives about 0.7).
+#define SEEDPACKING 0.7f
+// Candidates thrown per expected point
+#define SEEDDARTS 10
+// Box blur radius applied to the gradient, in pixels
+#define SEEDBLUR 2
+// Smallest tile side; tiles are also at least one maximum radius wide
+#define SEEDTILE 64
+
+std::vector<float> detailMap(const sf::Image& img, int threads){
+	int w = (int)img.getSize().x;
+	int h = (int)img.getSize().y;
+	std::vector<float> lum(w * h);
+	std::vector<float> grad(w * h);
+	if (w == 0 || h == 0){
+		return grad;
+	}
+	const sf::Uint8* pixels = img.getPixelsPtr();
+	parallelFor(h, [&](int y){
+		for (int x = 0; x < w; x++){
+			const sf::Uint8* p = pixels + (y * w + x) * 4;
+			lum[y * w + x] = 0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2];
+		}
+	}, threads);
+	parallelFor(h, [&](int y){
+		const float* up = &lum[std::max(y - 1, 0) * w];
+		const float* mid = &lum[y * w];
+		const float* down = &lum[std::min(y + 1, h - 1) * w];
+		for (int x = 0; x < w; x++){
+			int l = std::max(x - 1, 0);
+			int r = std::min(x + 1, w - 1);
+			float gx = (up[r] + 2 * mid[r] + down[r]) - (up[l] + 2 * mid[l] + down[l]);
+			float gy = (down[l] + 2 * down[x] + down[r]) - (up[l] + 2 * up[x] + up[r]);
+			grad[y * w + x] = std::sqrt(gx * gx + gy * gy);
+		}
+	}, threads);
+	// Separable box blur: rows from grad into lum, columns back into grad
+	parallelFor(h, [&](int y){
+		const float* in = &grad[y * w];
+		float* out = &lum[y * w];
+		for (int x = 0; x < w; x++){
+			int l = std::max(x - SEEDBLUR, 0);
+			int r = std::min(x + SEEDBLUR, w - 1);
+			float sum = 0;
+			for (int i = l; i <= r; i++){
+				sum += in[i];
+			}
+			out[x] = sum / (r - l + 1);
+		}
+	}, threads);
+	parallelFor(w, [&](int x){
+		for (int y = 0; y < h; y++){
+			int t = std::max(y - SEEDBLUR, 0);
+			int b = std::min(y + SEEDBLUR, h - 1);
+			float sum = 0;
+			for (int i = t; i <= b; i++){
+				sum += lum[i * w + x];
+			}
+			grad[y * w + x] = sum / (b - t + 1);
+		}
+	}, threads);
+	// Normalize by a high percentile so a few hard edges do not flatten
+	// everything else; the square root lifts soft edges further
+	std::vector<float> sample;
+	int stride = std::max(1, w * h / 65536);
+	for (int i = 0; i < w * h; i += stride){
+		sample.push_back(grad[i]);
+	}
+	std::vector<float>::iterator p99 = sample.begin() + sample.size() * 99 / 100;
+	std::nth_element(sample.begin(), p99, sample.end());
+	float scale = 1.0f / std::max(*p99, 1.0f);
+	parallelFor(h, [&](int y){
+		for (int x = 0; x < w; x++){
+			grad[y * w + x] = std::sqrt(std::min(grad[y * w + x] * scale, 1.0f));
+		}
+	}, threads);
+	return grad;
+}
+
+// A placed point and the distance it keeps to its neighbours.
+struct SeedSample {
+	float x, y, r;
+};
+
+// One sampling pass with a fixed radius scale: the radius at a pixel is
+// scale / sqrt(weight).
+class SeedPass {
+public:
+	SeedPass(const std::vector<float>& _detail, int _w, int _h, const SeedOptions& _options, float _scale);
+	std::vector<sf::Vector2f> run(const std::vector<sf::Vector2f>& existing);
+
+private:
+	float weight(int x, int y) const;
+	float radius(float x, float y) const;
+	bool isFree(const SeedSample& s) const;
+	void add(const SeedSample& s);
+	bool tryAdd(float x, float y);
+	void sampleTile(int tile, std::vector<sf::Vector2f>& out);
+
+	const std::vector<float>& detail;
+	const SeedOptions& options;
+	int w, h;
+	float scale;
+	float minweight;
+	float rmax;
+	// Grid of placed samples; tiles are whole cells so a tile only ever
+	// writes to its own cells
+	float cellsize;
+	int cellsx, cellsy;
+	int cellspertile;
+	int tilesx, tilesy;
+	std::vector<std::vector<SeedSample> > cells;
+};
+
+SeedPass::SeedPass(const std::vector<float>& _detail, int _w, int _h, const SeedOptions& _options, float _scale)
+	: detail(_detail), options(_options), w(_w), h(_h), scale(_scale){
+	minweight = std::max(0.02f, 1.0f - options.contrast);
+	rmax = scale / std::sqrt(minweight);
+	cellsize = std::max(std::floor(scale), 1.0f);
+	cellspertile = (int)std::ceil(std::max(rmax, (float)SEEDTILE) / cellsize);
+	float tile = cellsize * cellspertile;
+	tilesx = std::max(1, (int)std::ceil(w / tile));
+	tilesy = std::max(1, (int)std::ceil(h / tile));
+	// One extra column and row of cells for points on the right/bottom edge
+	cellsx = tilesx * cellspertile + 1;
+	cellsy = tilesy * cellspertile + 1;
+	cells.resize(cellsx * cellsy);
+}
+
+float SeedPass::weight(int x, int y) const {
+	x = std::min(std::max(x, 0), w - 1);
+	y = std::min(std::max(y, 0), h - 1);
+	return minweight + (1 - minweight) * detail[y * w + x];
+}
+
+float SeedPass::radius(float x, float y) const {
+	return scale / std::sqrt(weight((int)x, (int)y));
+}
+
+bool SeedPass::isFree(const SeedSample& s) const {
+	// Two samples conflict when closer than their average radius
+	float reach = (s.r + rmax) / 2;
+	int cx0 = std::max((int)((s.x - reach) / cellsize), 0);
+	int cy0 = std::max((int)((s.y - reach) / cellsize), 0);
+	int cx1 = std::min((int)((s.x + reach) / cellsize), cellsx - 1);
+	int cy1 = std::min((int)((s.y + reach) / cellsize), cellsy - 1);
+	for (int cy = cy0; cy <= cy1; cy++){
+		for (int cx = cx0; cx <= cx1; cx++){
+			for (const SeedSample& o : cells[cy * cellsx + cx]){
+				float dx = o.x - s.x;
+				float dy = o.y - s.y;
+				float d = (o.r + s.r) / 2;
+				if (dx * dx + dy * dy < d * d){
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+void SeedPass::add(const SeedSample& s){
+	int cx = std::min(std::max((int)(s.x / cellsize), 0), cellsx - 1);
+	int cy = std::min(std::max((int)(s.y / cellsize), 0), cellsy - 1);
+	cells[cy * cellsx + cx].push_back(s);
+}
+
+bool SeedPass::tryAdd(float x, float y){
+	SeedSample s = { x, y, radius(x, y) };
+	if (!isFree(s)){
+		return false;
+	}
+	add(s);
+	return true;
+}
+
+void SeedPass::sampleTile(int tile, std::vector<sf::Vector2f>& out){
+	int tsize = (int)(cellsize * cellspertile);
+	int x0 = (tile % tilesx) * tsize;
+	int y0 = (tile / tilesx) * tsize;
+	int x1 = std::min(x0 + tsize, w);
+	int y1 = std::min(y0 + tsize, h);
+	if (x0 >= x1 || y0 >= y1){
+		return;
+	}
+	// Candidates are drawn in proportion to the weight, so detailed areas
+	// fill up without wasting darts on flat ones
+	int tw = x1 - x0;
+	std::vector<double> cdf;
+	cdf.reserve(tw * (y1 - y0));
+	double total = 0;
+	for (int y = y0; y < y1; y++){
+		for (int x = x0; x < x1; x++){
+			total += weight(x, y);
+			cdf.push_back(total);
+		}
+	}
+	double expected = total * SEEDPACKING / (scale * scale);
+	int darts = (int)std::ceil(expected * SEEDDARTS);
+	SampleRng rng(polygonSeed(options.seed, tile));
+	std::uniform_real_distribution<double> pick(0.0, total);
+	std::uniform_real_distribution<float> jitter(0.0f, 1.0f);
+	for (int i = 0; i < darts; i++){
+		int index = (int)(std::upper_bound(cdf.begin(), cdf.end(), pick(rng)) - cdf.begin());
+		index = std::min(index, (int)cdf.size() - 1);
+		float x = x0 + index % tw + jitter(rng);
+		float y = y0 + index / tw + jitter(rng);
+		if (tryAdd(x, y)){
+			out.push_back(sf::Vector2f(x, y));
+		}
+	}
+}
+
+std::vector<sf::Vector2f> SeedPass::run(const std::vector<sf::Vector2f>& existing){
+	std::vector<sf::Vector2f> result;
+	for (const sf::Vector2f& p : existing){
+		SeedSample s = { p.x, p.y, radius(p.x, p.y) };
+		add(s);
+	}
+	if (options.border){
+		float fw = (float)w;
+		float fh = (float)h;
+		sf::Vector2f corners[4] = { sf::Vector2f(0, 0), sf::Vector2f(fw, 0), sf::Vector2f(fw, fh), sf::Vector2f(0, fh) };
+		for (int i = 0; i < 4; i++){
+			if (tryAdd(corners[i].x, corners[i].y)){
+				result.push_back(corners[i]);
+			}
+		}
+		// Walk each edge, stepping by the local radius
+		for (int i = 0; i < 4; i++){
+			sf::Vector2f a = corners[i];
+			sf::Vector2f b = corners[(i + 1) % 4];
+			float length = std::abs(b.x - a.x) + std::abs(b.y - a.y);
+			for (float t = radius(a.x, a.y); t < length; t += radius(a.x + (b.x - a.x) * t / length, a.y + (b.y - a.y) * t / length) / 2){
+				sf::Vector2f p = a + (b - a) * (t / length);
+				if (tryAdd(p.x, p.y)){
+					result.push_back(p);
+				}
+			}
+		}
+	}
+	// Tiles in the same phase are a whole tile apart and a sample never
+	// looks further than one tile, so they can be filled at the same time
+	int tiles = tilesx * tilesy;
+	std::vector<std::vector<sf::Vector2f> > tilepoints(tiles);
+	for (int phase = 0; phase < 4; phase++){
+		std::vector<int> list;
+		for (int t = 0; t < tiles; t++){
+			if (((t % tilesx) & 1) + ((t / tilesx) & 1) * 2 == phase){
+				list.push_back(t);
+			}
+		}
+		parallelFor((int)list.size(), [&](int i){
+			sampleTile(list[i], tilepoints[list[i]]);
+		}, options.threads);
+	}
+	for (const std::vector<sf::Vector2f>& points : tilepoints){
+		result.insert(result.end(), points.begin(), points.end());
+	}
+	return result;
+}
+
+std::vector<sf::Vector2f> seedPoints(const sf::Image& img, const SeedOptions& options, const std::vector<sf::Vector2f>& existing){
+	int w = (int)img.getSize().x;
+	int h = (int)img.getSize().y;
+	if (options.count <= 0 || w == 0 || h == 0){
+		return std::vector<sf::Vector2f>();
+	}
+	std::vector<float> detail = detailMap(img, options.threads);
+	float minweight = std::max(0.02f, 1.0f - options.contrast);
+	double sum = 0;
+	for (float d : detail){
+		sum += minweight + (1 - minweight) * d;
+	}
+	// Radius scale that fits count points at the packing density, then one
+	// correction from what the first pass actually produced
+	float scale = (float)std::sqrt(SEEDPACKING * sum / options.count);
+	std::vector<sf::Vector2f> points = SeedPass(detail, w, h, options, scale).run(existing);
+	float ratio = points.size() / (float)options.count;
+	if (ratio < 0.95f || ratio > 1.05f){
+		scale *= std::sqrt(std::max(ratio, 0.01f));
+		points = SeedPass(detail, w, h, options, scale).run(existing);
+	}
+	if ((int)points.size() > options.count){
+		// Drop a few at random; the corners come first and are kept
+		SampleRng rng(options.seed);
+		std::vector<sf::Vector2f>::iterator first = points.begin();
+		if (options.border){
+			first += std::min((int)points.size(), 4);
+		}
+		std::shuffle(first, points.end(), rng);
+		points.resize(options.count);
+	}
+	return points;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "stdafx.h"
+#include <vector>
+
+// Automatic point placement: more points where the image has detail.
+struct SeedOptions {
+	int   count    = 2000;  // Target number of points, border points included
+	float contrast = 0.8f;  // 0 spreads points evenly, 1 puts nearly all of them on edges
+	bool  border   = true;  // Place points along the image border and on its corners
+	unsigned seed  = 1;
+	int   threads  = 0;     // 0 uses every core
+};
+
+// Sobel gradient magnitude of the image luminance, lightly blurred and
+// normalized to [0, 1]. One float per pixel, row major.
+std::vector<float> detailMap(const sf::Image& img, int threads = 0);
+
+// Places about options.count points by density-weighted Poisson-disk
+// sampling: points keep a minimum distance from each other that shrinks
+// where the detail map is high. Points in existing keep their surroundings
+// free. The image is sampled in tiles, four non-touching sets of tiles at a
+// time, so the result only depends on the options and not on the number of
+// threads.
+std::vector<sf::Vector2f> seedPoints(const sf::Image& img, const SeedOptions& options,
+	const std::vector<sf::Vector2f>& existing = std::vector<sf::Vector2f>());
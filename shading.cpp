@@ -0,0 +1,187 @@
+#include "stdafx.h"
+#include "shading.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+
+// Below this change in color across the whole triangle a gradient is not
+// worth writing out
+#define MINGRADIENT 0.5
+// Most Gauss-Seidel sweeps when fitting the point colors, and the largest
+// change in any channel (0-255) that still counts as converged
+#define SHADINGSWEEPS 50
+#define SHADINGTOLERANCE 0.05
+
+struct Moments {
+	double mass[3][3];
+	double color[3][3];
+};
+
+std::vector<int> sampleVertexColors(Document& doc, const ColorStats& stats, int threads){
+	int npoints = (int)doc.points.size();
+	std::vector<int> polys;
+	for (unsigned t = 0; t < doc.polygons.size(); t++){
+		const DocPoly& p = doc.polygons[t];
+		if (p.sa[0] >= 0 && p.sa[1] >= 0 && p.sa[2] >= 0 && p.sa[0] < npoints && p.sa[1] < npoints && p.sa[2] < npoints){
+			polys.push_back(t);
+		}
+	}
+	// Barycentric pixel sums per polygon, the expensive part
+	std::vector<Moments> moments(polys.size());
+	parallelFor((int)polys.size(), [&](int k){
+		const DocPoly& p = doc.polygons[polys[k]];
+		stats.cornerSums(doc.points[p.sa[0]].vector, doc.points[p.sa[1]].vector, doc.points[p.sa[2]].vector, moments[k].mass, moments[k].color);
+	}, threads);
+
+	// Polygons around each point, and the plain mean over them to start from
+	std::vector<int> first(npoints + 1, 0);
+	for (int t : polys){
+		for (int j = 0; j < 3; j++){
+			first[doc.polygons[t].sa[j] + 1]++;
+		}
+	}
+	for (int i = 0; i < npoints; i++){
+		first[i + 1] += first[i];
+	}
+	std::vector<int> ring(first[npoints]);
+	std::vector<int> fill(first.begin(), first.end() - 1);
+	std::vector<double> sums(npoints * 4, 0);
+	std::vector<double> fills(npoints * 4, 0);
+	for (int k = 0; k < (int)polys.size(); k++){
+		const DocPoly& p = doc.polygons[polys[k]];
+		const Moments& m = moments[k];
+		double count = 0;
+		double color[3] = { 0, 0, 0 };
+		for (int i = 0; i < 3; i++){
+			for (int j = 0; j < 3; j++){
+				count += m.mass[i][j];
+				color[j] += m.color[i][j];
+			}
+		}
+		for (int j = 0; j < 3; j++){
+			int v = p.sa[j];
+			ring[fill[v]++] = k;
+			for (int ch = 0; ch < 3; ch++){
+				sums[v * 4 + ch] += color[ch];
+			}
+			sums[v * 4 + 3] += count;
+			// Fill colors stand in for rings too small to cover a pixel center
+			fills[v * 4] += p.fillcolor.r;
+			fills[v * 4 + 1] += p.fillcolor.g;
+			fills[v * 4 + 2] += p.fillcolor.b;
+			fills[v * 4 + 3] += 1;
+		}
+	}
+	std::vector<double> colors(npoints * 3, 0);
+	for (int v = 0; v < npoints; v++){
+		const double* s = sums[v * 4 + 3] > 0 ? &sums[v * 4] : &fills[v * 4];
+		for (int ch = 0; ch < 3; ch++){
+			colors[v * 3 + ch] = s[3] > 0 ? s[ch] / s[3] : 0;
+		}
+	}
+
+	// Gauss-Seidel on the normal equations: each point takes the color that
+	// best fits its ring's pixels given its neighbours' colors
+	for (int sweep = 0; sweep < SHADINGSWEEPS; sweep++){
+		double moved = 0;
+		for (int v = 0; v < npoints; v++){
+			double diagonal = 0;
+			double rhs[3] = { 0, 0, 0 };
+			for (int r = first[v]; r < first[v + 1]; r++){
+				const DocPoly& p = doc.polygons[polys[ring[r]]];
+				const Moments& m = moments[ring[r]];
+				int i = p.sa[0] == v ? 0 : p.sa[1] == v ? 1 : 2;
+				diagonal += m.mass[i][i];
+				for (int ch = 0; ch < 3; ch++){
+					rhs[ch] += m.color[i][ch];
+				}
+				for (int j = 0; j < 3; j++){
+					if (j != i){
+						for (int ch = 0; ch < 3; ch++){
+							rhs[ch] -= m.mass[i][j] * colors[p.sa[j] * 3 + ch];
+						}
+					}
+				}
+			}
+			if (diagonal <= 0){
+				continue;
+			}
+			for (int ch = 0; ch < 3; ch++){
+				double c = std::max(0.0, std::min(255.0, rhs[ch] / diagonal));
+				moved = std::max(moved, std::abs(c - colors[v * 3 + ch]));
+				colors[v * 3 + ch] = c;
+			}
+		}
+		if (moved < SHADINGTOLERANCE){
+			break;
+		}
+	}
+
+	std::vector<int> changed;
+	for (int v = 0; v < npoints; v++){
+		if (first[v + 1] == first[v]){
+			continue;
+		}
+		sf::Color color((sf::Uint8)std::lround(colors[v * 3]), (sf::Uint8)std::lround(colors[v * 3 + 1]), (sf::Uint8)std::lround(colors[v * 3 + 2]));
+		if (color != doc.points[v].color){
+			doc.points[v].color = color;
+			changed.push_back(v);
+		}
+	}
+	return changed;
+}
+
+bool gouraudGradient(const sf::Vector2f* v, const sf::Color* c, LinearGradient& out){
+	double ex = v[1].x - v[0].x, ey = v[1].y - v[0].y;
+	double fx = v[2].x - v[0].x, fy = v[2].y - v[0].y;
+	double det = ex * fy - ey * fx;
+	if (det == 0){
+		return false;
+	}
+	// Gradient of each channel, then the direction that carries most of
+	// their combined change: the main eigenvector of the sum of g g^T
+	double g[3][2];
+	double sxx = 0, sxy = 0, syy = 0;
+	double mean[3];
+	for (int ch = 0; ch < 3; ch++){
+		double c0 = ch == 0 ? c[0].r : ch == 1 ? c[0].g : c[0].b;
+		double c1 = ch == 0 ? c[1].r : ch == 1 ? c[1].g : c[1].b;
+		double c2 = ch == 0 ? c[2].r : ch == 1 ? c[2].g : c[2].b;
+		double du = c1 - c0, dv = c2 - c0;
+		g[ch][0] = (du * fy - dv * ey) / det;
+		g[ch][1] = (dv * ex - du * fx) / det;
+		sxx += g[ch][0] * g[ch][0];
+		sxy += g[ch][0] * g[ch][1];
+		syy += g[ch][1] * g[ch][1];
+		mean[ch] = (c0 + c1 + c2) / 3;
+	}
+	double angle = 0.5 * std::atan2(2 * sxy, sxx - syy);
+	double dx = std::cos(angle), dy = std::sin(angle);
+	double cx = (v[0].x + v[1].x + v[2].x) / 3.0;
+	double cy = (v[0].y + v[1].y + v[2].y) / 3.0;
+	double tmin = 0, tmax = 0;
+	for (int j = 0; j < 3; j++){
+		double t = (v[j].x - cx) * dx + (v[j].y - cy) * dy;
+		tmin = std::min(tmin, t);
+		tmax = std::max(tmax, t);
+	}
+	double slope[3];
+	double change = 0;
+	for (int ch = 0; ch < 3; ch++){
+		slope[ch] = g[ch][0] * dx + g[ch][1] * dy;
+		change = std::max(change, std::abs(slope[ch]) * (tmax - tmin));
+	}
+	if (change < MINGRADIENT){
+		return false;
+	}
+	double a[3], b[3];
+	for (int ch = 0; ch < 3; ch++){
+		a[ch] = std::max(0.0, std::min(255.0, mean[ch] + slope[ch] * tmin));
+		b[ch] = std::max(0.0, std::min(255.0, mean[ch] + slope[ch] * tmax));
+	}
+	out.from = sf::Vector2f((float)(cx + dx * tmin), (float)(cy + dy * tmin));
+	out.to = sf::Vector2f((float)(cx + dx * tmax), (float)(cy + dy * tmax));
+	out.start = sf::Color((sf::Uint8)std::lround(a[0]), (sf::Uint8)std::lround(a[1]), (sf::Uint8)std::lround(a[2]));
+	out.end = sf::Color((sf::Uint8)std::lround(b[0]), (sf::Uint8)std::lround(b[1]), (sf::Uint8)std::lround(b[2]));
+	return true;
+}
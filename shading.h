@@ -0,0 +1,28 @@
+#pragma once
+#include "stdafx.h"
+#include "colorstats.h"
+#include "document.h"
+#include <vector>
+
+// Samples a color for every point a polygon uses, for Document::gouraud,
+// where point colors are blended across each polygon instead of filling it
+// with its own color. Each point starts from the mean image color over its
+// one-ring (all pixels of the polygons around it, so larger polygons count
+// more); then the colors are fitted by least squares so the blended
+// polygons match the image as closely as they can. Points no polygon uses
+// keep their color. Returns the points whose color changed.
+std::vector<int> sampleVertexColors(Document& doc, const ColorStats& stats, int threads = 0);
+
+// A two stop SVG linear gradient.
+struct LinearGradient {
+	sf::Vector2f from, to;
+	sf::Color start, end;
+};
+
+// Gouraud shading changes each color channel linearly across a triangle,
+// but every channel may change in its own direction while an SVG gradient
+// has just one. This picks the direction most of the change happens along
+// (least squares over the channels) and keeps the mean color at the
+// centroid, so a triangle whose channels change the same way comes out
+// exact. Returns false if the color hardly changes across the triangle.
+bool gouraudGradient(const sf::Vector2f* v, const sf::Color* c, LinearGradient& out);
@@ -0,0 +1,499 @@
+#include "stdafx.h"
+#include "simplify.h"
+#include "shading.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+// Points within this distance (in pixels) of an image edge, or of the line
+// through their outline neighbours, are treated as lying on it
+#define SIMPLIFYSNAP 0.01
+
+#define BORDERLEFT   1
+#define BORDERRIGHT  2
+#define BORDERTOP    4
+#define BORDERBOTTOM 8
+
+// Summed squared distance to a set of weighted lines (Garland-Heckbert in 2D)
+struct LineQuadric {
+	double xx = 0, xy = 0, x = 0, yy = 0, y = 0, c = 0;
+
+	void addLine(double ax, double ay, double bx, double by, double weight){
+		double dx = bx - ax;
+		double dy = by - ay;
+		double len = std::sqrt(dx * dx + dy * dy);
+		if (len <= 0){
+			return;
+		}
+		double nx = -dy / len;
+		double ny = dx / len;
+		double nc = -(nx * ax + ny * ay);
+		xx += weight * nx * nx;
+		xy += weight * nx * ny;
+		x  += weight * nx * nc;
+		yy += weight * ny * ny;
+		y  += weight * ny * nc;
+		c  += weight * nc * nc;
+	}
+	void add(const LineQuadric& q){
+		xx += q.xx; xy += q.xy; x += q.x;
+		yy += q.yy; y += q.y; c += q.c;
+	}
+	double eval(double px, double py) const {
+		double e = xx * px * px + 2 * xy * px * py + 2 * x * px + yy * py * py + 2 * y * py + c;
+		return e > 0 ? e : 0;
+	}
+};
+
+class Simplifier {
+public:
+	Simplifier(const Document& _doc, const ColorStats& _stats, const SimplifyOptions& _options);
+	void run();
+	Document result(SimplifyStats* out) const;
+
+private:
+	struct Entry {
+		double cost;
+		int u, v;
+		unsigned version;
+		// Cheapest collapse on top of the heap
+		bool operator<(const Entry& other) const { return cost > other.cost; }
+	};
+
+	double orient(int a, int b, int c) const;
+	double triangleError(int a, int b, int c) const;
+	// Drops dead triangles from the list of triangles around v.
+	void compact(int v);
+	// Neighbours of v and how many of its triangles each one shares.
+	void neighbours(int v, std::vector<std::pair<int, int> >& out) const;
+	// Whether u may move onto v without folding a triangle or pinching the mesh.
+	bool allowed(int u, int v, const std::vector<std::pair<int, int> >& nu);
+	// Change in color error plus the quadric of moving u onto v.
+	double cost(int u, int v);
+	// Finds the cheapest collapse of u and queues it.
+	void evaluate(int u);
+	// Queues u to be evaluated again once it comes up, at its old cost.
+	void invalidate(int u);
+	void collapse(int u, int v);
+
+	const Document& doc;
+	const ColorStats& stats;
+	SimplifyOptions options;
+
+	std::vector<double> px, py;
+	std::vector<int>  mask;      // BORDER* flags of the image edges a point lies on
+	std::vector<bool> fixed;     // Never moved (non-manifold or degenerate surroundings)
+	std::vector<bool> outline;   // On the outline of the mesh
+	std::vector<bool> removed;
+	std::vector<unsigned> version;
+	std::vector<double>   best;      // Cost of the collapse last queued for each point
+	std::vector<LineQuadric> quadrics;
+	std::vector<std::vector<int> > vtris; // Triangles around each point, may hold dead ones
+
+	std::vector<std::array<int, 3> > tris;
+	std::vector<int>    polyof;  // Document polygon of each triangle
+	std::vector<bool>   alive;
+	std::vector<bool>   touched; // Reshaped, so its color is recomputed
+	std::vector<double> error;
+	int count = 0;
+	int collapses = 0;
+	double before = 0;
+
+	std::priority_queue<Entry> heap;
+	std::vector<std::pair<int, int> > scratch;
+	std::vector<unsigned> seen; // Stamps for the link condition
+	unsigned stamp = 0;
+	double current = 0; // Cost of the last collapse
+};
+
+Simplifier::Simplifier(const Document& _doc, const ColorStats& _stats, const SimplifyOptions& _options)
+	: doc(_doc), stats(_stats), options(_options){
+	int n = (int)doc.points.size();
+	px.resize(n);
+	py.resize(n);
+	mask.assign(n, 0);
+	fixed.assign(n, false);
+	outline.assign(n, false);
+	removed.assign(n, false);
+	version.assign(n, 0);
+	best.assign(n, 0);
+	seen.assign(n, 0);
+	quadrics.resize(n);
+	vtris.resize(n);
+	double w = doc.size.x;
+	double h = doc.size.y;
+	for (int i = 0; i < n; i++){
+		px[i] = doc.points[i].vector.x;
+		py[i] = doc.points[i].vector.y;
+		if (w > 0 && h > 0){
+			mask[i] |= std::fabs(px[i]) <= SIMPLIFYSNAP ? BORDERLEFT : 0;
+			mask[i] |= std::fabs(px[i] - w) <= SIMPLIFYSNAP ? BORDERRIGHT : 0;
+			mask[i] |= std::fabs(py[i]) <= SIMPLIFYSNAP ? BORDERTOP : 0;
+			mask[i] |= std::fabs(py[i] - h) <= SIMPLIFYSNAP ? BORDERBOTTOM : 0;
+		}
+	}
+
+	// Polygons with bad indices cannot be drawn and are left out
+	for (unsigned i = 0; i < doc.polygons.size(); i++){
+		const DocPoly& p = doc.polygons[i];
+		int a = p.sa[0];
+		int b = p.sa[1];
+		int c = p.sa[2];
+		if (a < 0 || b < 0 || c < 0 || a >= n || b >= n || c >= n || a == b || b == c || a == c){
+			continue;
+		}
+		double o = orient(a, b, c);
+		if (o == 0){
+			fixed[a] = fixed[b] = fixed[c] = true;
+		}
+		else if (o < 0){
+			std::swap(b, c);
+		}
+		std::array<int, 3> t = {{ a, b, c }};
+		tris.push_back(t);
+		polyof.push_back(i);
+	}
+	count = (int)tris.size();
+	alive.assign(count, true);
+	touched.assign(count, false);
+	error.resize(count);
+
+	// Directed edges: a neighbour runs an edge backwards, so an edge seen
+	// twice the same way means overlapping polygons
+	std::unordered_map<unsigned long long, std::pair<int, int> > edges;
+	edges.reserve(count * 3);
+	for (int t = 0; t < count; t++){
+		for (int i = 0; i < 3; i++){
+			unsigned long long a = tris[t][i];
+			unsigned long long b = tris[t][(i + 1) % 3];
+			std::pair<int, int>& e = edges[(a << 32) | b];
+			e.first++;
+			e.second = t;
+		}
+	}
+	for (int t = 0; t < count; t++){
+		for (int i = 0; i < 3; i++){
+			int a = tris[t][i];
+			int b = tris[t][(i + 1) % 3];
+			const std::pair<int, int>& mine = edges[((unsigned long long)a << 32) | b];
+			std::unordered_map<unsigned long long, std::pair<int, int> >::const_iterator other = edges.find(((unsigned long long)b << 32) | a);
+			if (mine.first > 1 || (other != edges.end() && other->second.first > 1)){
+				fixed[a] = fixed[b] = true;
+			}
+			else if (other == edges.end()){
+				outline[a] = outline[b] = true;
+			}
+			else if (a < b){
+				// An edge of the artwork weighs by the color change across it
+				sf::Color c0 = doc.polygons[polyof[t]].fillcolor;
+				sf::Color c1 = doc.polygons[polyof[other->second.second]].fillcolor;
+				double dr = c0.r - c1.r;
+				double dg = c0.g - c1.g;
+				double db = c0.b - c1.b;
+				double weight = (dr * dr + dg * dg + db * db) * options.geometry;
+				if (weight > 0){
+					quadrics[a].addLine(px[a], py[a], px[b], py[b], weight);
+					quadrics[b].addLine(px[a], py[a], px[b], py[b], weight);
+				}
+			}
+		}
+		for (int i = 0; i < 3; i++){
+			vtris[tris[t][i]].push_back(t);
+		}
+		error[t] = triangleError(tris[t][0], tris[t][1], tris[t][2]);
+		before += error[t];
+	}
+}
+
+double Simplifier::orient(int a, int b, int c) const {
+	return (px[b] - px[a]) * (py[c] - py[a]) - (py[b] - py[a]) * (px[c] - px[a]);
+}
+
+double Simplifier::triangleError(int a, int b, int c) const {
+	return stats.triangle(sf::Vector2f((float)px[a], (float)py[a]),
+		sf::Vector2f((float)px[b], (float)py[b]),
+		sf::Vector2f((float)px[c], (float)py[c])).error();
+}
+
+void Simplifier::compact(int v){
+	std::vector<int>& list = vtris[v];
+	unsigned out = 0;
+	for (unsigned i = 0; i < list.size(); i++){
+		if (alive[list[i]]){
+			list[out++] = list[i];
+		}
+	}
+	list.resize(out);
+}
+
+void Simplifier::neighbours(int v, std::vector<std::pair<int, int> >& out) const {
+	out.clear();
+	for (int t : vtris[v]){
+		for (int i = 0; i < 3; i++){
+			int w = tris[t][i];
+			if (w == v){
+				continue;
+			}
+			unsigned k = 0;
+			while (k < out.size() && out[k].first != w){
+				k++;
+			}
+			if (k == out.size()){
+				out.push_back(std::make_pair(w, 0));
+			}
+			out[k].second++;
+		}
+	}
+}
+
+bool Simplifier::allowed(int u, int v, const std::vector<std::pair<int, int> >& nu){
+	if ((mask[u] & ~mask[v]) != 0){
+		return false;
+	}
+	// Link condition: the points next to both u and v must be exactly the
+	// tips of the triangles on edge uv, or the collapse pinches the mesh
+	int shared = 0;
+	for (int t : vtris[u]){
+		if (tris[t][0] == v || tris[t][1] == v || tris[t][2] == v){
+			shared++;
+		}
+	}
+	if (shared == 0){
+		return false;
+	}
+	compact(v);
+	stamp++;
+	for (const std::pair<int, int>& w : nu){
+		seen[w.first] = stamp;
+	}
+	int common = 0;
+	for (int t : vtris[v]){
+		for (int i = 0; i < 3; i++){
+			int w = tris[t][i];
+			if (w != v && seen[w] == stamp){
+				// Counted once
+				seen[w] = 0;
+				common++;
+			}
+		}
+	}
+	if (common != shared){
+		return false;
+	}
+	for (int t : vtris[u]){
+		std::array<int, 3> tr = tris[t];
+		if (tr[0] == v || tr[1] == v || tr[2] == v){
+			continue;
+		}
+		for (int i = 0; i < 3; i++){
+			tr[i] = tr[i] == u ? v : tr[i];
+		}
+		// Would fold over (or flatten)
+		if (orient(tr[0], tr[1], tr[2]) <= 0){
+			return false;
+		}
+	}
+	return true;
+}
+
+double Simplifier::cost(int u, int v){
+	double old = 0;
+	double now = 0;
+	for (int t : vtris[u]){
+		std::array<int, 3> tr = tris[t];
+		old += error[t];
+		if (tr[0] == v || tr[1] == v || tr[2] == v){
+			continue;
+		}
+		for (int i = 0; i < 3; i++){
+			tr[i] = tr[i] == u ? v : tr[i];
+		}
+		now += triangleError(tr[0], tr[1], tr[2]);
+	}
+	return now - old + quadrics[u].eval(px[v], py[v]);
+}
+
+void Simplifier::evaluate(int u){
+	version[u]++;
+	if (removed[u] || fixed[u]){
+		return;
+	}
+	compact(u);
+	std::vector<std::pair<int, int> > nu;
+	neighbours(u, nu);
+	if (nu.empty()){
+		return;
+	}
+	std::vector<int> candidates;
+	if (outline[u]){
+		// Only slide along the outline, and only off a straight stretch of it
+		for (const std::pair<int, int>& w : nu){
+			if (w.second == 1){
+				candidates.push_back(w.first);
+			}
+		}
+		if (candidates.size() != 2){
+			return;
+		}
+		int p = candidates[0];
+		int q = candidates[1];
+		double len = std::sqrt((px[q] - px[p]) * (px[q] - px[p]) + (py[q] - py[p]) * (py[q] - py[p]));
+		if (len <= 0 || std::fabs(orient(p, q, u)) / len > SIMPLIFYSNAP){
+			return;
+		}
+	}
+	else {
+		for (const std::pair<int, int>& w : nu){
+			// Every edge inside the mesh has a triangle on both sides
+			if (w.second != 2){
+				return;
+			}
+			candidates.push_back(w.first);
+		}
+	}
+	Entry e = { 0, u, -1, version[u] };
+	for (int v : candidates){
+		if (!allowed(u, v, nu)){
+			continue;
+		}
+		double c = cost(u, v);
+		if (e.v < 0 || c < e.cost){
+			e.cost = c;
+			e.v = v;
+		}
+	}
+	if (e.v >= 0){
+		best[u] = e.cost;
+		heap.push(e);
+	}
+	else {
+		// Nothing allowed now; look again if its surroundings change
+		best[u] = current;
+	}
+}
+
+void Simplifier::invalidate(int u){
+	version[u]++;
+	if (removed[u] || fixed[u]){
+		return;
+	}
+	Entry e = { std::max(best[u], current), u, -1, version[u] };
+	heap.push(e);
+}
+
+void Simplifier::collapse(int u, int v){
+	for (int t : vtris[u]){
+		std::array<int, 3>& tr = tris[t];
+		if (tr[0] == v || tr[1] == v || tr[2] == v){
+			alive[t] = false;
+			count--;
+			continue;
+		}
+		for (int i = 0; i < 3; i++){
+			tr[i] = tr[i] == u ? v : tr[i];
+		}
+		touched[t] = true;
+		error[t] = triangleError(tr[0], tr[1], tr[2]);
+		vtris[v].push_back(t);
+	}
+	vtris[u].clear();
+	removed[u] = true;
+	quadrics[v].add(quadrics[u]);
+	collapses++;
+	// Every point whose surroundings changed is looked at again when its
+	// old cost comes up, so a point next to many collapses is scored once
+	compact(v);
+	neighbours(v, scratch);
+	invalidate(v);
+	for (const std::pair<int, int>& w : scratch){
+		invalidate(w.first);
+	}
+}
+
+void Simplifier::run(){
+	for (int u = 0; u < (int)px.size(); u++){
+		evaluate(u);
+	}
+	std::vector<std::pair<int, int> > nu;
+	while (count > options.triangles && !heap.empty()){
+		Entry e = heap.top();
+		heap.pop();
+		if (removed[e.u] || version[e.u] != e.version){
+			continue;
+		}
+		current = e.cost;
+		if (e.v < 0 || removed[e.v]){
+			evaluate(e.u);
+			continue;
+		}
+		// A collapse next to v may have changed what v allows since this
+		// entry was queued
+		compact(e.u);
+		neighbours(e.u, nu);
+		if (!allowed(e.u, e.v, nu)){
+			evaluate(e.u);
+			continue;
+		}
+		collapse(e.u, e.v);
+	}
+}
+
+Document Simplifier::result(SimplifyStats* out) const {
+	Document result;
+	result.size = doc.size;
+	result.palette = doc.palette;
+	result.gouraud = doc.gouraud;
+	std::vector<int> remap(px.size(), -1);
+	for (int t = 0; t < (int)tris.size(); t++){
+		if (alive[t]){
+			for (int i = 0; i < 3; i++){
+				remap[tris[t][i]] = 0;
+			}
+		}
+	}
+	for (unsigned i = 0; i < remap.size(); i++){
+		if (remap[i] == 0){
+			remap[i] = (int)result.points.size();
+			result.points.push_back(doc.points[i]);
+		}
+	}
+	double after = 0;
+	for (int t = 0; t < (int)tris.size(); t++){
+		if (!alive[t]){
+			continue;
+		}
+		const std::array<int, 3>& tr = tris[t];
+		DocPoly p;
+		for (int i = 0; i < 3; i++){
+			p.sa[i] = remap[tr[i]];
+		}
+		p.fillcolor = doc.polygons[polyof[t]].fillcolor;
+		if (touched[t]){
+			p.fillcolor = stats.triangle(sf::Vector2f((float)px[tr[0]], (float)py[tr[0]]),
+				sf::Vector2f((float)px[tr[1]], (float)py[tr[1]]),
+				sf::Vector2f((float)px[tr[2]], (float)py[tr[2]])).mean();
+		}
+		result.polygons.push_back(p);
+		after += error[t];
+	}
+	// The points that are left cover larger areas now
+	if (result.gouraud){
+		sampleVertexColors(result, stats);
+	}
+	if (out != NULL){
+		out->collapses = collapses;
+		out->triangles = count;
+		out->before = before;
+		out->after = after;
+	}
+	return result;
+}
+
+Document simplifyDocument(const Document& doc, const ColorStats& stats, const SimplifyOptions& options, SimplifyStats* result){
+	Simplifier simplifier(doc, stats, options);
+	simplifier.run();
+	return simplifier.result(result);
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include "stdafx.h"
+#include "colorstats.h"
+#include "document.h"
+
+struct SimplifyOptions {
+	int   triangles = 5000;  // Stop once the mesh is down to this many triangles
+	float geometry  = 1.0f;  // Weight of the edge quadrics against the color error
+};
+
+struct SimplifyStats {
+	int collapses = 0;
+	int triangles = 0;   // Triangles left
+	double before = 0;   // Total squared color error against the image
+	double after = 0;
+};
+
+// Returns a copy of doc reduced to about options.triangles polygons by
+// collapsing edges, cheapest first. The cost of moving a vertex onto a
+// neighbour is the exact change in squared color error of the triangles
+// around it plus a quadric (summed squared distance to the lines of the
+// edges it has absorbed, weighted by the color contrast across them), so
+// strong edges of the artwork stay put. Collapses that would fold a
+// triangle or pinch the mesh are skipped; points on the mesh outline or
+// the image border only slide along it, and corners never move.
+// Polygons keep their draw order; reshaped ones get their mean color.
+Document simplifyDocument(const Document& doc, const ColorStats& stats, const SimplifyOptions& options, SimplifyStats* result = NULL);
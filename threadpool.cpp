@@ -0,0 +1,251 @@
+#include "stdafx.h"
+#include "threadpool.h"
+#include "parallel.h"
+#include "trace.h"
+#include <cstdio>
+
+// Which worker of which pool the current thread is, -1 outside any pool
+static thread_local const ThreadPool* currentpool = NULL;
+static thread_local int currentworker = -1;
+
+static std::mutex sharedlock;
+static std::unique_ptr<ThreadPool> sharedpool;
+static int sharedthreads = 0;
+
+TaskGroup::TaskGroup(ThreadPool& _pool) : pool(_pool), pending(0), queued(0) {
+}
+
+TaskGroup::~TaskGroup(){
+	wait();
+}
+
+void TaskGroup::run(const std::function<void()>& task){
+	pending++;
+	ThreadPool::Task t = { task, this };
+	pool.push(t);
+}
+
+void TaskGroup::wait(){
+	int self = currentpool == &pool ? currentworker : -1;
+	for (;;){
+		ThreadPool::Task task;
+		if (pool.takeOwn(self, this, task)){
+			pool.execute(task);
+			continue;
+		}
+		// Checked under the lock, so the thread finishing the last task is
+		// done with the group before this returns and it can be destroyed
+		std::unique_lock<std::mutex> guard(lock);
+		done.wait(guard, [this](){ return pending == 0 || queued > 0; });
+		if (pending == 0){
+			return;
+		}
+	}
+}
+
+ThreadPool::ThreadPool(int count) : queued(0), dealt(0), tasks(0), steals(0) {
+	started = std::chrono::steady_clock::now();
+	for (int i = 0; i < count; i++){
+		workers.push_back(std::unique_ptr<Worker>(new Worker()));
+	}
+	for (int i = 0; i < count; i++){
+		workers[i]->thread = std::thread(&ThreadPool::loop, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool(){
+	{
+		std::lock_guard<std::mutex> lock(sleeplock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::unique_ptr<Worker>& worker : workers){
+		worker->thread.join();
+	}
+}
+
+void ThreadPool::push(const Task& task){
+	if (workers.empty()){
+		// Nobody to hand it to, the waiting thread runs it
+		Task t = task;
+		execute(t);
+		return;
+	}
+	int self = currentpool == this ? currentworker : -1;
+	Worker& worker = *workers[self >= 0 ? self : dealt++ % workers.size()];
+	{
+		// Queued and counted in one step, so a waiting thread woken by
+		// this finds the task. The group is alive until its task has run.
+		std::lock_guard<std::mutex> grouplock(task.group->lock);
+		{
+			std::lock_guard<std::mutex> lock(worker.lock);
+			worker.tasks.push_back(task);
+		}
+		queued++;
+		task.group->queued++;
+		task.group->done.notify_all();
+	}
+	std::lock_guard<std::mutex> lock(sleeplock);
+	wake.notify_one();
+}
+
+bool ThreadPool::take(int self, Task& task){
+	if (queued == 0){
+		return false;
+	}
+	int n = (int)workers.size();
+	if (self >= 0){
+		Worker& own = *workers[self];
+		std::lock_guard<std::mutex> lock(own.lock);
+		if (!own.tasks.empty()){
+			task = own.tasks.back();
+			own.tasks.pop_back();
+			queued--;
+			task.group->queued--;
+			return true;
+		}
+	}
+	int start = self >= 0 ? self + 1 : (int)(dealt % n);
+	for (int k = 0; k < n; k++){
+		int victim = (start + k) % n;
+		if (victim == self){
+			continue;
+		}
+		Worker& other = *workers[victim];
+		std::lock_guard<std::mutex> lock(other.lock);
+		if (!other.tasks.empty()){
+			task = other.tasks.front();
+			other.tasks.pop_front();
+			queued--;
+			task.group->queued--;
+			if (self >= 0){
+				steals++;
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+// Like take, but only a task of group: the newest from the caller's own
+// deque, otherwise the oldest found in another one.
+bool ThreadPool::takeOwn(int self, const TaskGroup* group, Task& task){
+	if (group->queued <= 0){
+		return false;
+	}
+	int n = (int)workers.size();
+	int start = self >= 0 ? self : 0;
+	for (int k = 0; k < n; k++){
+		int victim = (start + k) % n;
+		Worker& worker = *workers[victim];
+		std::lock_guard<std::mutex> lock(worker.lock);
+		if (victim == self){
+			for (std::deque<Task>::reverse_iterator it = worker.tasks.rbegin(); it != worker.tasks.rend(); ++it){
+				if (it->group == group){
+					task = *it;
+					worker.tasks.erase(std::next(it).base());
+					queued--;
+					task.group->queued--;
+					return true;
+				}
+			}
+			continue;
+		}
+		for (std::deque<Task>::iterator it = worker.tasks.begin(); it != worker.tasks.end(); ++it){
+			if (it->group == group){
+				task = *it;
+				worker.tasks.erase(it);
+				queued--;
+				task.group->queued--;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void ThreadPool::execute(Task& task){
+	{
+		TraceScope scope("Task", "pool");
+		task.fn();
+	}
+	tasks++;
+	TaskGroup* group = task.group;
+	std::lock_guard<std::mutex> lock(group->lock);
+	if (--group->pending == 0){
+		group->done.notify_all();
+	}
+}
+
+void ThreadPool::loop(int self){
+	currentpool = this;
+	currentworker = self;
+	Tracer::nameThread("Pool worker " + std::to_string(self + 1));
+	Worker& worker = *workers[self];
+	for (;;){
+		Task task;
+		if (take(self, task)){
+			std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+			execute(task);
+			worker.busy += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleeplock);
+		wake.wait(lock, [this](){ return stopping || queued > 0; });
+		if (stopping){
+			return;
+		}
+	}
+}
+
+PoolStats ThreadPool::stats() const {
+	PoolStats stats;
+	stats.workers = (int)workers.size();
+	stats.tasks = tasks;
+	stats.steals = steals;
+	stats.uptime = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+	for (const std::unique_ptr<Worker>& worker : workers){
+		stats.busy.push_back(worker->busy / 1e9);
+	}
+	return stats;
+}
+
+ThreadPool& ThreadPool::shared(){
+	std::lock_guard<std::mutex> lock(sharedlock);
+	if (!sharedpool){
+		sharedpool.reset(new ThreadPool((sharedthreads > 0 ? sharedthreads : hardwareThreads()) - 1));
+	}
+	return *sharedpool;
+}
+
+void ThreadPool::setThreads(int threads){
+	std::lock_guard<std::mutex> lock(sharedlock);
+	if (!sharedpool){
+		sharedthreads = threads;
+	}
+}
+
+int ThreadPool::threads(){
+	std::lock_guard<std::mutex> lock(sharedlock);
+	if (sharedpool){
+		return sharedpool->size() + 1;
+	}
+	return sharedthreads > 0 ? sharedthreads : hardwareThreads();
+}
+
+std::string describePool(const PoolStats& before, const PoolStats& after){
+	double span = after.uptime - before.uptime;
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%d workers, %lld tasks (%lld stolen), busy", after.workers,
+		after.tasks - before.tasks, after.steals - before.steals);
+	std::string out = buf;
+	for (unsigned i = 0; i < after.busy.size(); i++){
+		double was = i < before.busy.size() ? before.busy[i] : 0;
+		snprintf(buf, sizeof(buf), " %.0f%%", span > 0 ? 100 * (after.busy[i] - was) / span : 0.0);
+		out += buf;
+	}
+	if (after.busy.empty()){
+		out += " -";
+	}
+	return out;
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Flag for stopping work early. Copies share the flag, so a token handed to
+// a background task can be cancelled from the editor thread.
+class CancelToken {
+public:
+	CancelToken() : flag(std::make_shared<std::atomic<bool> >(false)) {}
+	void cancel() { *flag = true; }
+	bool cancelled() const { return *flag; }
+
+private:
+	std::shared_ptr<std::atomic<bool> > flag;
+};
+
+// Counters of a ThreadPool, all since it started.
+struct PoolStats {
+	int workers = 0;
+	long long tasks = 0;      // Tasks run, by workers or by threads waiting on a group
+	long long steals = 0;     // Tasks a worker took from another worker's deque
+	double uptime = 0;        // Seconds
+	std::vector<double> busy; // Seconds each worker spent running tasks
+};
+
+// One line of how busy each worker was between two stats() calls.
+std::string describePool(const PoolStats& before, const PoolStats& after);
+
+class ThreadPool;
+
+// Tasks that are waited for together. wait() runs the group's own queued
+// tasks on the calling thread, so a task can wait on a group of its own
+// without tying up a worker, then sleeps until the ones other threads took
+// are done. Tasks of other groups are never run by wait(), so a short
+// parallelFor is not held up behind a long one started elsewhere.
+class TaskGroup {
+public:
+	explicit TaskGroup(ThreadPool& _pool);
+	~TaskGroup();
+
+	void run(const std::function<void()>& task);
+	void wait();
+
+private:
+	friend class ThreadPool;
+	ThreadPool& pool;
+	std::atomic<int> pending;
+	std::atomic<int> queued;  // Of pending, the ones no thread has taken yet
+	std::mutex lock;          // Guards the last decrement of pending
+	std::condition_variable done;
+};
+
+// Work-stealing scheduler. Every worker has its own deque: it takes its own
+// tasks from the back (newest first, while their data is still in cache)
+// and, once that is empty, steals the oldest task from the front of another
+// worker's deque. Tasks queued by threads outside the pool are dealt to the
+// workers in turn. Idle workers sleep until something is queued.
+class ThreadPool {
+public:
+	explicit ThreadPool(int workers);
+	~ThreadPool();
+
+	int size() const { return (int)workers.size(); }
+	PoolStats stats() const;
+
+	// The pool parallelFor runs on, created on first use with threads() - 1
+	// workers (the thread calling parallelFor works too). setThreads only
+	// has an effect before that.
+	static ThreadPool& shared();
+	static void setThreads(int threads);
+	static int threads();
+
+private:
+	friend class TaskGroup;
+	struct Task {
+		std::function<void()> fn;
+		TaskGroup* group;
+	};
+	struct Worker {
+		std::mutex lock;
+		std::deque<Task> tasks;
+		std::thread thread;
+		std::atomic<long long> busy; // Nanoseconds
+		Worker() : busy(0) {}
+	};
+
+	void push(const Task& task);
+	bool take(int self, Task& task);
+	bool takeOwn(int self, const TaskGroup* group, Task& task);
+	void execute(Task& task);
+	void loop(int self);
+
+	std::vector<std::unique_ptr<Worker> > workers;
+	std::mutex sleeplock;
+	std::condition_variable wake;
+	std::atomic<int> queued;
+	std::atomic<unsigned> dealt;
+	std::atomic<long long> tasks;
+	std::atomic<long long> steals;
+	bool stopping = false;
+	std::chrono::steady_clock::time_point started;
+};
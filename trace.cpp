@@ -0,0 +1,311 @@
+#include "stdafx.h"
+#include "trace.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Events per buffer block
+#define TRACEBLOCK 1024
+// Milliseconds between drains by the writer thread
+#define TRACEFLUSHMS 500
+
+struct TraceEvent {
+	const char* name;
+	const char* category;
+	char phase;  // 'X' complete, 'i' instant, 'C' counter
+	long long ts;
+	long long dur;
+	const char* argname;
+	double arg;
+};
+
+struct TraceBlock {
+	TraceEvent events[TRACEBLOCK];
+	std::atomic<int> count;
+	std::atomic<TraceBlock*> next;
+	TraceBlock() : count(0), next(NULL) {}
+};
+
+// One thread's events. tail is only touched by that thread; head, read and
+// writtenname only under drainlock.
+struct ThreadTrace {
+	int tid;
+	std::string name;        // Under registrylock
+	std::string writtenname; // Name last written to the file
+	std::atomic<bool> finished;
+	TraceBlock* head;
+	int read;
+	TraceBlock* tail;
+	ThreadTrace() : tid(0), finished(false), head(NULL), read(0), tail(NULL) {}
+};
+
+// Registers the thread on its first event, marks its buffer finished when
+// the thread exits so the last drain can free it
+struct TraceHolder {
+	ThreadTrace* trace = NULL;
+	std::string name;
+	~TraceHolder(){
+		if (trace != NULL){
+			trace->finished.store(true, std::memory_order_release);
+		}
+	}
+};
+
+std::atomic<bool> Tracer::on(false);
+
+static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+static thread_local TraceHolder local;
+static std::mutex registrylock;
+static std::vector<ThreadTrace*> threads;
+static int nexttid = 1;
+
+static std::mutex drainlock;
+static FILE* out = NULL;
+static std::string outname;
+static std::atomic<long long> written(0);
+
+static std::thread writer;
+static std::mutex writerlock;
+static std::condition_variable writerwake;
+static bool writerstop = false;
+
+// Finishes the file if the program exits while recording
+static struct TraceCloser {
+	~TraceCloser(){
+		Tracer::stop();
+	}
+} closer;
+
+static void append(const TraceEvent& e){
+	ThreadTrace* t = local.trace;
+	if (t == NULL){
+		t = new ThreadTrace();
+		t->head = t->tail = new TraceBlock();
+		std::lock_guard<std::mutex> lock(registrylock);
+		t->tid = nexttid++;
+		t->name = local.name.empty() ? "Thread " + std::to_string(t->tid) : local.name;
+		threads.push_back(t);
+		local.trace = t;
+	}
+	TraceBlock* b = t->tail;
+	int n = b->count.load(std::memory_order_relaxed);
+	if (n == TRACEBLOCK){
+		TraceBlock* next = new TraceBlock();
+		b->next.store(next, std::memory_order_release);
+		t->tail = b = next;
+		n = 0;
+	}
+	b->events[n] = e;
+	b->count.store(n + 1, std::memory_order_release);
+}
+
+// Writes s as a quoted JSON string, so names with quotes, backslashes or
+// control characters still give a valid file
+static void writeString(const char* s){
+	fputc('"', out);
+	for (; *s != 0; s++){
+		unsigned char c = (unsigned char)*s;
+		if (c == '"' || c == '\\'){
+			fputc('\\', out);
+			fputc(c, out);
+		}
+		else if (c < 0x20){
+			fprintf(out, "\\u%04x", c);
+		}
+		else {
+			fputc(c, out);
+		}
+	}
+	fputc('"', out);
+}
+
+static void writeEvent(int tid, const TraceEvent& e){
+	fputs(written > 0 ? ",\n" : "\n", out);
+	fputs("{\"name\":", out);
+	writeString(e.name);
+	if (e.phase == 'X'){
+		fputs(",\"cat\":", out);
+		writeString(e.category);
+		fprintf(out, ",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":1,\"tid\":%d}", e.ts, e.dur, tid);
+	}
+	else if (e.phase == 'i'){
+		fputs(",\"cat\":", out);
+		writeString(e.category);
+		fprintf(out, ",\"ph\":\"i\",\"s\":\"t\",\"ts\":%lld,\"pid\":1,\"tid\":%d", e.ts, tid);
+		if (e.argname != NULL){
+			fputs(",\"args\":{", out);
+			writeString(e.argname);
+			fprintf(out, ":%g}", e.arg);
+		}
+		fputs("}", out);
+	}
+	else {
+		fprintf(out, ",\"ph\":\"C\",\"ts\":%lld,\"pid\":1,\"tid\":%d,\"args\":{\"value\":%g}}", e.ts, tid, e.arg);
+	}
+	written++;
+}
+
+// Reads every complete event, writing it when there is a file. Buffers of
+// threads that have exited are freed once empty. Call with drainlock held.
+static void drain(){
+	std::vector<ThreadTrace*> list;
+	{
+		std::lock_guard<std::mutex> lock(registrylock);
+		list = threads;
+	}
+	for (ThreadTrace* t : list){
+		// Loaded first: a finished thread added nothing after setting it
+		bool finished = t->finished.load(std::memory_order_acquire);
+		if (out != NULL){
+			std::string name;
+			{
+				std::lock_guard<std::mutex> lock(registrylock);
+				name = t->name;
+			}
+			if (name != t->writtenname){
+				fputs(written > 0 ? ",\n" : "\n", out);
+				fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", t->tid);
+				writeString(name.c_str());
+				fputs("}}", out);
+				written++;
+				t->writtenname = name;
+			}
+		}
+		for (;;){
+			TraceBlock* b = t->head;
+			int n = b->count.load(std::memory_order_acquire);
+			for (; t->read < n; t->read++){
+				if (out != NULL){
+					writeEvent(t->tid, b->events[t->read]);
+				}
+			}
+			TraceBlock* next = n == TRACEBLOCK ? b->next.load(std::memory_order_acquire) : NULL;
+			if (next == NULL){
+				break;
+			}
+			// The thread moved on to next and never touches b again
+			delete b;
+			t->head = next;
+			t->read = 0;
+		}
+		if (finished && t->head->next.load() == NULL && t->read == t->head->count.load()){
+			std::lock_guard<std::mutex> lock(registrylock);
+			threads.erase(std::find(threads.begin(), threads.end(), t));
+			delete t->head;
+			delete t;
+		}
+	}
+}
+
+static void writerLoop(){
+	std::unique_lock<std::mutex> lock(writerlock);
+	while (!writerstop){
+		writerwake.wait_for(lock, std::chrono::milliseconds(TRACEFLUSHMS));
+		if (writerstop){
+			break;
+		}
+		lock.unlock();
+		Tracer::flush();
+		lock.lock();
+	}
+}
+
+bool Tracer::start(const std::string& filename){
+	std::lock_guard<std::mutex> lock(drainlock);
+	if (on){
+		return false;
+	}
+	FILE* f = fopen(filename.c_str(), "wb");
+	if (f == NULL){
+		return false;
+	}
+	// Drop whatever was recorded after the last stop()
+	drain();
+	out = f;
+	outname = filename;
+	written = 0;
+	fputs("{\"traceEvents\":[", out);
+	std::lock_guard<std::mutex> registry(registrylock);
+	for (ThreadTrace* t : threads){
+		t->writtenname.clear();
+	}
+	writerstop = false;
+	writer = std::thread(writerLoop);
+	on = true;
+	return true;
+}
+
+void Tracer::stop(){
+	if (!on){
+		return;
+	}
+	on = false;
+	{
+		std::lock_guard<std::mutex> lock(writerlock);
+		writerstop = true;
+	}
+	writerwake.notify_all();
+	writer.join();
+	std::lock_guard<std::mutex> lock(drainlock);
+	drain();
+	fputs("\n],\"displayTimeUnit\":\"ms\"}\n", out);
+	fclose(out);
+	out = NULL;
+}
+
+void Tracer::flush(){
+	std::lock_guard<std::mutex> lock(drainlock);
+	if (out != NULL){
+		drain();
+		fflush(out);
+	}
+}
+
+std::string Tracer::file(){
+	std::lock_guard<std::mutex> lock(drainlock);
+	return outname;
+}
+
+long long Tracer::events(){
+	return written;
+}
+
+void Tracer::nameThread(const std::string& name){
+	local.name = name;
+	if (local.trace != NULL){
+		std::lock_guard<std::mutex> lock(registrylock);
+		local.trace->name = name;
+	}
+}
+
+long long Tracer::micros(std::chrono::steady_clock::time_point t){
+	return std::chrono::duration_cast<std::chrono::microseconds>(t - epoch).count();
+}
+
+void Tracer::complete(const char* name, const char* category, long long begin, long long end){
+	if (!recording()){
+		return;
+	}
+	TraceEvent e = { name, category, 'X', begin, end - begin, NULL, 0 };
+	append(e);
+}
+
+void Tracer::instant(const char* name, const char* category, const char* argname, double arg){
+	if (!recording()){
+		return;
+	}
+	TraceEvent e = { name, category, 'i', now(), 0, argname, arg };
+	append(e);
+}
+
+void Tracer::counter(const char* name, double value){
+	if (!recording()){
+		return;
+	}
+	TraceEvent e = { name, NULL, 'C', now(), 0, NULL, value };
+	append(e);
+}
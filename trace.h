@@ -0,0 +1,58 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <string>
+
+// Records what every thread does as Chrome trace events, for
+// chrome://tracing or ui.perfetto.dev. Recording is switched on and off at
+// runtime; while it is off, every event costs one relaxed atomic load.
+//
+// Each thread appends to a buffer of its own without locking: events go
+// into fixed-size blocks, and a block's count is published with a release
+// store. A writer thread drains the buffers into the file every half
+// second, so memory stays bounded however long a session is recorded.
+// Names are kept as pointers and must be string literals.
+class Tracer {
+public:
+	// Starts writing a trace to filename, returns false if it can't be
+	// created. Events left over from an earlier recording are dropped.
+	static bool start(const std::string& filename);
+	// Writes what is left and closes the file.
+	static void stop();
+	// Writes every event recorded so far.
+	static void flush();
+	static bool recording() { return on.load(std::memory_order_relaxed); }
+	static std::string file();
+	static long long events();  // Written to the current file so far
+
+	// Shown as the name of the calling thread's track.
+	static void nameThread(const std::string& name);
+
+	// Microseconds on the trace clock.
+	static long long micros(std::chrono::steady_clock::time_point t);
+	static long long now() { return micros(std::chrono::steady_clock::now()); }
+
+	static void complete(const char* name, const char* category, long long begin, long long end);
+	static void instant(const char* name, const char* category, const char* argname = NULL, double arg = 0);
+	static void counter(const char* name, double value);
+
+private:
+	static std::atomic<bool> on;
+};
+
+// Records its lifetime as one complete event on the calling thread.
+class TraceScope {
+public:
+	TraceScope(const char* _name, const char* _category) : name(_name), category(_category), begin(Tracer::recording() ? Tracer::now() : -1){
+	}
+	~TraceScope(){
+		if (begin >= 0 && Tracer::recording()){
+			Tracer::complete(name, category, begin, Tracer::now());
+		}
+	}
+
+private:
+	const char* name;
+	const char* category;
+	long long begin;
+};